@@ -43,8 +43,10 @@ enum TErrorCode {
     E_SIGNAL         = -5,  /**< failed to register or deregister signal 
                                  handlers */
     E_THREAD         = -6,  /**< failed to create service thread */
-    E_IOCTL          = -7   /**< ioctl() call to the MOST NetServices driver 
+    E_IOCTL          = -7,  /**< ioctl() call to the MOST NetServices driver 
                                  failed */
+    E_CONTROL        = -8   /**< the service thread lost the control driver
+                                 and couldn't reopen it yet */
 };
 
 /**
@@ -146,6 +148,19 @@ void MostStartUpOriginal(byte mode, byte opt);
  */
 void LinuxPrintRoutingTable(void);
 
+/**
+ * Extension to check the service thread. If reading the interrupts from the
+ * control driver fails, the service thread reopens the driver about once per
+ * second. Until that succeeds, no interrupts reach the NetServices (only
+ * requests and timers are served), so an application should poll this
+ * function and e.g. call CloseNetServices() and OpenNetServices() itself if
+ * the error persists.
+ *
+ * @return E_SUCCESS if the service thread receives the interrupts and
+ *         E_CONTROL if it lost the control driver
+ */
+short LinuxGetServiceError(void);
+
 /*
  * In the main file, declare the global variables.
  */
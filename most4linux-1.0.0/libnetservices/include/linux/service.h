@@ -26,21 +26,22 @@
 #define SERVICE_H
 
 /**
- * Number of real-time signal to use. Because we don't support LinuxThread
- * implementation but rely on POSIX Threads (NTPL), we can safely use SIGRTMIN
- * here.
+ * Wakeup reason for service_thread_wakeup(): the NetServices requested a call
+ * of MostService() (MnsRequest()).
  */
-#define MOST_RT_SIGNAL          SIGRTMIN
+#define SERVICE_WAKEUP_REQUEST  0x01
 
 /**
- * The interrupt used for timers.
+ * Wakeup reason for service_thread_wakeup(): the NetServices requested a timer
+ * update (MnsRequestTimer()).
  */
-#define MOST_RT_SIGNAL_TIMER    (SIGRTMIN + 1)
+#define SERVICE_WAKEUP_TIMER    0x02
 
 
 /**
- * Initializes the service thread including the interrupt (= signal) handling.
- * The thread has to be killed with service_thread_finish.
+ * Initializes the service thread including the interrupt handling. The
+ * interrupts are read from the control driver, no signals are used. The
+ * thread has to be killed with service_thread_finish.
  *
  * @return an error code of type TErrorCode (delared in mostnetsdll.h).
  */
@@ -51,6 +52,16 @@ int service_thread_init(void);
  */
 void service_thread_finish(void);
 
+/**
+ * Wakes up the service thread. Requests that arrive before the service thread
+ * has processed the previous ones are merged, so only the first request after
+ * the thread woke up costs a system call. This function may be called from
+ * any thread, also from within MostService().
+ *
+ * @param reason SERVICE_WAKEUP_REQUEST and/or SERVICE_WAKEUP_TIMER
+ */
+void service_thread_wakeup(unsigned int reason);
+
 
 
 #endif /* SERVICE_H */
@@ -22,13 +22,10 @@
  * the Initial Developer. All Rights Reserved.
  * ----------------------------------------------------------------------------
  */
-#include <signal.h>
 #include <pthread.h>
 #include <semaphore.h>
 #include <time.h>
 #include <assert.h>
-#include <unistd.h>
-#include <sys/types.h>
 #include <sys/ioctl.h>
 
 #include <adjust.h>
@@ -45,32 +42,21 @@
 /* -------------------------------------------------------------------------- */
 void MnsRequest(word flags)
 {
-    union sigval val;
-
     PRINT_TRACE("flags = %d", flags);
 
-    val.sival_int = MNS_INT;
-
     /*
-     * send the current process a MOST_RT_SIGNAL signal with a MNS_INT value
-     * because that's the same as an interrupt
-     *
-     * The process blocks the signal and the service thread gets notified
+     * the service thread handles the request like an interrupt, requests
+     * that arrive while the previous one is pending are merged
      */
-    sigqueue(getpid(), MOST_RT_SIGNAL, val);
+    service_thread_wakeup(SERVICE_WAKEUP_REQUEST);
 }
 
 /* -------------------------------------------------------------------------- */
 void MnsRequestTimer(void)
 {
-    union sigval val;
-
     PRINT_TRACE();
 
-    val.sival_int = 0;
-
-    /* ensure that si_value.sigval_int is zero */
-    sigqueue(getpid(), MOST_RT_SIGNAL_TIMER, val);
+    service_thread_wakeup(SERVICE_WAKEUP_TIMER);
 }
 
 /* -------------------------------------------------------------------------- */
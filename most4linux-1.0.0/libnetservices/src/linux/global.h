@@ -37,6 +37,13 @@
  */
 extern int g_control_fd;
 
+/**
+ * Opens the control driver of the instance InstID.
+ *
+ * @return the new file descriptor or -1 on error (see errno)
+ */
+int control_open(void);
+
 /**
  * Mutex for locking MOST NetServices because of multi-threading */
 extern pthread_mutex_t g_nets_mutex;
@@ -54,15 +54,21 @@ pthread_mutex_t g_nets_mutex = PTHREAD_MUTEX_INITIALIZER;
 #define NETSERVICE_DEVICE_FILE      "/dev/mostnets%d"
 
 /* -------------------------------------------------------------------------- */
-short OpenNetServices(void)
+int control_open(void)
 {
     char buffer[PATH_MAX];
-    
+
+    snprintf(buffer, PATH_MAX, NETSERVICE_DEVICE_FILE, InstID);
+    return open(buffer, O_RDWR);
+}
+
+/* -------------------------------------------------------------------------- */
+short OpenNetServices(void)
+{
     PRINT_TRACE();
 
     /* open the driver */
-    snprintf(buffer, PATH_MAX, NETSERVICE_DEVICE_FILE, InstID);
-    g_control_fd = open(buffer, O_RDWR);
+    g_control_fd = control_open();
     if (g_control_fd < 0) {
         PERR_DEBUG("Failed to open control driver");
         return E_OPEN_DRIVER;
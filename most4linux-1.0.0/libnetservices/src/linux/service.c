@@ -23,13 +23,23 @@
  * ----------------------------------------------------------------------------
  */
 #include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdint.h>
+#include <unistd.h>
 #include <sys/ioctl.h>
-#include <signal.h>
 #include <pthread.h>
 #include <semaphore.h>
 #include <time.h>
 #include <assert.h>
 
+/* eventfd() is available in glibc since version 2.8 */
+#if defined(__GLIBC__) && \
+    (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 8))
+#   include <sys/eventfd.h>
+#   define SERVICE_HAVE_EVENTFD
+#endif
+
 #include <adjust.h>
 #include <mostdef1.h>
 #include <mostns1.h>
@@ -41,10 +51,46 @@
 #include "service.h"
 
 static pthread_t    service_thread_descriptor;
-static sigset_t     old_sigset;
 static sem_t        startup_sem;
 static sem_t        thread_sem;
 
+/**
+ * The file descriptors used to wake up the service thread, [0] is read by the
+ * thread and [1] is written by service_thread_wakeup(). With eventfd() both
+ * are the same file descriptor, else it's a pipe.
+ */
+static int          wakeup_fd[2]                = { -1, -1 };
+
+/**
+ * Protects wakeup_fd[1] against wakeup_close(), so a late
+ * service_thread_wakeup() doesn't write to a closed (or reused) descriptor.
+ */
+static pthread_mutex_t wakeup_mutex             = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Time in milliseconds the service thread waits after poll() failed, so a
+ * persistent error doesn't make it spin.
+ */
+#define SERVICE_ERROR_BACKOFF_MS                100
+
+/**
+ * Time in milliseconds between two attempts of the service thread to reopen a
+ * failed control driver.
+ */
+#define SERVICE_REOPEN_MS                       1000
+
+/**
+ * E_SUCCESS or E_CONTROL if the service thread lost the control driver, see
+ * LinuxGetServiceError().
+ */
+static volatile short control_error             = E_SUCCESS;
+
+/**
+ * The SERVICE_WAKEUP_* reasons that the service thread has not processed yet.
+ * Only the change from zero to non-zero writes to wakeup_fd.
+ */
+static volatile unsigned int wakeup_pending     = 0;
+
 /* inspired by ns_main.c (Coguar example) */
 static unsigned int events_mns                  = 0;
 
@@ -55,23 +101,186 @@ void MostStartUpFinished(void)
     sem_post(&startup_sem);
 }
 
+/* -------------------------------------------------------------------------- */
+static int set_nonblocking(int fd)
+{
+    int flags = fcntl(fd, F_GETFL);
+
+    if (flags < 0) {
+        return -1;
+    }
+
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+/* -------------------------------------------------------------------------- */
+static int wakeup_open(void)
+{
+    int fds[2];
+
+#ifdef SERVICE_HAVE_EVENTFD
+    fds[0] = eventfd(0, 0);
+    if (fds[0] >= 0) {
+        if (set_nonblocking(fds[0]) != 0) {
+            close(fds[0]);
+            return -1;
+        }
+        pthread_mutex_lock(&wakeup_mutex);
+        wakeup_fd[0] = wakeup_fd[1] = fds[0];
+        pthread_mutex_unlock(&wakeup_mutex);
+        return 0;
+    }
+
+    /* kernel without eventfd(), use a pipe */
+#endif
+    if (pipe(fds) != 0) {
+        return -1;
+    }
+    if (set_nonblocking(fds[0]) != 0 || set_nonblocking(fds[1]) != 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+
+    pthread_mutex_lock(&wakeup_mutex);
+    wakeup_fd[0] = fds[0];
+    wakeup_fd[1] = fds[1];
+    pthread_mutex_unlock(&wakeup_mutex);
+
+    return 0;
+}
+
+/* -------------------------------------------------------------------------- */
+static void wakeup_close(void)
+{
+    int fds[2];
+
+    /* no service_thread_wakeup() uses the descriptors after this */
+    pthread_mutex_lock(&wakeup_mutex);
+    fds[0] = wakeup_fd[0];
+    fds[1] = wakeup_fd[1];
+    wakeup_fd[0] = wakeup_fd[1] = -1;
+    pthread_mutex_unlock(&wakeup_mutex);
+
+    if (fds[1] != fds[0]) {
+        close(fds[1]);
+    }
+    close(fds[0]);
+}
+
+/* -------------------------------------------------------------------------- */
+static unsigned int wakeup_fetch(void)
+{
+    char buffer[sizeof(uint64_t)];
+
+    /* empty the eventfd counter or the pipe */
+    while (read(wakeup_fd[0], buffer, sizeof(buffer)) > 0)
+        ;
+
+    /*
+     * fetch the reasons after emptying the file descriptor, so a request
+     * that arrives in between is either fetched now or writes again
+     */
+    return __sync_fetch_and_and(&wakeup_pending, 0);
+}
+
+/* -------------------------------------------------------------------------- */
+void service_thread_wakeup(unsigned int reason)
+{
+    uint64_t    one = 1;
+    int         cancel_state;
+
+    /* somebody else already woke up the thread */
+    if (__sync_fetch_and_or(&wakeup_pending, reason) != 0) {
+        return;
+    }
+
+    /* write() is a cancellation point, the mutex must not stay locked */
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &cancel_state);
+    pthread_mutex_lock(&wakeup_mutex);
+
+    /*
+     * before service_thread_init() (or after service_thread_finish()) the
+     * request just stays pending, the service thread fetches it in its first
+     * loop iteration
+     */
+    if (wakeup_fd[1] >= 0) {
+        /* eventfd needs 8 bytes, a pipe takes them as well */
+        if (write(wakeup_fd[1], &one, sizeof(one)) < 0 && errno != EAGAIN) {
+            PERR_DEBUG("Waking up the service thread failed");
+        }
+    }
+
+    pthread_mutex_unlock(&wakeup_mutex);
+    pthread_setcancelstate(cancel_state, NULL);
+}
+
+/* -------------------------------------------------------------------------- */
+short LinuxGetServiceError(void)
+{
+    return control_error;
+}
+
+/* -------------------------------------------------------------------------- */
+static int control_reopen(void)
+{
+    struct interrupt_set_arg    interrupt_set = {0, MNS_INT};
+    int                         fd;
+    int                         cancel_state;
+    int                         ret = -1;
+
+    /* service_thread_finish() must not cancel us with the new descriptor open */
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &cancel_state);
+
+    fd = control_open();
+    if (fd < 0) {
+        goto out;
+    }
+
+    if (ioctl(fd, MOST_NETS_IRQ_SET, &interrupt_set) < 0) {
+        goto out_close;
+    }
+
+    /*
+     * the other threads keep using g_control_fd, so replace the file behind
+     * that number instead of changing the number
+     */
+    if (dup2(fd, g_control_fd) < 0) {
+        interrupt_set.sigmask = 0;
+        ioctl(fd, MOST_NETS_IRQ_SET, &interrupt_set);
+        goto out_close;
+    }
+    ret = 0;
+
+out_close:
+    close(fd);
+out:
+    pthread_setcancelstate(cancel_state, NULL);
+    return ret;
+}
+
 /* -------------------------------------------------------------------------- */
 void *service_thread_func(void *cookie)
 {
     int                 ret;
-    sigset_t            sig;
-    struct timespec     next_timeout         = { 0, 0 };
-    siginfo_t           sinfo;
+    struct pollfd       fds[2];
+    int                 next_timeout         = 0;
+    unsigned int        reason;
+    unsigned char       irq;
     long long           last_time, cur_time, time_diff;
+    long long           reopen_time          = 0;
     int                 tmp;
     int                 most_service         = 0;
+    int                 control_failed;
+    ssize_t             len;
 
     PRINT_TRACE();
 
-    /* initialize the sigset_t value */
-    sigemptyset(&sig);
-    sigaddset(&sig, MOST_RT_SIGNAL);
-    sigaddset(&sig, MOST_RT_SIGNAL_TIMER);
+    /* the control driver is readable if an interrupt occurred */
+    fds[0].fd       = g_control_fd;
+    fds[0].events   = POLLIN;
+    fds[1].fd       = wakeup_fd[0];
+    fds[1].events   = POLLIN;
 
     /* signal the init function to continue */
     sem_post(&thread_sem);
@@ -84,22 +293,69 @@ void *service_thread_func(void *cookie)
     TIME_IN_MS(last_time);
         
     for (;;) {
-        PRINT_TRACE("Waiting for a signal, timeout = { %ld, %ld }", next_timeout.tv_sec,
-                                                                    next_timeout.tv_nsec);
+        PRINT_TRACE("Waiting for an event, timeout = %d ms", next_timeout);
 
         /* wait for the next interrupt or request */
-        ret = sigtimedwait(&sig, &sinfo, &next_timeout);
-        if (ret == -1 && errno != EAGAIN) {
-            PERR_DEBUG("sigtimedwait error");
+        ret = poll(fds, 2, next_timeout);
+        if (ret < 0) {
+            if (errno != EINTR) {
+                PERR_DEBUG("poll error");
+                usleep(SERVICE_ERROR_BACKOFF_MS * 1000);
+            }
             continue;
         }
 
-        PRINT_TRACE("Signal received, ret = %d, value = %d", ret, sinfo.si_value.sival_int);
+        /* read the interrupt (the byte only tells MNS_INT or MNS_AINT) */
+        irq = 0;
+        control_failed = 0;
+        if (fds[0].revents & (POLLERR | POLLHUP | POLLNVAL)) {
+            control_failed = 1;
+        } else if (fds[0].revents & POLLIN) {
+            len = read(g_control_fd, &irq, 1);
+            if (len != 1) {
+                control_failed = len == 0 || (errno != EAGAIN && errno != EINTR);
+                irq = 0;
+            }
+        }
+
+        TIME_IN_MS(cur_time);
+
+        /*
+         * the control driver failed (or doesn't support poll()), poll() would
+         * return at once forever, so only requests and timers are served
+         * until it could be reopened, the application sees that with
+         * LinuxGetServiceError()
+         */
+        if (control_failed) {
+            PERR_DEBUG("Reading the interrupt failed, reopening the driver");
+            fds[0].fd = -1;
+            control_error = E_CONTROL;
+        }
+
+        /*
+         * at most one attempt per SERVICE_REOPEN_MS, so a driver that fails
+         * again at once doesn't make us spin; the timeout is at most one
+         * second, so this runs often enough
+         */
+        if (fds[0].fd < 0 && cur_time - reopen_time >= SERVICE_REOPEN_MS) {
+            reopen_time = cur_time;
+            if (control_reopen() == 0) {
+                PRINT_DBG("Reopened the control driver");
+                fds[0].fd = g_control_fd;
+                control_error = E_SUCCESS;
+
+                /* an interrupt may have been missed in between */
+                irq = MNS_INT;
+            }
+        }
+
+        reason = wakeup_fetch();
+
+        PRINT_TRACE("Woken up, ret = %d, interrupt = %d, reason = %d", ret, irq, reason);
 
-        /* now ret == -1 is timeout, all other values are signals */
+        /* now ret == 0 is timeout, but requests may be pending from startup */
 
         /* calculate the difference */
-        TIME_IN_MS(cur_time);
         time_diff = cur_time - last_time;
         last_time = cur_time;
 
@@ -108,26 +364,14 @@ void *service_thread_func(void *cookie)
 
         MostTimerIntDiff( (word)time_diff );
 
-        /* calculate the next timeout */
+        /* calculate the next timeout, "infinite" (0xffff) is one second */
         tmp = MostGetMinTimeout();
-        if (tmp == 0xffff) {
-            /* wait one second, that should be ok for "infinite" */
-            next_timeout.tv_sec     = 1;
-            next_timeout.tv_nsec    = 0;
-        } else {
-            next_timeout.tv_sec  = tmp / 1000;
-            tmp %= 1000;
-            next_timeout.tv_nsec = tmp * 1000 * 1000;
-        }
 
         /* maximum timeout is 1 s */
-        if (next_timeout.tv_sec > 0) {
-            next_timeout.tv_sec = 1;
-            next_timeout.tv_nsec = 0;
-        }
+        next_timeout = tmp > 1000 ? 1000 : tmp;
 
         /* only timeout, nothing to do, timers are updated */
-        if (ret == -1 && !most_service) {
+        if (irq == 0 && reason == 0 && !most_service) {
             continue;
         }
 
@@ -135,12 +379,12 @@ void *service_thread_func(void *cookie)
         events_mns = 0;
 
         /* now get the event that caued the process to continue */
-        if (ret == MOST_RT_SIGNAL && sinfo.si_value.sival_int == MNS_INT) {
+        if ((irq & MNS_INT) || (reason & SERVICE_WAKEUP_REQUEST)) {
             events_mns |= MNS_E_INT | MNS_E_REQ;
         }
 
         /* timer events */
-        if (ret == MOST_RT_SIGNAL_TIMER) {
+        if (reason & SERVICE_WAKEUP_TIMER) {
             events_mns |= MNS_E_TIMER;
         }
     
@@ -172,34 +416,34 @@ void *service_thread_func(void *cookie)
 int service_thread_init(void)
 {
     int                         ret;
-    sigset_t                    sig;
-    struct interrupt_set_arg    interrupt_set = {MOST_RT_SIGNAL, MNS_INT};
+    struct interrupt_set_arg    interrupt_set = {0, MNS_INT};
 
     PRINT_TRACE();
 
     /* initialize the semaphore (in "locked" state) */
     sem_init(&startup_sem, 0, 0);
     sem_init(&thread_sem, 0, 0);
-        
-    /* modify the interrupt mask of the process */
-    sigemptyset(&sig);
-    sigaddset(&sig, MOST_RT_SIGNAL);
-    sigaddset(&sig, MOST_RT_SIGNAL_TIMER);
-    
-    ret = sigprocmask(SIG_BLOCK, &sig, &old_sigset);
+
+    /* create the file descriptor for MnsRequest() and MnsRequestTimer() */
+    ret = wakeup_open();
     if (ret != 0) {
-        PERR_DEBUG("Setting procmask failed");
+        PERR_DEBUG("Creating the wakeup file descriptor failed");
         return E_SIGNAL;
     }
 
-    /* register the signal at the driver */
+    /*
+     * enable the interrupt at the driver, no signal: the service thread
+     * reads the interrupts from the control driver
+     */
     ret = ioctl(g_control_fd, MOST_NETS_IRQ_SET, &interrupt_set);
     if (ret < 0) {
         PERR_DEBUG("Registering interrupts at the driver failed");
         ret = E_IOCTL;
-        goto out_procmask;
+        goto out_wakeup;
     }
     
+    control_error = E_SUCCESS;
+
     /* start the service thread */
     ret = pthread_create(&service_thread_descriptor, NULL, service_thread_func, NULL);
     if (ret < 0) {
@@ -213,11 +457,11 @@ int service_thread_init(void)
 
     return E_SUCCESS;
 
-out_procmask:
-    sigprocmask(SIG_SETMASK, &old_sigset, NULL);
 out_ioctl:
     interrupt_set.sigmask   = 0;
     ioctl(g_control_fd, MOST_NETS_IRQ_SET, &interrupt_set);
+out_wakeup:
+    wakeup_close();
     return ret;
 }
 
@@ -227,7 +471,7 @@ void service_thread_finish(void)
     struct interrupt_set_arg    interrupt_set = {0, 0};
     int                         ret;
     
-    /* deregister the signal of the driver */
+    /* disable the interrupt at the driver */
     ret = ioctl(g_control_fd, MOST_NETS_IRQ_SET, &interrupt_set);
     if (ret < 0) {
         PERR_DEBUG("Deregistering interrupts at the driver failed");
@@ -239,11 +483,13 @@ void service_thread_finish(void)
         PERR_DEBUG("Cancelling service thread failed");
     }
 
-    /* restore the interrupt mask of the process */ 
-    ret = sigprocmask(SIG_SETMASK, &old_sigset, NULL);
+    /* wait for the thread before its file descriptor goes away */
+    ret = pthread_join(service_thread_descriptor, NULL);
     if (ret != 0) {
-        PERR_DEBUG("Restoring procmask failed");
+        PERR_DEBUG("Joining service thread failed");
     }
+
+    wakeup_close();
 }
 
 /* vim: set ts=4 et sw=4: */
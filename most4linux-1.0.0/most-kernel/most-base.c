@@ -76,6 +76,17 @@ RWSEMA_LOCKED_LIST(most_base_high_drivers_sema);
  */
 SPIN_LOCKED_LIST(most_base_high_drivers_spin);
 
+/**
+ * @copydoc most_base_int_table
+ */
+struct most_int_table *most_base_int_table = NULL;
+
+/**
+ * The two interrupt dispatch tables, one is published in
+ * most_base_int_table and the other one is built on the next change.
+ */
+static struct most_int_table most_int_tables[2];
+
 /**
  * The major id for all MOST devices.
  */
@@ -87,6 +98,66 @@ static dev_t major_id = 0;
 static atomic_t device_count = ATOMIC_INIT(0);
 
 
+/**
+ * Builds a new interrupt dispatch table from the list of high drivers and
+ * publishes it. The table which is not published is used for that, no reader
+ * can see it any more because the previous call has waited for them. So a
+ * published table is never modified and removing a driver cannot fail. Must
+ * be called with the lock of most_base_high_drivers_sema held for writing.
+ *
+ * @return 0 on success, @c -ENOSPC if there are more than MOST_INT_DRIVERS
+ *         drivers with an interrupt handler
+ */
+static int most_publish_int_table(void)
+{
+    struct most_int_table       *table;
+    struct list_head            *cursor;
+    struct most_high_driver     *driver;
+    unsigned int                slot = 0;
+    unsigned int                bit;
+#ifdef RT_RTDM
+    rtnrt_lockctx_t             flags;
+#endif
+
+    table = (most_base_int_table == &most_int_tables[0])
+        ? &most_int_tables[1]
+        : &most_int_tables[0];
+    memset(table, 0, sizeof(struct most_int_table));
+
+    list_for_each(cursor, &most_base_high_drivers_sema.list) {
+        driver = list_entry(cursor, struct most_high_driver, sema_list);
+        if (!driver->int_handler || !driver->interrupt_mask) {
+            continue;
+        }
+
+        if (slot >= MOST_INT_DRIVERS) {
+            rtnrt_warn(PR "More than %d drivers with interrupt handlers\n",
+                    MOST_INT_DRIVERS);
+            return -ENOSPC;
+        }
+
+        table->drivers[slot] = driver;
+        for (bit = 0; bit < MOST_INT_BITS; bit++) {
+            if (driver->interrupt_mask & (1 << bit)) {
+                table->bit_drivers[bit] |= 1 << slot;
+            }
+        }
+        slot++;
+    }
+
+    /* when this returns, no handler uses the old table any more */
+#ifdef RT_RTDM
+    rtnrt_lock_get_irqsave(&most_base_high_drivers_spin.lock, flags);
+    most_base_int_table = table;
+    rtnrt_lock_put_irqrestore(&most_base_high_drivers_spin.lock, flags);
+#else
+    rcu_assign_pointer(most_base_int_table, table);
+    synchronize_rcu();
+#endif
+
+    return 0;
+}
+
 /*
  * Documentation: see header
  */
@@ -95,10 +166,17 @@ int most_register_high_driver(struct most_high_driver *driver)
     struct list_head            *cursor;
     struct most_low_driver      *low_driver;
     rtnrt_lockctx_t             flags;
+    int                         err;
 
     /* add the driver to the global list of drivers */
     down_write(&most_base_high_drivers_sema.lock);
     list_add_tail(&driver->sema_list, &most_base_high_drivers_sema.list);
+    err = most_publish_int_table();
+    if (unlikely(err != 0)) {
+        list_del(&driver->sema_list);
+        up_write(&most_base_high_drivers_sema.lock);
+        return err;
+    }
     up_write(&most_base_high_drivers_sema.lock);
 
     /* add the driver to the global list of drivers */
@@ -143,9 +221,10 @@ void most_deregister_high_driver(struct most_high_driver *driver)
     list_del(&driver->spin_list);
     rtnrt_lock_put_irqrestore(&most_base_high_drivers_spin.lock, flags);
 
-    /* remove from the list */
+    /* remove from the list and the interrupt dispatch table */
     down_write(&most_base_high_drivers_sema.lock);
     list_del(&driver->sema_list);
+    most_publish_int_table();
     up_write(&most_base_high_drivers_sema.lock);
 }
 
@@ -209,6 +288,44 @@ void most_dev_free(struct most_dev* dev)
     kfree(dev);
 }
 
+/**
+ * Completion function of the transactions of most_transact8104().
+ *
+ * @param trans the transaction, @c data is the completion
+ */
+static void most_transact8104_done(struct most_8104_trans *trans)
+{
+    complete((struct completion *)trans->data);
+}
+
+/*
+ * Documentation: see header
+ */
+int most_transact8104(struct most_dev *dev, struct most_8104_op *ops,
+                      unsigned int nops)
+{
+    struct most_8104_trans  trans;
+    struct completion       done;
+    int                     err;
+
+    init_completion(&done);
+    memset(&trans, 0, sizeof(struct most_8104_trans));
+    trans.ops = ops;
+    trans.nops = nops;
+    trans.complete = most_transact8104_done;
+    trans.data = &done;
+
+    err = most_submit8104(dev, &trans);
+    if (unlikely(err != 0)) {
+        return err;
+    }
+
+    /* not interruptible, the transaction lives on the stack */
+    wait_for_completion(&done);
+
+    return trans.result;
+}
+
 /**
  * Sequence file operation for proc device. This function is executed on start
  * of the sequence file operation. Only one sequence is used, so the function
@@ -357,8 +474,10 @@ EXPORT_SYMBOL(most_register_low_driver);
 EXPORT_SYMBOL(most_deregister_low_driver);
 EXPORT_SYMBOL(most_base_high_drivers_sema);
 EXPORT_SYMBOL(most_base_high_drivers_spin);
+EXPORT_SYMBOL(most_base_int_table);
 EXPORT_SYMBOL(most_dev_new);
 EXPORT_SYMBOL(most_dev_free);
+EXPORT_SYMBOL(most_transact8104);
 
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("Bernhard Walle");
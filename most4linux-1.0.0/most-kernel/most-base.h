@@ -37,6 +37,8 @@
 #include <linux/interrupt.h>
 #include <linux/spinlock.h>
 #include <linux/seq_file.h>
+#include <linux/rcupdate.h>
+#include <linux/completion.h>
 
 #ifdef RT_RTDM
 #   include <rtdm/rtdm_driver.h>
@@ -98,6 +100,9 @@ typedef void (*changereg_func) (struct most_dev     *dev,
  * @param addr the address (consists of address and page part) to read from
  * @return the number of bytes that have been read successfully or a negative 
  *         error code
+ *
+ * The read is performed as transaction (see submit_8104_func), so the
+ * function may sleep.
  */
 typedef int (*read_os8104_func) (struct most_dev*   dev,
                                  unsigned char      *dest, 
@@ -113,6 +118,9 @@ typedef int (*read_os8104_func) (struct most_dev*   dev,
  * @param addr the address where to write (consists of address and page part)
  * @return the number of bytes that have been written successfully or a
  *         negative error code
+ *
+ * The write is performed as transaction (see submit_8104_func), so the
+ * function may sleep.
  */
 typedef int (*write_os8104_func) (struct most_dev*  dev,
                                   unsigned char     *src,
@@ -148,13 +156,132 @@ typedef void (*intclear_func) (struct most_dev    *dev,
                                unsigned int        interrupts);
 
 /**
- * Resets the MOST Transceiver.
+ * Waits until the interrupt handlers of the high drivers which are running for
+ * @p dev have returned, on another CPU or in the interrupt thread of the low
+ * driver. A high driver calls this after it has removed a buffer from the data
+ * its interrupt handler uses and before it frees or reuses the buffer. The
+ * function may sleep.
+ *
+ * @param dev the MOST device
+ */
+typedef void (*intsync_func) (struct most_dev *dev);
+
+/**
+ * The page state of the card for the receive and transmit interrupts (ISSRX,
+ * ISSTX) which the interrupt handlers of the high drivers are called for, see
+ * intlatch_func.
+ */
+struct most_int_latch {
+    u32                 srxctrl;        /**< SRXCTRL at the last ISSRX, SRXPP is
+                                             the page the card was about to
+                                             write */
+    u32                 stxctrl;        /**< STXCTRL at the last ISSTX */
+    unsigned int        rx_count;       /**< number of ISSRX interrupts the call
+                                             stands for, more than 1 if the
+                                             card completed several pages
+                                             before the handlers ran */
+    unsigned int        tx_count;       /**< the same for ISSTX */
+    bool                deferred;       /**< the handlers run in the interrupt
+                                             thread, i.e. possibly long after the
+                                             interrupt */
+};
+
+/**
+ * Returns the page state which the hard interrupt handler has latched for the
+ * interrupts the high drivers are called for. The low driver reads the control
+ * registers when the interrupt occurs, so a handler that runs later (in the
+ * interrupt thread of the low driver) still knows which page has been
+ * completed and how many pages it has missed. May only be called from an
+ * interrupt handler (irq_func).
+ *
+ * @param dev the MOST device
+ * @param latch the state is stored there
+ */
+typedef void (*intlatch_func) (struct most_dev          *dev,
+                               struct most_int_latch    *latch);
+
+/**
+ * Resets the MOST Transceiver. Waits for the running OS8104 access, so the
+ * function may sleep.
  *
  * @param dev the MOST device
  * @return 0 on success, an error code (e.g. -ERESTARTSYS) on failure
  */
 typedef void (*reset_func) (struct most_dev *dev);
 
+/**
+ * Type of an operation in a transaction on the OS8104 registers.
+ */
+enum most_8104_op_type {
+    MOST_8104_READ,                    /**< read @c len registers to @c buf */
+    MOST_8104_WRITE,                   /**< write @c len registers from @c buf */
+    MOST_8104_MODIFY                   /**< set the bits of @c mask in @c len
+                                            registers to the bits in @c buf */
+};
+
+/**
+ * One operation of a transaction on the OS8104 registers. The operation works
+ * on @p len consecutive registers like read_os8104_func and
+ * write_os8104_func.
+ */
+struct most_8104_op {
+    enum most_8104_op_type type;       /**< the type of the operation */
+    u32                    addr;       /**< the start address (consists of address
+                                            and page part) */
+    unsigned char          *buf;       /**< the values (kernelspace), must be valid
+                                            until the transaction is completed */
+    size_t                 len;        /**< the number of registers */
+    unsigned char          mask;       /**< the bits to change, only used for
+                                            MOST_8104_MODIFY */
+};
+
+struct most_8104_trans;
+
+/**
+ * Called when a transaction has been completed. The function is called in the
+ * context of a kernel thread of the low driver and must not block for long
+ * because it delays the following transactions.
+ *
+ * @param trans the transaction, @c result is valid
+ */
+typedef void (*most_8104_complete_func) (struct most_8104_trans *trans);
+
+/**
+ * A transaction on the OS8104 registers, i.e. a list of operations that are
+ * executed in order without operations of other transactions in between.
+ * The low driver executes the operations in slices of a few registers, so
+ * it neither disables the interrupts nor blocks other register accesses for
+ * the whole transaction.
+ */
+struct most_8104_trans {
+    struct most_8104_op     *ops;      /**< the operations */
+    unsigned int            nops;      /**< the number of operations */
+    most_8104_complete_func complete;  /**< called on completion */
+    void                    *data;     /**< private data of the caller */
+    int                     result;    /**< the number of registers that have been
+                                            accessed or a negative error code if an
+                                            operation failed */
+
+    /* private to the low driver */
+    struct list_head        list;      /**< the queue of the low driver */
+    unsigned int            op;        /**< the current operation, the failed one
+                                            if @c result is negative */
+    size_t                  pos;       /**< the current register of @c op */
+};
+
+/**
+ * Submits a transaction on the OS8104 registers. The function doesn't wait
+ * for the transaction and can be called in atomic context. The transaction
+ * must not be modified until it has been completed.
+ *
+ * @param dev the MOST device
+ * @param trans the transaction, @c ops, @c nops and @c complete must be set
+ * @return 0 on success, a negative error code if the transaction cannot be
+ *         queued (in that case, @c complete isn't called)
+ */
+typedef int (*submit_8104_func) (struct most_dev         *dev,
+                                 struct most_8104_trans  *trans);
+
 /**
  * DMA buffer
  */
@@ -245,8 +372,11 @@ struct most_ops {
     changereg_func     changereg;      /**< see description of changereg_func */
     read_os8104_func   readreg8104;    /**< see description of read_os8104_func */
     write_os8104_func  writereg8104;   /**< see description of write_os8104_func */
+    submit_8104_func   submit8104;     /**< see description of submit_8104_func */
     intset_func        intset;         /**< see description of intset_func */
     intclear_func      intclear;       /**< see description of intclear_func */
+    intsync_func       intsync;        /**< see description of intsync_func */
+    intlatch_func      intlatch;       /**< see description of intlatch_func */
     reset_func         reset;          /**< see description of reset_func */
     dma_alloc_fun      dma_allocate;   /**< see description of dma_alloc_fun */
     dma_dealloc_fun    dma_deallocate; /**< see description of dma_dealloc_fun */
@@ -326,6 +456,12 @@ struct most_dev {
 #define most_writereg8104(dev, src, len, addr)              \
     (dev)->ops.writereg8104((dev), (src), (len), (addr))
 
+/**
+ * @see submit_8104_func
+ */
+#define most_submit8104(dev, trans)                         \
+    (dev)->ops.submit8104((dev), (trans))
+
 /**
  * @see intset_func
  */
@@ -338,6 +474,18 @@ struct most_dev {
 #define most_intclear(dev, interrupts)                      \
     (dev)->ops.intclear((dev), (interrupts))
 
+/**
+ * @see intsync_func
+ */
+#define most_intsync(dev)                                   \
+    (dev)->ops.intsync((dev))
+
+/**
+ * @see intlatch_func
+ */
+#define most_intlatch(dev, latch)                           \
+    (dev)->ops.intlatch((dev), (latch))
+
 /**
  * @see dma_alloc_fun
  */
@@ -419,7 +567,10 @@ struct most_high_driver {
                                             constants). If 0, the interrupt_handler never
                                             will be called. */
     irq_func           int_handler;    /**< interrupt handler, gets executed if an interrupt
-                                            is handles by the most_pci driver */
+                                            is handles by the most_pci driver. It gets the
+                                            pending interrupts of interrupt_mask and is
+                                            called once per interrupt, see struct
+                                            most_int_table */
 };
 
 /**
@@ -437,6 +588,110 @@ struct most_low_driver {
     proc_show_func   proc_show;        /**< see documentation of proc_show_func */
 };
 
+/**
+ * Number of interrupt bits of the card (INTSTATUS register).
+ */
+#define MOST_INT_BITS                   8
+
+/**
+ * Maximum number of high drivers with an interrupt handler.
+ */
+#define MOST_INT_DRIVERS                16
+
+/**
+ * Interrupt dispatch table, built from the registered high drivers. For each
+ * bit of the INTSTATUS register, @c bit_drivers holds a bit mask of the
+ * @c drivers which handle that interrupt, so the interrupt handler only looks
+ * at the bits that are set instead of walking the whole driver list.
+ *
+ * There is one table for all devices: the high drivers register for all
+ * cards at once and their interrupt masks don't depend on the card, so a
+ * table per struct most_dev would only hold copies of the same data. The
+ * device is passed to the handlers instead, and as the table is only read in
+ * the interrupt path, the interrupts of different cards don't serialize on it.
+ *
+ * A published table is never modified. Each registration and deregistration
+ * builds a new table and replaces the pointer. Without @c RT_RTDM, the table
+ * is read under rcu_read_lock(). In RTDM, readers and writers hold the lock
+ * of most_base_high_drivers_spin because Linux RCU cannot be used in the
+ * real-time domain.
+ */
+struct most_int_table {
+    struct most_high_driver *drivers[MOST_INT_DRIVERS];  /**< the drivers */
+    u32                     bit_drivers[MOST_INT_BITS];  /**< the drivers per interrupt
+                                                              bit, bit n stands for
+                                                              drivers[n] */
+};
+
+/**
+ * Calls the interrupt handlers for the pending interrupts. Each handler is
+ * called once with the pending bits of its interrupt mask. Must be called under
+ * rcu_read_lock() (or the lock of most_base_high_drivers_spin in RTDM).
+ *
+ * @param table the interrupt dispatch table, may be @c NULL
+ * @param dev the MOST device
+ * @param intstatus the pending interrupts
+ * @return the interrupts that have been handled by a high driver
+ */
+static inline u32 most_int_dispatch(struct most_int_table    *table,
+                                    struct most_dev          *dev,
+                                    u32                      intstatus)
+{
+    struct most_high_driver *driver;
+    u32                     pending = intstatus;
+    u32                     called = 0;
+    u32                     handled = 0;
+    u32                     slots;
+    unsigned int            slot;
+
+    if (unlikely(!table)) {
+        return 0;
+    }
+
+    while (pending) {
+        slots = table->bit_drivers[__ffs(pending)] & ~called;
+        pending &= pending - 1;
+
+        while (slots) {
+            slot = __ffs(slots);
+            slots &= slots - 1;
+            called |= 1 << slot;
+
+            driver = table->drivers[slot];
+            driver->int_handler(dev, intstatus & driver->interrupt_mask);
+            handled |= intstatus & driver->interrupt_mask;
+        }
+    }
+
+    return handled;
+}
+
+/**
+ * Returns the interrupt bits which are handled by at least one high driver,
+ * i.e. the bits that most_int_dispatch() would report as handled. Must be
+ * called like most_int_dispatch().
+ *
+ * @param table the interrupt dispatch table, may be @c NULL
+ * @return the interrupt bits
+ */
+static inline u32 most_int_handled_mask(struct most_int_table *table)
+{
+    u32             mask = 0;
+    unsigned int    bit;
+
+    if (unlikely(!table)) {
+        return 0;
+    }
+
+    for (bit = 0; bit < MOST_INT_BITS; bit++) {
+        if (table->bit_drivers[bit]) {
+            mask |= 1 << bit;
+        }
+    }
+
+    return mask;
+}
+
 /*
  * Function prototypes * ------------------------------------------------------
  */
@@ -499,6 +754,19 @@ struct most_dev *most_dev_new(void);
  */
 void most_dev_free(struct most_dev* dev);
 
+/**
+ * Executes a transaction on the OS8104 registers (see submit_8104_func) and
+ * waits until it has been completed. Must be called in process context.
+ *
+ * @param dev the MOST device
+ * @param ops the operations
+ * @param nops the number of operations
+ * @return the number of registers that have been accessed or a negative
+ *         error code
+ */
+int most_transact8104(struct most_dev *dev, struct most_8104_op *ops,
+                      unsigned int nops);
+
 /**
  * Linked list of all MOST PCI Low Drivers. 
  */
@@ -514,6 +782,11 @@ extern struct rwsema_locked_list most_base_high_drivers_sema;
  */
 extern struct spin_locked_list most_base_high_drivers_spin;
 
+/**
+ * The interrupt dispatch table, see struct most_int_table.
+ */
+extern struct most_int_table *most_base_int_table;
+
 
 #endif /* __KERNEL__ */
 #endif /* MOST_BASE */
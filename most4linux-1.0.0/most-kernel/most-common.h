@@ -54,6 +54,212 @@ struct frame_part {
     __u32    offset;        /**< offset of the first byte */
 };
 
+/**
+ * Maximum number of reader slots in struct rx_mmap_ctrl. This is independent
+ * of the number of readers the driver really supports, it only reserves space
+ * in the control page.
+ */
+#define RX_MMAP_CTRL_READERS    64
+
+/**
+ * Value of rx_mmap_ctrl.state while the mapped ring is in use.
+ */
+#define RX_MMAP_VALID           1
+
+/**
+ * Value of rx_mmap_ctrl.state after the ring has been replaced (e.g. because
+ * of a new setup ioctl()). The mapping must be discarded and the ring must be
+ * mapped again.
+ */
+#define RX_MMAP_STALE           2
+
+/**
+ * Control page of a receive ring that is mapped in userspace with mmap(). The
+ * page is mapped read-only in front of the ring buffer itself. All offsets are
+ * byte offsets relative to the start of the ring (not of the mapping).
+ */
+struct rx_mmap_ctrl {
+    __u32    state;                 /**< RX_MMAP_VALID or RX_MMAP_STALE */
+    __u32    frame_count;           /**< number of frames in the ring */
+    __u32    bytes_per_frame;       /**< number of bytes of each frame */
+    __u32    write_offset;          /**< offset of the frame which is written
+                                         next by the interrupt service routine */
+    __u32    write_seq;             /**< odd while the interrupt service routine
+                                         updates the ring, incremented twice per
+                                         update: if it changed while reading
+                                         @c frames_written or frames, read again */
+    __u32    reserved;              /**< reserved, always 0 */
+    __u64    frames_written;        /**< 64 bit sequence number of the frame at
+                                         @c write_offset, i.e. the number of
+                                         frames written since the setup. A reader
+                                         that counts its own frames was overrun
+                                         if it falls behind by more than
+                                         @c frame_count */
+    __u32    read_offset[RX_MMAP_CTRL_READERS];
+                                    /**< offset of the frame which is read next,
+                                         one per reader */
+};
+
+/**
+ * Value of tx_mmap_ctrl.state while the mapped transmit area is in use.
+ */
+#define TX_MMAP_VALID           1
+
+/**
+ * Value of tx_mmap_ctrl.state after the transmit area has been replaced (e.g.
+ * because of a new MOST_SYNC_SETUP_TX). The mapping must be discarded.
+ */
+#define TX_MMAP_STALE           2
+
+/**
+ * Control page of the transmit area of a writer that is mapped in userspace
+ * with mmap(), see MOST_SYNC_TX_MMAP_INFO. The page is in front of the ring
+ * of frame parts. All offsets are byte offsets relative to the start of the
+ * ring (not of the mapping).
+ */
+struct tx_mmap_ctrl {
+    __u32    state;                 /**< TX_MMAP_VALID or TX_MMAP_STALE */
+    __u32    frame_count;           /**< number of frame parts in the ring */
+    __u32    bytes_per_frame;       /**< number of bytes of each frame part */
+    __u32    write_offset;          /**< offset of the frame part which is
+                                         committed next */
+    __u32    read_offset;           /**< offset of the frame part which is
+                                         transmitted next by the interrupt
+                                         service routine */
+};
+
+/**
+ * Overrun policy of a reader (see struct rx_policy): if the reader was
+ * overrun by the interrupt service routine, skip to the newest frames and
+ * continue reading. This is the default.
+ */
+#define RX_OVERRUN_SKIP         0
+
+/**
+ * Overrun policy of a reader (see struct rx_policy): if the reader was
+ * overrun by the interrupt service routine, skip to the newest frames and
+ * fail the read once with @c -EOVERFLOW.
+ */
+#define RX_OVERRUN_ERROR        1
+
+/**
+ * Read policy of a receiving file, see MOST_SYNC_RX_SET_POLICY.
+ */
+struct rx_policy {
+    __u32    overrun;               /**< RX_OVERRUN_SKIP or RX_OVERRUN_ERROR */
+    __u32    latest_frames;         /**< if not 0, a read never returns frames
+                                         that are older than the newest
+                                         @c latest_frames frames, the older
+                                         ones are skipped */
+};
+
+/**
+ * Statistics of a receiving file, see MOST_SYNC_RX_GET_STATS. The frames are
+ * counted from the last setup of the receive ring.
+ */
+struct rx_stats {
+    __u64    frames_received;       /**< number of frames received by the
+                                         device */
+    __u64    position;              /**< sequence number of the frame which
+                                         is read next */
+    __u64    lost_frames;           /**< number of frames that were lost
+                                         because of overruns, also those the
+                                         interrupt handler was too late for */
+    __u64    skipped_frames;        /**< number of frames that were skipped
+                                         because of @c latest_frames */
+    __u32    overruns;              /**< number of overruns */
+    __u32    reserved;              /**< reserved, always 0 */
+};
+
+/**
+ * Timing of a receiving file, see MOST_SYNC_RX_GET_TIMESTAMP. All times are
+ * in nanoseconds of rtnrt_clock_read(), i.e. the monotonic clock of Linux in
+ * the non-realtime driver.
+ */
+struct rx_timestamps {
+    __u64    position;              /**< sequence number of the first frame of
+                                         the last read() */
+    __u64    timestamp;             /**< time at which that frame was received,
+                                         0 if unknown */
+    __u64    now;                   /**< the current time */
+    __u32    queued_frames;         /**< number of frames available for
+                                         reading */
+    __u32    queue_delay;           /**< age of the oldest available frame in
+                                         microseconds, 0 if none */
+};
+
+/**
+ * Maximum number of stripes in struct rx_stripes.
+ */
+#define RX_STRIPES_MAX          8
+
+/**
+ * Layout of the data of a striped reader (see struct rx_stripes): the stripes
+ * of each frame follow each other, i.e. frame 0 of stripe 0, frame 0 of stripe
+ * 1, ..., frame 1 of stripe 0, ...
+ */
+#define RX_LAYOUT_INTERLEAVED   0
+
+/**
+ * Layout of the data of a striped reader (see struct rx_stripes): one plane
+ * per stripe, i.e. all frames of stripe 0, then all frames of stripe 1, ...
+ * The size of a plane is the number of frames returned by the read times the
+ * size of the stripe.
+ */
+#define RX_LAYOUT_PLANAR        1
+
+/**
+ * Several frame parts that are read with one read(), see
+ * MOST_SYNC_SETUP_RX_STRIPES.
+ */
+struct rx_stripes {
+    __u32               count;      /**< number of stripes in @c part */
+    __u32               layout;     /**< RX_LAYOUT_INTERLEAVED or
+                                         RX_LAYOUT_PLANAR */
+    struct frame_part   part[RX_STRIPES_MAX];
+                                    /**< the stripes (offset and count like
+                                         in MOST_SYNC_SETUP_RX) */
+};
+
+
+/**
+ * Underrun policy of a writer (see struct tx_policy): transmit silence (0) in
+ * the frame part of the writer while it has no data. This is the default.
+ */
+#define TX_UNDERRUN_SILENCE     0
+
+/**
+ * Underrun policy of a writer (see struct tx_policy): repeat the last frame
+ * part the writer has transmitted while it has no data.
+ */
+#define TX_UNDERRUN_REPEAT      1
+
+/**
+ * Underrun policy of a transmitting file, see MOST_SYNC_TX_SET_POLICY.
+ */
+struct tx_policy {
+    __u32    underrun;              /**< TX_UNDERRUN_SILENCE or
+                                         TX_UNDERRUN_REPEAT */
+    __u32    reserved;              /**< reserved, must be 0 */
+};
+
+/**
+ * Statistics of a transmitting file, see MOST_SYNC_TX_GET_STATS. The frames
+ * are counted from the last setup of the writer.
+ */
+struct tx_stats {
+    __u64    position;              /**< sequence number of the frame which
+                                         is written next */
+    __u64    underrun_frames;       /**< number of frames in which the frame
+                                         part of the writer was filled
+                                         because it had no data, these frames
+                                         are skipped in its ring */
+    __u32    underruns;             /**< number of underruns, i.e. how often
+                                         the writer ran out of data */
+    __u32    queued_frames;         /**< number of frames written but not
+                                         transmitted yet */
+};
+
 
 #ifdef __KERNEL__
 
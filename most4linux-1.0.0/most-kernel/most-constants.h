@@ -71,9 +71,12 @@
 #define MOST_DELAY_INCREMENT                        10
 
 /**
- * How often can a /dev/mostsyncX device be opened?
+ * How often can a /dev/mostsyncX device be opened? The per-reader and
+ * per-writer state is allocated on demand, so raising this only costs one
+ * pointer per slot in the ring buffers. Must not exceed 
+ * RX_MMAP_CTRL_READERS.
  */
-#define MOST_SYNC_OPENS                             8
+#define MOST_SYNC_OPENS                             64
 
 /**
  * Number of quadlets in a MOST frame.
@@ -85,6 +88,19 @@
  */
 #define STD_MOST_FRAMES_PER_SEC                     44100
 
+/**
+ * Maximum number of frames per page of the card that can be set with
+ * MOST_SYNC_SET_BUFFER_SIZES (100 ms). Also the largest page of the adaptive
+ * page sizing (module parameter @c adaptive_pages).
+ */
+#define MOST_SYNC_MAX_PAGE_FRAMES                   (STD_MOST_FRAMES_PER_SEC/10)
+
+/**
+ * Maximum size of a software buffer in frames that can be set with
+ * MOST_SYNC_SET_BUFFER_SIZES (4 s).
+ */
+#define MOST_SYNC_MAX_BUFFER_FRAMES                 (4*STD_MOST_FRAMES_PER_SEC)
+
 /**
  * Feature mask for the synchronous transfer.
  */
@@ -757,6 +773,21 @@
  */
 #define MOST_IF_PAGE                    0xFF
 
+/**
+ * Number of register addresses of the OS8104 (4 pages with 256 registers).
+ */
+#define MOST_8104_REGS                  0x400
+
+/**
+ * Transceiver Control register (bXCR) of the OS8104.
+ */
+#define MOST_8104_XCR_REG               0x0080
+
+/**
+ * Master bit in bXCR, set if the transceiver is the timing master.
+ */
+#define MOST_8104_XCR_MTR               (1 << 7)
+
 /*
  * Misc constants -------------------------------------------------------------
  */
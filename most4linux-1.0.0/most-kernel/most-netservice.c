@@ -34,6 +34,12 @@
 #include <linux/spinlock.h>
 #include <linux/interrupt.h>
 #include <linux/signal.h>
+#include <linux/slab.h>
+#include <linux/delay.h>
+#include <linux/jiffies.h>
+#include <linux/completion.h>
+#include <linux/poll.h>
+#include <linux/version.h>
 
 #include <asm/siginfo.h>
 #include <asm/uaccess.h>
@@ -44,6 +50,10 @@
 #include "most-constants.h"
 #include "most-base.h"
 
+#ifdef MOST_NETS_HAVE_EVENTFD
+#   include <linux/eventfd.h>
+#endif
+
 /**
  * The name of the driver.
  */
@@ -65,6 +75,9 @@ static int  most_nets_open            (struct inode *, struct file *);
 static int  most_nets_release         (struct inode *inode, struct file *file);
 static int  most_nets_ioctl           (struct inode *, struct file *, 
                                        unsigned int, unsigned long);
+static ssize_t most_nets_read         (struct file *, char __user *, size_t,
+                                       loff_t *);
+static unsigned int most_nets_poll    (struct file *, poll_table *);
 static void process_sigsend_handler   (unsigned long);
 
 /* ioctls */
@@ -76,6 +89,8 @@ static int  ioctl_read_int        (struct most_nets_dev *);
 static int  ioctl_irq_set         (struct most_nets_dev *, unsigned long);
 static int  ioctl_irq_reset       (struct most_nets_dev *, unsigned long);
 static int  ioctl_reset           (struct most_nets_dev *);
+static int  ioctl_transact        (struct most_nets_dev *, unsigned long);
+static int  ioctl_set_eventfd     (struct most_nets_dev *, unsigned long);
 
 
 /* general static data elements -------------------------------------------- */
@@ -93,6 +108,8 @@ static struct file_operations most_nets_file_operations = {
 	.owner   = THIS_MODULE,
 	.open    = most_nets_open,
     .ioctl   = most_nets_ioctl,
+    .read    = most_nets_read,
+    .poll    = most_nets_poll,
 	.release = most_nets_release
 };
 
@@ -119,9 +136,10 @@ DEFINE_NRTSIG(nrt_signal);
 /* functions --------------------------------------------------------------- */
 
 /**
- * Tasklet that gets started if an interrupt occured. It sends all processes
- * that belongs to a PCI card that has an interrupt signalled in 
- * cards_to_send_interrupt the requested signal.
+ * Tasklet that gets started if an interrupt occured. For each PCI card that
+ * has an interrupt signalled in cards_to_send_interrupt, it latches the
+ * interrupts for read(), wakes up the readers and pollers, signals the
+ * eventfd and sends the registered process the requested signal.
  *
  * @param data the "cookie" (required if more tasklets have been assigned the
  *        same function)
@@ -141,27 +159,38 @@ static void process_sigsend_handler(unsigned long data)
     for (i = 0; i < MOST_DEVICE_NUMBER; i++) {
         if (test_and_clear_bit(i, &cards_to_send_interrupt)) {
             struct most_nets_dev* nets_dev = most_nets_devices[i];
-            int data = 0;
+            int events = 0;
 
             assert(nets_dev != NULL);
 
-            if (nets_dev->task == NULL) {
-                continue;
+            if (nets_dev->intstatus & ISMAINT) {
+                events |= MNS_AINT;
             }
-            if ((nets_dev->intstatus & ISMAINT) && 
-                    (nets_dev->signo_async != 0)) {
-                data = MNS_AINT;
+            if (nets_dev->intstatus & ISMINT) {
+                events |= MNS_INT;
             }
-            if ((nets_dev->intstatus & (ISMINT)) && nets_dev->signo != 0) {
-                data = MNS_INT;
+            nets_dev->intstatus = 0;
+
+            if (events == 0) {
+                continue;
             }
 
-            assert(data != 0);
+            /* latch the interrupts for read() and wake up */
+            spin_lock(&nets_dev->event_lock);
+            nets_dev->events |= events;
+#ifdef MOST_NETS_HAVE_EVENTFD
+            if (nets_dev->eventfd) {
+                eventfd_signal(nets_dev->eventfd, 1);
+            }
+#endif
+            spin_unlock(&nets_dev->event_lock);
+            wake_up_interruptible(&nets_dev->event_wait);
 
             /* send the signal finally */
-            most_kill(nets_dev->signo, nets_dev->task, data);
-
-            nets_dev->intstatus = 0;
+            if (nets_dev->task != NULL && nets_dev->signo != 0) {
+                most_kill(nets_dev->signo, nets_dev->task,
+                        (events & MNS_INT) ? MNS_INT : MNS_AINT);
+            }
         }
     }
 }
@@ -194,6 +223,11 @@ static int most_nets_open(struct inode *inode, struct file *filp)
         err = -EBUSY;
         goto out_dec;
     }
+
+    /* the interrupts of the previous process are not for us */
+    spin_lock_bh(&dev->event_lock);
+    dev->events = 0;
+    spin_unlock_bh(&dev->event_lock);
     
 	return 0;
 
@@ -276,6 +310,12 @@ static int most_nets_ioctl(struct inode         *inode,
         case MOST_NETS_RESET:
             return ioctl_reset(dev);
 
+        case MOST_NETS_TRANSACT:
+            return ioctl_transact(dev, arg);
+
+        case MOST_NETS_SET_EVENTFD:
+            return ioctl_set_eventfd(dev, arg);
+
         default:
             return -ENOTTY;
     }
@@ -298,6 +338,21 @@ static int most_nets_release(struct inode *inode, struct file *filp)
     pr_nets_debug(PR "most_nets_release called for PCI card %d\n", 
                   MOST_DEV_CARDNUMBER(dev->most_dev));
 
+#ifdef MOST_NETS_HAVE_EVENTFD
+    {
+        struct eventfd_ctx *eventfd;
+
+        spin_lock_bh(&dev->event_lock);
+        eventfd = dev->eventfd;
+        dev->eventfd = NULL;
+        spin_unlock_bh(&dev->event_lock);
+
+        if (eventfd) {
+            eventfd_ctx_put(eventfd);
+        }
+    }
+#endif
+
     /* manage the open counter */
     atomic_dec(&dev->open_count);
     most_manage_usage(dev->most_dev, -1);
@@ -306,6 +361,79 @@ static int most_nets_release(struct inode *inode, struct file *filp)
 }
 
 
+/**
+ * Returns the interrupts (values of enum most_nets_interrupt) that occurred
+ * since the last call as one byte. Blocks until an interrupt occurs unless
+ * the file has been opened with @c O_NONBLOCK.
+ *
+ * @param filp the file pointer
+ * @param buf the buffer in userspace
+ * @param count the size of @p buf, must be at least 1
+ * @param pos the file position (unused)
+ * @return 1 on success, a negative error code on failure
+ */
+static ssize_t most_nets_read(struct file   *filp,
+                              char __user   *buf,
+                              size_t        count,
+                              loff_t        *pos)
+{
+    struct most_nets_dev    *dev = (struct most_nets_dev *)filp->private_data;
+    unsigned char           events;
+    int                     err;
+
+    if (count < 1) {
+        return -EINVAL;
+    }
+
+    for (;;) {
+        spin_lock_bh(&dev->event_lock);
+        events = dev->events;
+        dev->events = 0;
+        spin_unlock_bh(&dev->event_lock);
+
+        if (events != 0) {
+            break;
+        }
+        if (filp->f_flags & O_NONBLOCK) {
+            return -EAGAIN;
+        }
+
+        err = wait_event_interruptible(dev->event_wait, dev->events != 0);
+        if (err != 0) {
+            return err;
+        }
+    }
+
+    if (put_user(events, (unsigned char __user *)buf)) {
+        return -EFAULT;
+    }
+
+    return 1;
+}
+
+
+/**
+ * The poll() system call. The device is readable if an interrupt occurred
+ * since the last read().
+ *
+ * @param filp the file pointer
+ * @param wait the poll table
+ * @return the poll mask
+ */
+static unsigned int most_nets_poll(struct file *filp, poll_table *wait)
+{
+    struct most_nets_dev    *dev = (struct most_nets_dev *)filp->private_data;
+    unsigned int            mask = 0;
+
+    poll_wait(filp, &dev->event_wait, wait);
+    if (dev->events != 0) {
+        mask |= POLLIN | POLLRDNORM;
+    }
+
+    return mask;
+}
+
+
 /**
  * Writes the register specified in @p arg with the value specified in @p arg.
  *
@@ -459,6 +587,266 @@ static int ioctl_write_regblock(struct most_nets_dev       *dev,
 }
 
 
+/**
+ * Completion function of the transactions of transact_batch().
+ *
+ * @param trans the transaction, @c data is the completion
+ */
+static void transact_done(struct most_8104_trans *trans)
+{
+    complete((struct completion *)trans->data);
+}
+
+/**
+ * Executes operations of a MOST_NETS_TRANSACT ioctl() call without
+ * MNS_OP_WAIT as one transaction of the low driver and sets their results.
+ *
+ * @param dev the most_nets_dev structure
+ * @param ops the operations
+ * @param kops the corresponding operations of the low driver
+ * @param nops the number of operations
+ * @return 0 on success, the error code of the failed operation on failure
+ */
+static int transact_batch(struct most_nets_dev      *dev,
+                          struct most_nets_op       *ops,
+                          struct most_8104_op       *kops,
+                          unsigned int              nops)
+{
+    struct most_8104_trans  trans;
+    struct completion       done;
+    unsigned int            i;
+    int                     err;
+
+    init_completion(&done);
+    memset(&trans, 0, sizeof(struct most_8104_trans));
+    trans.ops = kops;
+    trans.nops = nops;
+    trans.complete = transact_done;
+    trans.data = &done;
+
+    err = most_submit8104(dev->most_dev, &trans);
+    if (unlikely(err != 0)) {
+        ops[0].result = err;
+        return err;
+    }
+
+    /* not interruptible, the transaction lives on the stack */
+    wait_for_completion(&done);
+
+    for (i = 0; i < nops; i++) {
+        if (trans.result < 0 && i == trans.op) {
+            ops[i].result = trans.result;
+            return trans.result;
+        }
+        ops[i].result = kops[i].len;
+    }
+
+    return 0;
+}
+
+/**
+ * Executes a MNS_OP_WAIT operation of a MOST_NETS_TRANSACT ioctl() call, i.e.
+ * reads the register each millisecond until the bits of @c mask match or the
+ * timeout elapses.
+ *
+ * @param dev the most_nets_dev structure
+ * @param op the operation
+ * @return 0 on success, -ETIMEDOUT if the bits didn't match in time, -EINTR
+ *         if a signal is pending or another negative error code on failure
+ */
+static int transact_wait(struct most_nets_dev *dev, struct most_nets_op *op)
+{
+    unsigned long       timeout = jiffies + msecs_to_jiffies(op->timeout);
+    unsigned char       expected = op->value;
+    unsigned char       val;
+    struct most_8104_op kop = {
+        .type   = MOST_8104_READ,
+        .addr   = op->address,
+        .buf    = &val,
+        .len    = 1
+    };
+    int                 ret;
+
+    for (;;) {
+        ret = most_transact8104(dev->most_dev, &kop, 1);
+        if (unlikely(ret < 0)) {
+            break;
+        }
+
+        op->value = val;
+
+        if (((val ^ expected) & op->mask) == 0) {
+            break;
+        }
+
+        if (time_after(jiffies, timeout)) {
+            ret = -ETIMEDOUT;
+            break;
+        }
+        if (msleep_interruptible(1) || signal_pending(current)) {
+            ret = -EINTR;
+            break;
+        }
+    }
+
+    op->result = ret;
+
+    return ret < 0 ? ret : 0;
+}
+
+/**
+ * Performs the MOST_NETS_TRANSACT ioctl() call as described in the
+ * description of the definition of MOST_NETS_TRANSACT.
+ *
+ * @param dev the most_nets_dev structure
+ * @param ioctl_arg the ioctl argument (must be parsed in this function)
+ * @return 0 on success, a negative error code on failure
+ */
+static int ioctl_transact(struct most_nets_dev *dev, unsigned long ioctl_arg)
+{
+    struct most_nets_transact_arg   *arg  = (void *)ioctl_arg;
+    struct most_nets_transact_arg   param;
+    struct most_nets_op             *ops  = NULL;
+    struct most_8104_op             *kops = NULL;
+    unsigned char                   *data = NULL;
+    unsigned char                   *pos;
+    size_t                          size  = 0;
+    unsigned int                    i, first;
+    int                             ret;
+
+    /* get the argument */
+    ret = __copy_from_user(&param, arg, sizeof(struct most_nets_transact_arg));
+    if (unlikely(ret != 0)) {
+        return -EFAULT;
+    }
+    if (param.nops == 0) {
+        return 0;
+    }
+    if (param.nops > MOST_NETS_TRANSACT_MAX_OPS) {
+        return -EINVAL;
+    }
+
+    ops = kmalloc(param.nops * sizeof(struct most_nets_op), GFP_KERNEL);
+    kops = kmalloc(param.nops * sizeof(struct most_8104_op), GFP_KERNEL);
+    if (unlikely(!ops || !kops)) {
+        ret = -ENOMEM;
+        goto out;
+    }
+    if (copy_from_user(ops, (struct most_nets_op __user *)param.ops,
+                param.nops * sizeof(struct most_nets_op))) {
+        ret = -EFAULT;
+        goto out;
+    }
+
+    /* check the operations, the data of all operations is copied at once */
+    for (i = 0; i < param.nops; i++) {
+        ops[i].result = 0;
+        if (ops[i].count == 0 || ops[i].count > MOST_NETS_TRANSACT_MAX_COUNT ||
+                (!ops[i].data && ops[i].count != 1)) {
+            ret = -EINVAL;
+            goto out;
+        }
+
+        switch (ops[i].type) {
+            case MNS_OP_READ:
+                kops[i].type = MOST_8104_READ;
+                break;
+
+            case MNS_OP_WRITE:
+                kops[i].type = MOST_8104_WRITE;
+                break;
+
+            case MNS_OP_MODIFY:
+                kops[i].type = MOST_8104_MODIFY;
+                break;
+
+            case MNS_OP_WAIT:
+                if (ops[i].count != 1) {
+                    ret = -EINVAL;
+                    goto out;
+                }
+                kops[i].type = MOST_8104_READ;
+                break;
+
+            default:
+                ret = -EINVAL;
+                goto out;
+        }
+
+        if (ops[i].data && ops[i].type != MNS_OP_WAIT) {
+            size += ops[i].count;
+        }
+    }
+
+    if (size > 0) {
+        data = kmalloc(size, GFP_KERNEL);
+        if (unlikely(!data)) {
+            ret = -ENOMEM;
+            goto out;
+        }
+    }
+
+    pos = data;
+    for (i = 0; i < param.nops; i++) {
+        kops[i].addr = ops[i].address;
+        kops[i].len = ops[i].count;
+        kops[i].mask = ops[i].mask;
+
+        if (!ops[i].data || ops[i].type == MNS_OP_WAIT) {
+            kops[i].buf = &ops[i].value;
+            continue;
+        }
+
+        kops[i].buf = pos;
+        if (ops[i].type != MNS_OP_READ && copy_from_user(pos, 
+                    (unsigned char __user *)ops[i].data, ops[i].count)) {
+            ret = -EFAULT;
+            goto out;
+        }
+        pos += ops[i].count;
+    }
+
+    pr_ioctl_debug(PR "MOST TRANSACT %u operations, %u bytes\n", 
+            param.nops, (unsigned int)size);
+
+    /* the operations between two waits form one transaction */
+    ret = 0;
+    first = 0;
+    for (i = 0; i <= param.nops && ret == 0; i++) {
+        if (i < param.nops && ops[i].type != MNS_OP_WAIT) {
+            continue;
+        }
+        if (i > first) {
+            ret = transact_batch(dev, ops + first, kops + first, i - first);
+        }
+        if (ret == 0 && i < param.nops) {
+            ret = transact_wait(dev, ops + i);
+        }
+        first = i + 1;
+    }
+
+    /* copy the read values and the results */
+    for (i = 0; i < param.nops; i++) {
+        if (ops[i].type == MNS_OP_READ && ops[i].data && ops[i].result > 0 &&
+                copy_to_user((unsigned char __user *)ops[i].data, kops[i].buf,
+                    ops[i].count)) {
+            ret = -EFAULT;
+        }
+    }
+    if (copy_to_user((struct most_nets_op __user *)param.ops, ops,
+                param.nops * sizeof(struct most_nets_op))) {
+        ret = -EFAULT;
+    }
+
+out:
+    kfree(data);
+    kfree(kops);
+    kfree(ops);
+
+    return ret;
+}
+
+
 /**
  * Performs the MOST_NETS_READ_INT ioctl() call as described in the description
  * of the definition of MOST_NETS_READ_INT.
@@ -523,7 +911,7 @@ static int ioctl_irq_set(struct most_nets_dev   *dev,
         dev->intmask |= IEMINT;
     }
     if (param.sigmask & MNS_AINT) {
-        dev->intmask |= IEMINT;
+        dev->intmask |= IEMAINT;
     }
 
     most_intset(dev->most_dev, dev->intmask, IEMAINT | IEMINT, NULL);
@@ -581,6 +969,50 @@ static int ioctl_reset(struct most_nets_dev *dev)
 }
 
 
+/**
+ * Performs the MOST_NETS_SET_EVENTFD ioctl() call as described in the
+ * description of the definition of MOST_NETS_SET_EVENTFD.
+ *
+ * @param dev the most_nets_dev structure
+ * @param ioctl_arg the ioctl() argument
+ * @return 0 on success, a negative error code on failure
+ */
+static int ioctl_set_eventfd(struct most_nets_dev *dev, unsigned long ioctl_arg)
+{
+#ifdef MOST_NETS_HAVE_EVENTFD
+    struct eventfd_ctx  *eventfd = NULL;
+    struct eventfd_ctx  *old;
+    int                 fd;
+    int                 ret;
+
+    ret = __get_user(fd, (int __user *)ioctl_arg);
+    if (unlikely(ret != 0)) {
+        return -EFAULT;
+    }
+
+    if (fd >= 0) {
+        eventfd = eventfd_ctx_fdget(fd);
+        if (IS_ERR(eventfd)) {
+            return PTR_ERR(eventfd);
+        }
+    }
+
+    spin_lock_bh(&dev->event_lock);
+    old = dev->eventfd;
+    dev->eventfd = eventfd;
+    spin_unlock_bh(&dev->event_lock);
+
+    if (old) {
+        eventfd_ctx_put(old);
+    }
+
+    return 0;
+#else
+    return -ENOSYS;
+#endif
+}
+
+
 /**
  * Gets called by the MOST driver when a new MOST device was discovered.
  *
@@ -615,6 +1047,8 @@ static int nets_probe(struct most_dev *most_dev)
     dev->most_dev = most_dev;
     atomic_set(&dev->open_count, -MAX_OPEN_PROCESSES);
     dev->task = NULL;
+    init_waitqueue_head(&dev->event_wait);
+    spin_lock_init(&dev->event_lock);
 
     /* register the new character device */
     cdev_init(&dev->cdev, &most_nets_file_operations);
@@ -697,7 +1131,7 @@ static void nets_int_handler(struct most_dev         *dev,
     nets_dev->intstatus |= intstatus;
 
     /* disable MOST NetServices interrupt */
-    most_intset(dev, 0, IEMINT | IEMINT, NULL);
+    most_intset(dev, 0, IEMAINT | IEMINT, NULL);
 
     /* sends the signal if real-time or schedules the tasklet if NRT */
     rtnrt_nrtsig_action(&nrt_signal, nrtsig_handler);
@@ -33,6 +33,9 @@
 
 #ifdef __KERNEL__
 #   include <linux/cdev.h>
+#   include <linux/wait.h>
+#   include <linux/spinlock.h>
+#   include <linux/version.h>
 #endif
 
 #include <asm/types.h>
@@ -76,6 +79,13 @@ struct block_transfer_arg {
 
 /**
  * Enumeration that defines numbers that must be used as intmask in interrupt_set_arg.
+ *
+ * The same values are returned by read() on the device: it blocks (unless
+ * the file is opened with @c O_NONBLOCK) until an interrupt that was enabled
+ * with MOST_NETS_IRQ_SET occurred and returns one byte with the interrupts
+ * that occurred since the last read(). The device is readable for poll() and
+ * select() while there are such interrupts. The interrupts stay disabled until
+ * MOST_NETS_IRQ_RESET is called, as with signals.
  */
 enum most_nets_interrupt {
     MNS_INT  = (1<<0),        /**< MOST Interrupt (/INT pin) */
@@ -87,13 +97,75 @@ enum most_nets_interrupt {
  */
 struct interrupt_set_arg {
     __u32   signo;            /**< signal number which the process gets 
-                                   signalled if an interrupt occured */
+                                   signalled if an interrupt occured, 0 if
+                                   the interrupts are only delivered through
+                                   read() and poll() */
     __u32   sigmask;          /**< signals that the process is interested 
                                    in, must be a bitwise or'd combination
                                    of values defined in most_nets_interrupt 
                                    enumeration. */
 };
 
+/**
+ * Type of an operation of a MOST_NETS_TRANSACT ioctl() call.
+ */
+enum most_nets_op_type {
+    MNS_OP_READ   = 0,        /**< read @c count registers */
+    MNS_OP_WRITE  = 1,        /**< write @c count registers */
+    MNS_OP_MODIFY = 2,        /**< set the bits of @c mask in @c count registers
+                                   to the bits of the data */
+    MNS_OP_WAIT   = 3         /**< read one register until the bits of @c mask
+                                   are equal to the bits of @c value */
+};
+
+/**
+ * One operation of a MOST_NETS_TRANSACT ioctl() call.
+ */
+struct most_nets_op {
+    __u32   type;             /**< the type, see enum most_nets_op_type */
+    __u32   address;          /**< the start address where the lower 8 bits
+                                   are the real adress part and the bits
+                                   8..9 are the page part */
+    __u32   count;            /**< the number of registers, at most
+                                   MOST_NETS_TRANSACT_MAX_COUNT (1 for
+                                   MNS_OP_WAIT) */
+    __u8    *data;            /**< an array of length count with the values
+                                   that are written or read, or NULL to use
+                                   @c value if count is 1 (ignored for
+                                   MNS_OP_WAIT) */
+    __u8    value;            /**< the value if @c data is NULL; for
+                                   MNS_OP_WAIT the expected value, the last
+                                   read value on return */
+    __u8    mask;             /**< the bits to change (MNS_OP_MODIFY) or to
+                                   compare (MNS_OP_WAIT) */
+    __u16   timeout;          /**< the maximum time to wait in ms, only
+                                   for MNS_OP_WAIT */
+    __s32   result;           /**< on return: the number of registers that
+                                   have been accessed, a negative error code
+                                   if the operation failed or 0 if it was
+                                   not executed */
+};
+
+/**
+ * The argument for a MOST_NETS_TRANSACT ioctl() call.
+ */
+struct most_nets_transact_arg {
+    __u32               nops; /**< the number of operations */
+    struct most_nets_op *ops; /**< the operations, at most
+                                   MOST_NETS_TRANSACT_MAX_OPS */
+};
+
+/**
+ * The maximum number of operations of a MOST_NETS_TRANSACT ioctl() call.
+ */
+#define MOST_NETS_TRANSACT_MAX_OPS          1024
+
+/**
+ * The maximum number of registers of one operation of a MOST_NETS_TRANSACT
+ * ioctl() call. MAP of the OS8104 wraps around at the end of a page.
+ */
+#define MOST_NETS_TRANSACT_MAX_COUNT        256
+
 /**
  * Writes a register. The argument must be a pointer to a single_transfer_arg
  * structure. The return value is 0 on success and a negative error code on
@@ -191,10 +263,37 @@ struct interrupt_set_arg {
 #define MOST_NETS_RESET \
     _IO(MOST_NETS_IOCTL_MAGIC, 7)
 
+/**
+ * Executes a list of register operations (see struct most_nets_op) in one
+ * call. The argument must be a pointer to a most_nets_transact_arg
+ * structure. The operations are executed in order, the operations between two
+ * MNS_OP_WAIT operations as one transaction without accesses of other
+ * processes in between. The execution stops at the first operation that
+ * fails.
+ *
+ * The return value is 0 if all operations have been executed and the error
+ * code of the failed operation otherwise. The @c result (and for operations
+ * without @c data the @c value) of each operation is written back, and read
+ * registers are stored in @c data.
+ */
+#define MOST_NETS_TRANSACT \
+    _IOW(MOST_NETS_IOCTL_MAGIC, 8, struct most_nets_transact_arg)
+
+/**
+ * Sets an eventfd (see eventfd(2)) which is signalled on each interrupt that
+ * is delivered through read(). The argument is a pointer to the file
+ * descriptor as int, -1 removes the eventfd. The eventfd is only a wakeup,
+ * the interrupts must be fetched with read(). Returns 0 on success and a
+ * negative error code on failure, -ENOSYS if the kernel doesn't support
+ * eventfds for drivers (before Linux 2.6.31).
+ */
+#define MOST_NETS_SET_EVENTFD \
+    _IOW(MOST_NETS_IOCTL_MAGIC, 9, int)
+
 /**
  * The maximum ioctl number. This value may change in future.
  */
-#define MOST_NETS_MAXIOCTL                  7
+#define MOST_NETS_MAXIOCTL                  9
 
 
 #ifdef __KERNEL__
@@ -214,6 +313,14 @@ struct interrupt_set_arg {
  */
 #define NETS_BUFSIZ                         256
 
+/**
+ * Set if the kernel supports eventfds for drivers (MOST_NETS_SET_EVENTFD).
+ */
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(2,6,31))
+#   define MOST_NETS_HAVE_EVENTFD
+struct eventfd_ctx;
+#endif
+
 /**
  * Defines the maximum number of processes which are allowed to open a MOST
  * NetServices device. Currently, only one process is supported.
@@ -261,6 +368,17 @@ struct most_nets_dev {
                                                      NetService because it's cleared
                                                      if the process receives the
                                                      signal.)*/
+    unsigned long          events;              /**< interrupts (values of enum
+                                                     most_nets_interrupt) that have
+                                                     not been read with read() */
+    wait_queue_head_t      event_wait;          /**< readers and pollers of
+                                                     @c events */
+    spinlock_t             event_lock;          /**< protects @c events and
+                                                     @c eventfd */
+#ifdef MOST_NETS_HAVE_EVENTFD
+    struct eventfd_ctx     *eventfd;            /**< signalled on interrupts, see
+                                                     MOST_NETS_SET_EVENTFD */
+#endif
 };
 
 
@@ -34,7 +34,11 @@
 #ifdef RT_RTDM
 #   include <rtdm/rtdm_driver.h>
 #   include "most-common-rt.h"
+#else
+#   include <linux/cpumask.h>
 #endif
+#include <linux/kthread.h>
+#include <linux/bitmap.h>
 
 #include "most-constants.h"
 #include "most-pci.h"
@@ -74,15 +78,20 @@ static void        writereg          (struct most_dev *, u32, u32);
 static void        changereg         (struct most_dev *, u32, u32, u32);
 static int         writereg_8104     (struct most_dev *, unsigned char *, size_t, u32);
 static int         readreg_8104      (struct most_dev *, unsigned char *, size_t, u32);
+static int         submit_8104       (struct most_dev *, struct most_8104_trans *);
 static bool        get_license       (struct most_dev *);
 static void        revision          (struct most_dev *);
 static void        intset            (struct most_dev *, unsigned int, unsigned int, 
                                       unsigned int *);
 static void        reset             (struct most_dev *);
 static void        intclear          (struct most_dev *, unsigned int);
+static void        intsync           (struct most_dev *);
+static void        intlatch          (struct most_dev *, struct most_int_latch *);
 static int         features          (struct most_dev *);
 static int         dma_allocate      (struct most_dev *, struct dma_buffer *); 
 static void        dma_deallocate    (struct most_dev *, struct dma_buffer *);
+static int         start_trans_thread(struct most_dev *);
+static void        stop_trans_thread (struct most_dev *);
 
 /* module parameters ------------------------------------------------------- */
 
@@ -91,13 +100,81 @@ static void        dma_deallocate    (struct most_dev *, struct dma_buffer *);
  */
 static int disable_shared_irq = false;
 
+/**
+ * Module parameter which compares each use of a register shadow with the
+ * register of the card, see read_shadow().
+ */
+static int check_shadow = false;
+
+/**
+ * Module parameter that holds the number of OS8104 registers that are
+ * accessed in one slice of a transaction, see run_8104_slice().
+ */
+static int cmd_slice = 8;
+
+/**
+ * Module parameter which serves reads of the OS8104 configuration registers
+ * from memory, see cacheable_8104().
+ */
+static int cache_8104 = true;
+
+#ifndef RT_RTDM
+/**
+ * Module parameter which moves the interrupt processing of the high drivers
+ * into one kernel thread per card, see int_thread_fn().
+ */
+static int int_thread = false;
+
+/**
+ * Module parameter that holds the CPU the interrupt thread of each card is
+ * bound to, -1 if it may run on any CPU.
+ */
+static int int_cpu[MOST_DEVICE_NUMBER] = { [0 ... MOST_DEVICE_NUMBER - 1] = -1 };
+#endif
+
 #ifndef DOXYGEN
 module_param(disable_shared_irq, bool, S_IRUGO);
 MODULE_PARM_DESC(disable_shared_irq, "Don't support IRQ sharing if set to true (default: false)");
+
+module_param(check_shadow, bool, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(check_shadow, "Check the shadowed registers against the card "
+        "on each use, for debugging (default: false)");
+
+module_param(cmd_slice, int, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(cmd_slice, "Number of OS8104 registers that are accessed "
+        "without rescheduling (default: 8)");
+
+module_param(cache_8104, bool, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(cache_8104, "Read the OS8104 configuration registers from "
+        "memory (default: true)");
+
+#ifndef RT_RTDM
+module_param(int_thread, bool, S_IRUGO);
+MODULE_PARM_DESC(int_thread, "Process the interrupts of each card in a kernel "
+        "thread instead of the hard interrupt handler (default: false)");
+
+module_param_array(int_cpu, int, NULL, S_IRUGO);
+MODULE_PARM_DESC(int_cpu, "CPU of the interrupt thread for each card, -1 for "
+        "any (default: -1)");
+#endif
 #endif
 
 /* general static data elements -------------------------------------------- */
 
+/**
+ * The shadowed registers (see enum most_pci_shadow_reg) and the bits of them
+ * which the card changes itself. These bits are not shadowed and read as 0,
+ * changereg() takes them from the card.
+ */
+static const struct {
+    u32     address;                    /**< the address of the register */
+    u32     volatile_bits;              /**< the bits owned by the card */
+} shadow_regs[MOST_PCI_SHADOW_REGS] = {
+    [SHADOW_INTMASK] = { MOST_PCI_INTMASK_REG, 0     },
+    [SHADOW_SRXCTRL] = { MOST_PCI_SRXCTRL_REG, SRXPP },
+    [SHADOW_STXCTRL] = { MOST_PCI_STXCTRL_REG, STXPP },
+};
+
 /**
  * Array of all MOST PCI devices. 
  */
@@ -151,7 +228,7 @@ static inline u32 loop_until_bit_is_clear(void __iomem  *addr,
         delay_ns += MOST_DELAY_INCREMENT;
     } while ((val & bitmask) && (count++ < MOST_MAX_POLL));
 
-    if (val == MOST_MAX_POLL) {
+    if (val & bitmask) {
         if (timeout) {
             *timeout = true;
         }
@@ -178,7 +255,80 @@ static inline u32 readreg_int(struct most_dev* dev, u32 address)
 }
 
 /**
- * Internal  writereg function, inlined.
+ * Returns the index of a register in the shadow (see enum
+ * most_pci_shadow_reg). The address is mostly a constant, so this folds away.
+ *
+ * @param[in] address the address of the register
+ * @return the index or -1 if the register is not shadowed
+ */
+static inline int shadow_index(u32 address)
+{
+    switch (address) {
+        case MOST_PCI_INTMASK_REG:
+            return SHADOW_INTMASK;
+
+        case MOST_PCI_SRXCTRL_REG:
+            return SHADOW_SRXCTRL;
+
+        case MOST_PCI_STXCTRL_REG:
+            return SHADOW_STXCTRL;
+
+        default:
+            return -1;
+    }
+}
+
+/**
+ * Returns the shadow of a register. With the module parameter
+ * @c check_shadow, the shadow is compared with the register of the card, a
+ * difference is reported and the value of the card is returned. The shadow
+ * itself is only corrected if the caller holds the lock of the device, which
+ * serializes all writers of the shadow.
+ *
+ * @param[in] dev the MOST device
+ * @param[in] index the index of the register in the shadow
+ * @param[in] locked @c true if the caller holds @c dev->lock
+ * @return the value of the register without the volatile bits
+ */
+static inline u32 read_shadow(struct most_dev *dev, int index, bool locked)
+{
+    u32 val = PCI_DEV(dev)->shadow[index];
+    u32 hw;
+
+    if (unlikely(check_shadow)) {
+        hw = readreg_int(dev, shadow_regs[index].address)
+            & ~shadow_regs[index].volatile_bits;
+        if (hw != val) {
+            rtnrt_warn(PR "Shadow of register 0x%x is 0x%x, the card has "
+                    "0x%x\n", shadow_regs[index].address, val, hw);
+            if (locked) {
+                PCI_DEV(dev)->shadow[index] = hw;
+            }
+            val = hw;
+        }
+    }
+
+    return val;
+}
+
+/**
+ * Initializes the shadow from the registers of the card.
+ *
+ * @param[in] dev the MOST device
+ */
+static void init_shadow(struct most_dev *dev)
+{
+    int i;
+
+    for (i = 0; i < MOST_PCI_SHADOW_REGS; i++) {
+        PCI_DEV(dev)->shadow[i] = readreg_int(dev, shadow_regs[i].address)
+            & ~shadow_regs[i].volatile_bits;
+    }
+}
+
+/**
+ * Internal  writereg function, inlined. Updates the shadow if the register is
+ * shadowed.
  *
  * @param[in] dev the MOST device
  * @param[in] value the value to write at @p address
@@ -186,6 +336,11 @@ static inline u32 readreg_int(struct most_dev* dev, u32 address)
  */
 static inline void writereg_int(struct most_dev* dev, u32 value, u32 address)
 {
+    int index = shadow_index(address);
+
+    if (index >= 0) {
+        PCI_DEV(dev)->shadow[index] = value & ~shadow_regs[index].volatile_bits;
+    }
     iowrite32(value, PCI_DEV(dev)->mem + address);
     pr_reg_access_debug(PR "REGWRITE 0x%x=0x%x\n", address, value);
 }
@@ -519,11 +674,211 @@ void proc_show(struct seq_file *s)
                     (unsigned int)(((dev->serial_number) >> 32) & 0xffff),
                     (unsigned int)(((dev->serial_number) >> 16) & 0xffff),
                     (unsigned int)(((dev->serial_number)      ) & 0xffff));
+            seq_printf(s, "    OS8104 cache: %lu hits, %lu misses\n",
+                    PCI_DEV(dev)->reg8104_hits, PCI_DEV(dev)->reg8104_misses);
         }
         up_read(&sema);
     }
 }
 
+/**
+ * Calls the interrupt handlers of the high drivers through the interrupt
+ * dispatch table (see struct most_int_table). Without @c RT_RTDM, this doesn't
+ * take any lock, so the interrupts of different cards don't serialize.
+ *
+ * @param dev the MOST device
+ * @param intstatus the pending interrupts
+ * @return the interrupts that have been handled by a high driver
+ */
+static inline u32 call_int_handlers(struct most_dev *dev, u32 intstatus)
+{
+    u32                         handled;
+
+#ifdef RT_RTDM
+    rtnrt_lock_get(&most_base_high_drivers_spin.lock);
+    handled = most_int_dispatch(most_base_int_table, dev, intstatus);
+    rtnrt_lock_put(&most_base_high_drivers_spin.lock);
+#else
+    rcu_read_lock();
+    handled = most_int_dispatch(rcu_dereference(most_base_int_table), dev,
+            intstatus);
+    rcu_read_unlock();
+#endif
+
+    return handled;
+}
+
+/**
+ * Reads the page state of the card for the receive and transmit interrupts in
+ * @p intstatus and adds it to @p latch, see intlatch_func. Called in the hard
+ * interrupt handler, so the page is known even if the handlers run later.
+ *
+ * @param dev the MOST device
+ * @param intstatus the pending interrupts
+ * @param latch the page state, the counts are incremented
+ */
+static inline void latch_pages(struct most_dev          *dev,
+                               u32                      intstatus,
+                               struct most_int_latch    *latch)
+{
+    if (intstatus & ISSRX) {
+        latch->srxctrl = readreg_int(dev, MOST_PCI_SRXCTRL_REG);
+        latch->rx_count++;
+    }
+    if (intstatus & ISSTX) {
+        latch->stxctrl = readreg_int(dev, MOST_PCI_STXCTRL_REG);
+        latch->tx_count++;
+    }
+}
+
+#ifndef RT_RTDM
+
+/**
+ * Keeps only the interrupts of @p keep of those which the interrupt thread has
+ * not processed yet, together with their page state. Must be called with
+ * @c int_lock held.
+ *
+ * @param dev the MOST device
+ * @param keep the interrupts to keep
+ */
+static inline void keep_pending(struct most_dev *dev, u32 keep)
+{
+    PCI_DEV(dev)->int_pending &= keep;
+    if (!(keep & ISSRX)) {
+        PCI_DEV(dev)->int_latch_pending.rx_count = 0;
+    }
+    if (!(keep & ISSTX)) {
+        PCI_DEV(dev)->int_latch_pending.tx_count = 0;
+    }
+}
+
+/**
+ * Thread that runs the interrupt handlers of the high drivers for one card if
+ * the module parameter @c int_thread is set. The hard interrupt handler only
+ * acknowledges the interrupts, latches the page state (see intlatch_func) and
+ * stores them in @c int_pending, so the page copies of the synchronous driver
+ * don't run in hard interrupt context and the work of several cards can be
+ * spread over the CPUs (see @c int_cpu). An interrupt that occurs again before
+ * the thread runs is processed once, the page state tells the handlers how
+ * many pages have been completed meanwhile. An interrupt that has been masked
+ * or cleared (intset(), intclear()) in the meantime is dropped, so a high
+ * driver that has stopped doesn't get it after most_intsync().
+ *
+ * @param data the MOST device
+ * @return 0
+ */
+static int int_thread_fn(void *data)
+{
+    struct most_dev     *dev = data;
+    u32                 intstatus;
+
+    for (;;) {
+        set_current_state(TASK_INTERRUPTIBLE);
+        if (kthread_should_stop()) {
+            break;
+        }
+
+        spin_lock_irq(&PCI_DEV(dev)->int_lock);
+        intstatus = PCI_DEV(dev)->int_pending & 
+            PCI_DEV(dev)->shadow[SHADOW_INTMASK];
+        PCI_DEV(dev)->int_latch = PCI_DEV(dev)->int_latch_pending;
+        PCI_DEV(dev)->int_latch.deferred = true;
+        keep_pending(dev, 0);
+        PCI_DEV(dev)->int_busy = intstatus != 0;
+        spin_unlock_irq(&PCI_DEV(dev)->int_lock);
+
+        if (intstatus == 0) {
+            schedule();
+            continue;
+        }
+
+        __set_current_state(TASK_RUNNING);
+        call_int_handlers(dev, intstatus);
+
+        spin_lock_irq(&PCI_DEV(dev)->int_lock);
+        PCI_DEV(dev)->int_busy = false;
+        PCI_DEV(dev)->int_passes++;
+        spin_unlock_irq(&PCI_DEV(dev)->int_lock);
+        wake_up_all(&PCI_DEV(dev)->int_wait);
+    }
+    __set_current_state(TASK_RUNNING);
+
+    return 0;
+}
+
+/**
+ * Starts the interrupt thread of a card if the module parameter @c int_thread
+ * is set. The thread runs with a real-time priority like the interrupt threads
+ * of Linux and is bound to the CPU of @c int_cpu. Must be called before the
+ * interrupt is requested.
+ *
+ * @param dev the MOST device
+ * @return 0 on success, a negative error code on failure
+ */
+static int start_int_thread(struct most_dev *dev)
+{
+    struct task_struct  *task;
+    struct sched_param  param = { .sched_priority = MAX_USER_RT_PRIO / 2 };
+    int                 cpu = int_cpu[MOST_DEV_CARDNUMBER(dev)];
+
+    spin_lock_init(&PCI_DEV(dev)->int_lock);
+    init_waitqueue_head(&PCI_DEV(dev)->int_wait);
+    if (!int_thread) {
+        return 0;
+    }
+
+    task = kthread_create(int_thread_fn, dev, "most-pci/%d",
+            MOST_DEV_CARDNUMBER(dev));
+    if (IS_ERR(task)) {
+        rtnrt_warn(PR "Could not create the interrupt thread\n");
+        return PTR_ERR(task);
+    }
+
+    if (cpu >= 0 && cpu < NR_CPUS && cpu_online(cpu)) {
+        kthread_bind(task, cpu);
+    } else if (cpu >= 0) {
+        rtnrt_warn(PR "CPU %d is not online, the interrupt thread of card %d "
+                "is not bound\n", cpu, MOST_DEV_CARDNUMBER(dev));
+    }
+    sched_setscheduler(task, SCHED_FIFO, &param);
+
+    PCI_DEV(dev)->int_task = task;
+    wake_up_process(task);
+
+    return 0;
+}
+
+/**
+ * Stops the interrupt thread of a card, if any. The interrupt must have been
+ * freed before.
+ *
+ * @param dev the MOST device
+ */
+static void stop_int_thread(struct most_dev *dev)
+{
+    if (PCI_DEV(dev)->int_task) {
+        kthread_stop(PCI_DEV(dev)->int_task);
+        PCI_DEV(dev)->int_task = NULL;
+    }
+}
+
+#else /* RT_RTDM */
+
+/*
+ * the RTDM interrupt handlers of the high drivers must run in real-time
+ * context, so there is no interrupt thread
+ */
+static inline int start_int_thread(struct most_dev *dev)
+{
+    return 0;
+}
+
+static inline void stop_int_thread(struct most_dev *dev)
+{
+}
+
+#endif /* RT_RTDM */
+
 /**
  * Does the actual interrupt handling.
  *
@@ -531,16 +886,15 @@ void proc_show(struct seq_file *s)
  */
 static inline rtnrt_irqreturn_t handle_interrupt(struct most_dev *dev)
 {
-    struct list_head            *cursor;
-    struct most_high_driver     *high_driver;
     u32                         intstatus, intmask;
-    u32                         intstatus_new  = 0;
+    u32                         intstatus_new;
+    struct most_int_latch       latch = { 0, 0, 0, 0, false };
 
     measuring_int_begin();
 
     /* determine if the interrupt was from this PCI card */
     intstatus = readreg_int(dev, MOST_PCI_INTSTATUS_REG) & 0xff;
-    intmask = readreg_int(dev, MOST_PCI_INTMASK_REG) & 0xff;
+    intmask = read_shadow(dev, SHADOW_INTMASK, false) & 0xff;
     intstatus &= intmask;
     if (unlikely(!intstatus)) {
         measuring_int_error_sharing();
@@ -550,19 +904,43 @@ static inline rtnrt_irqreturn_t handle_interrupt(struct most_dev *dev)
     pr_irq_debug(PR "int_handler, status = 0x%x, mask = 0x%x\n", 
             intstatus, intmask);
 
-    /* now call the registered IRQ handlers. */
-    rtnrt_lock_get(&most_base_high_drivers_spin.lock);
-    list_for_each(cursor, &most_base_high_drivers_spin.list) {
-        high_driver = list_entry(cursor, struct most_high_driver, spin_list);
+#ifndef RT_RTDM
+    /* acknowledge only, the thread calls the handlers */
+    if (PCI_DEV(dev)->int_task) {
+        /* like below, only the interrupts a high driver handles */
+        rcu_read_lock();
+        intstatus &= most_int_handled_mask(rcu_dereference(most_base_int_table));
+        rcu_read_unlock();
+        if (unlikely(!intstatus)) {
+            measuring_int_end();
+            return RTNRT_IRQ_HANDLED;
+        }
 
-        if (high_driver->int_handler && high_driver->interrupt_mask & intstatus) {
-            high_driver->int_handler(dev, intstatus);
+        latch_pages(dev, intstatus, &latch);
+        writereg_int(dev, intstatus, MOST_PCI_INTSTATUS_REG);
 
-            /* interrupt handled => clear the bits */
-            intstatus_new |= high_driver->interrupt_mask & intstatus;
+        spin_lock(&PCI_DEV(dev)->int_lock);
+        PCI_DEV(dev)->int_pending |= intstatus;
+        if (latch.rx_count) {
+            PCI_DEV(dev)->int_latch_pending.srxctrl = latch.srxctrl;
+            PCI_DEV(dev)->int_latch_pending.rx_count++;
+        }
+        if (latch.tx_count) {
+            PCI_DEV(dev)->int_latch_pending.stxctrl = latch.stxctrl;
+            PCI_DEV(dev)->int_latch_pending.tx_count++;
         }
+        spin_unlock(&PCI_DEV(dev)->int_lock);
+        wake_up_process(PCI_DEV(dev)->int_task);
+
+        measuring_int_end();
+        return RTNRT_IRQ_HANDLED;
     }
-    rtnrt_lock_put(&most_base_high_drivers_spin.lock);
+#endif
+
+    /* now call the registered IRQ handlers. */
+    latch_pages(dev, intstatus, &latch);
+    PCI_DEV(dev)->int_latch = latch;
+    intstatus_new = call_int_handlers(dev, intstatus);
 
     /* now clear the handled interrupts */
     writereg_int(dev, intstatus_new, MOST_PCI_INTSTATUS_REG);
@@ -648,9 +1026,12 @@ static int probe(struct pci_dev *lpci_dev, const struct pci_device_id *id)
     dev->ops.changereg       = changereg;
     dev->ops.readreg8104     = readreg_8104;
     dev->ops.writereg8104    = writereg_8104;
+    dev->ops.submit8104      = submit_8104;
     dev->ops.intset          = intset;
     dev->ops.reset           = reset;
     dev->ops.intclear        = intclear;
+    dev->ops.intsync         = intsync;
+    dev->ops.intlatch        = intlatch;
     dev->ops.features        = features;
     dev->ops.dma_allocate    = dma_allocate;
     dev->ops.dma_deallocate  = dma_deallocate;
@@ -667,6 +1048,12 @@ static int probe(struct pci_dev *lpci_dev, const struct pci_device_id *id)
         goto out_region;
     }
 
+    /* start the interrupt thread before the interrupt may come */
+    err = start_int_thread(dev);
+    if (unlikely(err != 0)) {
+        goto out_region;
+    }
+
     /* request the interrupt */
     err = rtnrt_register_interrupt_handler(&PCI_DEV(dev)->rt_irq_handle,
             PCI_DEV(dev)->interrupt_line, int_handler,
@@ -675,7 +1062,7 @@ static int probe(struct pci_dev *lpci_dev, const struct pci_device_id *id)
     if (unlikely(err != 0)) {
         rtnrt_warn(PR "Interrupt line %d could not be assigned "
                 "(error code = %d)\n", PCI_DEV(dev)->interrupt_line, err);
-        goto out_region;
+        goto out_thread;
     }
 
     /* enable the interrupt */
@@ -692,6 +1079,7 @@ static int probe(struct pci_dev *lpci_dev, const struct pci_device_id *id)
         err = -ENOMEM;
         goto out_irq;
     }
+    init_shadow(dev);
 
     /*  set the license information in the device */
     if (!get_license(dev)) {
@@ -704,6 +1092,12 @@ static int probe(struct pci_dev *lpci_dev, const struct pci_device_id *id)
     /* turn off all interrupts */
     most_intset(dev, 0, 0x1ff, NULL);
 
+    /* the high drivers access the OS8104 through the transaction thread */
+    err = start_trans_thread(dev);
+    if (unlikely(err != 0)) {
+        goto out_irq;
+    }
+
     rtnrt_info(PR "Serial Number: %04X-%04X-%04X-%04X\n",
                       (unsigned int)(((dev->serial_number) >> 48) & 0xffff),
                       (unsigned int)(((dev->serial_number) >> 32) & 0xffff),
@@ -738,6 +1132,8 @@ static int probe(struct pci_dev *lpci_dev, const struct pci_device_id *id)
 out_irq:
     rtnrt_free_interrupt_handler(&PCI_DEV(dev)->rt_irq_handle, 
             PCI_DEV(dev)->interrupt_line, dev);
+out_thread:
+    stop_int_thread(dev);
 out_region:
     pci_release_regions(lpci_dev);
 out_driver_structure:
@@ -771,6 +1167,7 @@ static void remove(struct pci_dev *lpci_dev)
     /* unregister interrupts */
     rtnrt_free_interrupt_handler(&PCI_DEV(dev)->rt_irq_handle, 
             PCI_DEV(dev)->interrupt_line, dev);
+    stop_int_thread(dev);
 
     /* call the remove function for each registered driver */
     down_read(&most_base_high_drivers_sema.lock);
@@ -780,6 +1177,9 @@ static void remove(struct pci_dev *lpci_dev)
     }
     up_read(&most_base_high_drivers_sema.lock);
 
+    /* no more OS8104 accesses */
+    stop_trans_thread(dev);
+
     /* unmap the I/O memory space */
     pci_iounmap(PCI_DEV(dev)->lpci_dev, PCI_DEV(dev)->mem);
 
@@ -837,26 +1237,39 @@ static void changereg(struct most_dev *dev, u32 address, u32 value, u32 mask)
 {
     unsigned long   flags;
     u32             val;
+    int             index = shadow_index(address);
 
     spin_lock_irqsave(&dev->lock, flags);
 
-    val = readreg_int(dev, address);
+    /* 
+     * the shadowed registers are computed from memory, except for the bits
+     * the card changes itself, which are written back as they are read
+     */
+    if (index < 0) {
+        val = readreg_int(dev, address);
+    } else {
+        val = read_shadow(dev, index, true);
+        if (shadow_regs[index].volatile_bits != 0) {
+            val |= readreg_int(dev, address) & shadow_regs[index].volatile_bits;
+        }
+    }
     val = (val & ~mask) | value;
     writereg_int(dev, val, address);
     spin_unlock_irqrestore(&dev->lock, flags);
 }
 
 /**
- * Writes MAP. This is only a helper function. The dev->lock_cmdreg must be
- * held when calling this function.
+ * Writes MAP. This is only a helper function. The cmd_mutex must be held when
+ * calling this function.
  *
  * @param dev the device
  * @param map the address
+ * @return 0 on success, -ETIMEDOUT if the CMD register stays busy
  */
-static inline void write_map_8104(struct most_dev      *dev, 
-                                           unsigned char        map)
+static inline int write_map_8104(struct most_dev      *dev, 
+                                 unsigned char        map)
 {
-    int val;
+    bool    timeout;
     
     /* 
      *  - wait until EXEC bit is clear
@@ -865,26 +1278,30 @@ static inline void write_map_8104(struct most_dev      *dev,
      *  - set EXEC bit          /
      * see: page 26 of MOST PCI datasheet
      */
-    val = loop_until_bit_is_clear(PCI_DEV(dev)->mem + MOST_PCI_CMD_REG,
-            EXEC, NULL);
+    loop_until_bit_is_clear(PCI_DEV(dev)->mem + MOST_PCI_CMD_REG, EXEC,
+            &timeout);
+    if (unlikely(timeout)) {
+        return -ETIMEDOUT;
+    }
 
-    val = map | EXEC;
-    
-    writereg_int(dev, val, MOST_PCI_CMD_REG);
+    writereg_int(dev, map | EXEC, MOST_PCI_CMD_REG);
 
     pr_devfunc_debug("Write MAP 0x%x\n", map);
+
+    return 0;
 }
 
 /**
- * Writes data. This is only a help function. The dev->lock_cmdreg must be held
- * when calling this function.
+ * Writes data. This is only a help function. The cmd_mutex must be held when
+ * calling this function.
  *
  * @param dev the device
  * @param data the data
+ * @return 0 on success, -ETIMEDOUT if the CMD register stays busy
  */
-static inline void write_data_8104(struct most_dev* dev, unsigned char data)
+static inline int write_data_8104(struct most_dev* dev, unsigned char data)
 {
-    u32 val;
+    bool    timeout;
     
     /*
      *  - wait until EXEC bit is clear
@@ -893,25 +1310,30 @@ static inline void write_data_8104(struct most_dev* dev, unsigned char data)
      *  - set EXEC bit          /
      * see: page 26 of MOST PCI datasheet
      */
-    val = loop_until_bit_is_clear(PCI_DEV(dev)->mem + MOST_PCI_CMD_REG, 
-            EXEC, NULL);
-
-    val = CPOP1 | data | EXEC;
+    loop_until_bit_is_clear(PCI_DEV(dev)->mem + MOST_PCI_CMD_REG, EXEC,
+            &timeout);
+    if (unlikely(timeout)) {
+        return -ETIMEDOUT;
+    }
 
-    writereg_int(dev, val, MOST_PCI_CMD_REG);
+    writereg_int(dev, CPOP1 | data | EXEC, MOST_PCI_CMD_REG);
 
     pr_devfunc_debug("Write data 0x%x\n", data);
+
+    return 0;
 }
 
 /**
- * Reads data. This is only a helper function. The dev->lock_cmdreg must be
- * held when calling this function.
+ * Reads data. This is only a helper function. The cmd_mutex must be held when
+ * calling this function.
  *
  * @param dev the device
+ * @return the data on success, -ETIMEDOUT if the CMD register stays busy
  */
-static inline unsigned char read_data_8104(struct most_dev* dev)
+static inline int read_data_8104(struct most_dev* dev)
 {
     u32         val;
+    bool        timeout;
     
     /*
      *  - wait until EXEC bit is clear
@@ -921,15 +1343,19 @@ static inline unsigned char read_data_8104(struct most_dev* dev)
      *  - read DATA[7:0]
      * see: page 27 of MOST PCI datasheet
      */
-    val = loop_until_bit_is_clear(PCI_DEV(dev)->mem + MOST_PCI_CMD_REG,
-            EXEC, NULL);
+    loop_until_bit_is_clear(PCI_DEV(dev)->mem + MOST_PCI_CMD_REG, EXEC,
+            &timeout);
+    if (unlikely(timeout)) {
+        return -ETIMEDOUT;
+    }
 
-    val = CPOP1 | CPOP0 | EXEC;
-    writereg_int(dev, val, MOST_PCI_CMD_REG);
+    writereg_int(dev, CPOP1 | CPOP0 | EXEC, MOST_PCI_CMD_REG);
 
-    val = 0;
     val = loop_until_bit_is_clear(PCI_DEV(dev)->mem + MOST_PCI_CMD_REG,
-            EXEC, NULL);
+            EXEC, &timeout);
+    if (unlikely(timeout)) {
+        return -ETIMEDOUT;
+    }
     
     val &= VALUE_DATA;
     
@@ -938,9 +1364,383 @@ static inline unsigned char read_data_8104(struct most_dev* dev)
     return val;
 }
 
+/**
+ * Sets the page (if it has changed) and MAP of the OS8104 to @p addr. This is
+ * only a helper function. The cmd_mutex must be held when calling this
+ * function.
+ *
+ * @param dev the device
+ * @param addr the address (consists of address and page part)
+ * @return 0 on success, -ETIMEDOUT if the CMD register stays busy
+ */
+static int select_8104(struct most_dev *dev, u32 addr)
+{
+    unsigned char   page = (addr >> 8) & 0x03;
+    int             err;
+
+    if (page != PCI_DEV(dev)->page) {
+        PCI_DEV(dev)->page = MOST_PCI_NO_PAGE;
+        err = write_map_8104(dev, MOST_IF_PAGE);
+        if (err == 0) {
+            err = write_data_8104(dev, page);
+        }
+        if (unlikely(err != 0)) {
+            return err;
+        }
+        PCI_DEV(dev)->page = page;
+    }
+
+    return write_map_8104(dev, addr & 0xff);
+}
+
+/**
+ * Returns if an OS8104 register can be cached, i.e. if only the host changes
+ * it. These are the routing table and the configuration registers. The
+ * status registers, the message and packet buffers and the allocation table
+ * are changed by the transceiver and always read from it. bSBC is set by the
+ * timing master, so it is cached only on the master.
+ *
+ * @param dev the device
+ * @param index the address of the register (consists of address and page part)
+ * @return @c true if the register can be cached, @c false otherwise
+ */
+static bool cacheable_8104(struct most_dev *dev, unsigned int index)
+{
+    /* the routing table */
+    if (index < MOST_8104_XCR_REG) {
+        return true;
+    }
+
+    switch (index) {
+        case MOST_8104_XCR_REG:         /* bXCR */
+        case 0x082:                     /* bSDC1 */
+        case 0x083:                     /* bCM1 */
+        case 0x084:                     /* bNC */
+        case 0x088:                     /* bIE */
+        case 0x089:                     /* bGA */
+        case 0x08A:                     /* bNAH */
+        case 0x08B:                     /* bNAL */
+        case 0x08C:                     /* bSDC2 */
+        case 0x08D:                     /* bSDC3 */
+        case 0x0BE:                     /* bXTIM */
+        case 0x0BF:                     /* bXRTY */
+        case 0x0E8:                     /* bAPAH */
+        case 0x0E9:                     /* bAPAL */
+        case 0x3C0:                     /* bXLRTY */
+        case 0x3C1:                     /* bXSTIM */
+            return true;
+
+        case MOST_8104_SBC_REG:
+            return test_bit(MOST_8104_XCR_REG, PCI_DEV(dev)->reg8104_valid) &&
+                (PCI_DEV(dev)->reg8104[MOST_8104_XCR_REG] & MOST_8104_XCR_MTR);
+
+        default:
+            return false;
+    }
+}
+
+/**
+ * Reads one register for run_8104_slice(). A cacheable register is read from
+ * the cache if the module parameter @c cache_8104 is set and stored in the
+ * cache after reading it from the OS8104. The cmd_mutex must be held.
+ *
+ * @param dev the device
+ * @param addr the address (consists of address and page part)
+ * @return the value on success, -ETIMEDOUT if the CMD register stays busy
+ */
+static int read_8104(struct most_dev *dev, u32 addr)
+{
+    unsigned int    index = addr & (MOST_8104_REGS - 1);
+    bool            cacheable = cache_8104 && cacheable_8104(dev, index);
+    int             val;
+
+    if (cacheable) {
+        if (test_bit(index, PCI_DEV(dev)->reg8104_valid)) {
+            PCI_DEV(dev)->reg8104_hits++;
+
+            /* MAP stays behind */
+            PCI_DEV(dev)->map_valid = false;
+            return PCI_DEV(dev)->reg8104[index];
+        }
+        PCI_DEV(dev)->reg8104_misses++;
+    }
+
+    if (!PCI_DEV(dev)->map_valid) {
+        val = select_8104(dev, addr);
+        if (unlikely(val < 0)) {
+            return val;
+        }
+        PCI_DEV(dev)->map_valid = true;
+    }
+
+    val = read_data_8104(dev);
+    if (cacheable && likely(val >= 0)) {
+        PCI_DEV(dev)->reg8104[index] = val;
+        __set_bit(index, PCI_DEV(dev)->reg8104_valid);
+    }
+
+    return val;
+}
+
+/**
+ * Writes one register for run_8104_slice(). The value of a cacheable register
+ * is stored in the cache. The cmd_mutex must be held.
+ *
+ * @param dev the device
+ * @param addr the address (consists of address and page part)
+ * @param data the value
+ * @return 0 on success, -ETIMEDOUT if the CMD register stays busy
+ */
+static int write_8104(struct most_dev *dev, u32 addr, unsigned char data)
+{
+    unsigned int    index = addr & (MOST_8104_REGS - 1);
+    int             err;
+
+    if (!PCI_DEV(dev)->map_valid) {
+        err = select_8104(dev, addr);
+        if (unlikely(err != 0)) {
+            return err;
+        }
+        PCI_DEV(dev)->map_valid = true;
+    }
+
+    err = write_data_8104(dev, data);
+    if (unlikely(err != 0)) {
+        return err;
+    }
+
+    /* the cacheability of bSBC depends on bXCR */
+    if (index == MOST_8104_XCR_REG) {
+        __clear_bit(MOST_8104_SBC_REG, PCI_DEV(dev)->reg8104_valid);
+    }
+    if (cacheable_8104(dev, index)) {
+        PCI_DEV(dev)->reg8104[index] = data;
+        __set_bit(index, PCI_DEV(dev)->reg8104_valid);
+    }
+
+    return 0;
+}
+
+/**
+ * Executes the next slice of a transaction, i.e. at most @c cmd_slice
+ * registers. The CMD register is locked for the slice only, the interrupts
+ * stay enabled. MAP increments with each access, so it is written only at the
+ * start of an operation (or if a reset or a cached read came in between),
+ * except for MOST_8104_MODIFY which needs a read and a write of the same
+ * register.
+ *
+ * @param dev the device
+ * @param trans the transaction
+ * @return @c true if the transaction has been completed, @c false if there
+ *         are registers left
+ */
+static bool run_8104_slice(struct most_dev *dev, struct most_8104_trans *trans)
+{
+    struct most_8104_op *op;
+    int                 budget = max(cmd_slice, 1);
+    int                 val = 0;
+    u32                 addr = 0;
+
+    mutex_lock(&PCI_DEV(dev)->cmd_mutex);
+
+    while (budget > 0 && trans->op < trans->nops) {
+        op = &trans->ops[trans->op];
+        if (unlikely(op->len == 0)) {
+            trans->op++;
+            continue;
+        }
+
+        /* the page doesn't change within an operation */
+        addr = (op->addr & ~0xff) | ((op->addr + trans->pos) & 0xff);
+
+        switch (op->type) {
+            case MOST_8104_READ:
+                val = read_8104(dev, addr);
+                if (likely(val >= 0)) {
+                    op->buf[trans->pos] = val;
+                }
+                break;
+
+            case MOST_8104_WRITE:
+                val = write_8104(dev, addr, op->buf[trans->pos]);
+                break;
+
+            case MOST_8104_MODIFY:
+                val = read_8104(dev, addr);
+                if (likely(val >= 0)) {
+                    /* the read moved MAP to the next register */
+                    PCI_DEV(dev)->map_valid = false;
+                    val = write_8104(dev, addr,
+                            (val & ~op->mask) | (op->buf[trans->pos] & op->mask));
+                }
+                break;
+
+            default:
+                val = -EINVAL;
+                break;
+        }
+        if (unlikely(val < 0)) {
+            break;
+        }
+
+        trans->result++;
+        budget--;
+        if (++trans->pos == op->len) {
+            trans->op++;
+            trans->pos = 0;
+            PCI_DEV(dev)->map_valid = false;
+        }
+    }
+
+    if (unlikely(val < 0)) {
+        rtnrt_warn(PR "OS8104 access at 0x%x failed (%d)\n", addr, val);
+        PCI_DEV(dev)->map_valid = false;
+        trans->result = val;
+    }
+
+    mutex_unlock(&PCI_DEV(dev)->cmd_mutex);
+
+    return val < 0 || trans->op == trans->nops;
+}
+
+/**
+ * Thread that executes the OS8104 transactions of one card, one slice after
+ * the other (see run_8104_slice()). The transactions are executed in the
+ * order in which they have been submitted. The CMD register needs busy-waiting
+ * for each register, so this is done here instead of in the context of the
+ * caller with the interrupts disabled.
+ *
+ * @param data the MOST device
+ * @return 0
+ */
+static int trans_thread_fn(void *data)
+{
+    struct most_dev         *dev = data;
+    struct most_8104_trans  *trans;
+
+    for (;;) {
+        set_current_state(TASK_INTERRUPTIBLE);
+
+        trans = NULL;
+        spin_lock_irq(&PCI_DEV(dev)->trans_lock);
+        if (!list_empty(&PCI_DEV(dev)->trans_queue)) {
+            trans = list_entry(PCI_DEV(dev)->trans_queue.next,
+                    struct most_8104_trans, list);
+        }
+        spin_unlock_irq(&PCI_DEV(dev)->trans_lock);
+
+        if (!trans) {
+            if (kthread_should_stop()) {
+                break;
+            }
+            schedule();
+            continue;
+        }
+
+        __set_current_state(TASK_RUNNING);
+        if (run_8104_slice(dev, trans)) {
+            spin_lock_irq(&PCI_DEV(dev)->trans_lock);
+            list_del(&trans->list);
+            spin_unlock_irq(&PCI_DEV(dev)->trans_lock);
+
+            trans->complete(trans);
+        }
+        cond_resched();
+    }
+    __set_current_state(TASK_RUNNING);
+
+    return 0;
+}
+
+/**
+ * Initializes the OS8104 access of a card and starts the transaction thread.
+ *
+ * @param dev the MOST device
+ * @return 0 on success, a negative error code on failure
+ */
+static int start_trans_thread(struct most_dev *dev)
+{
+    struct task_struct  *task;
+
+    mutex_init(&PCI_DEV(dev)->cmd_mutex);
+    spin_lock_init(&PCI_DEV(dev)->trans_lock);
+    INIT_LIST_HEAD(&PCI_DEV(dev)->trans_queue);
+    PCI_DEV(dev)->page = MOST_PCI_NO_PAGE;
+    PCI_DEV(dev)->map_valid = false;
+    bitmap_zero(PCI_DEV(dev)->reg8104_valid, MOST_8104_REGS);
+
+    task = kthread_run(trans_thread_fn, dev, "most-8104/%d",
+            MOST_DEV_CARDNUMBER(dev));
+    if (IS_ERR(task)) {
+        rtnrt_warn(PR "Could not create the OS8104 transaction thread\n");
+        return PTR_ERR(task);
+    }
+    PCI_DEV(dev)->trans_task = task;
+
+    return 0;
+}
+
+/**
+ * Stops the transaction thread of a card. The thread executes the queued
+ * transactions before, transactions that are submitted while it stops are
+ * completed with -ENODEV.
+ *
+ * @param dev the MOST device
+ */
+static void stop_trans_thread(struct most_dev *dev)
+{
+    struct task_struct      *task;
+    struct most_8104_trans  *trans, *tmp;
+
+    spin_lock_irq(&PCI_DEV(dev)->trans_lock);
+    task = PCI_DEV(dev)->trans_task;
+    PCI_DEV(dev)->trans_task = NULL;
+    spin_unlock_irq(&PCI_DEV(dev)->trans_lock);
+
+    if (task) {
+        kthread_stop(task);
+    }
+
+    list_for_each_entry_safe(trans, tmp, &PCI_DEV(dev)->trans_queue, list) {
+        list_del(&trans->list);
+        trans->result = -ENODEV;
+        trans->complete(trans);
+    }
+}
+
+/**
+ * Queues a transaction on the OS8104 registers. For a detailled description
+ * see the comment near the typedef submit_8104_func.
+ *
+ * @param dev the most_dev structure for the device (which must be a PCI
+ *        structure in that case
+ * @param trans the transaction
+ * @return 0 on success, -ENODEV if the card is being removed
+ */
+static int submit_8104(struct most_dev *dev, struct most_8104_trans *trans)
+{
+    unsigned long   flags;
+    int             err = 0;
+
+    trans->op = 0;
+    trans->pos = 0;
+    trans->result = 0;
+
+    spin_lock_irqsave(&PCI_DEV(dev)->trans_lock, flags);
+    if (likely(PCI_DEV(dev)->trans_task)) {
+        list_add_tail(&trans->list, &PCI_DEV(dev)->trans_queue);
+        wake_up_process(PCI_DEV(dev)->trans_task);
+    } else {
+        err = -ENODEV;
+    }
+    spin_unlock_irqrestore(&PCI_DEV(dev)->trans_lock, flags);
+
+    return err;
+}
+
 /**
  * Performs a read of of one or more registers on the OS8104. For a detailled
- * description see the comment near the typedef write_os8104_func.
+ * description see the comment near the typedef read_os8104_func.
  *
  * @param dev the most_dev structure for the device (which must be a PCI
  *        structure in that case
@@ -951,38 +1751,23 @@ static inline unsigned char read_data_8104(struct most_dev* dev)
  *         error code on failure
  */
 static int readreg_8104(struct most_dev    *dev, 
-                                 unsigned char      *dest, 
-                                 size_t             len,
-                                 u32                addr)
+                        unsigned char      *dest, 
+                        size_t             len,
+                        u32                addr)
 {
-    unsigned long   flags;
-    unsigned char   page = (addr >> 8) & 0x03;
-    unsigned char   address = addr & 0xff;
-    int             read = 0;
-    
-    spin_lock_irqsave(&dev->lock, flags);
-
-    if (page != PCI_DEV(dev)->page) {
-        write_map_8104(dev, MOST_IF_PAGE);
-        write_data_8104(dev, page);
-        PCI_DEV(dev)->page = page;
-    }
-
-    write_map_8104(dev, address);
-    
-    do {
-        *dest++ = read_data_8104(dev);
-        read++;
-    } while (--len > 0);
-
-    spin_unlock_irqrestore(&dev->lock, flags);
-    
-    return read;
+    struct most_8104_op op = {
+        .type   = MOST_8104_READ,
+        .addr   = addr,
+        .buf    = dest,
+        .len    = len
+    };
+
+    return most_transact8104(dev, &op, 1);
 }
 
 /**
  * Performs a write of of one or more registers on the OS8104. For a detailled
- * description see the comment near the typedef read_os8104_func.
+ * description see the comment near the typedef write_os8104_func.
  *
  * @param dev the most_dev structure for the device (which must be a PCI
  *        structure in that case
@@ -993,33 +1778,18 @@ static int readreg_8104(struct most_dev    *dev,
  *         error code on failure
  */
 static int writereg_8104(struct most_dev   *dev, 
-                                  unsigned char     *src,
-                                  size_t            len,
-                                  u32               addr)
+                         unsigned char     *src,
+                         size_t            len,
+                         u32               addr)
 {
-    unsigned long   flags;
-    unsigned char   page    = (addr >> 8) & 0x03;
-    unsigned char   address = addr & 0xff;
-    int             written = 0;
-    
-    spin_lock_irqsave(&dev->lock, flags);
-
-    if (page != PCI_DEV(dev)->page) {
-        write_map_8104(dev, MOST_IF_PAGE);
-        write_data_8104(dev, page);
-        PCI_DEV(dev)->page = page;
-    }
-
-    write_map_8104(dev, address);
-
-    do {
-        write_data_8104(dev, *src++);
-        written++;
-    } while (--len > 0);
-    
-    spin_unlock_irqrestore(&dev->lock, flags);
-
-    return written;
+    struct most_8104_op op = {
+        .type   = MOST_8104_WRITE,
+        .addr   = addr,
+        .buf    = src,
+        .len    = len
+    };
+
+    return most_transact8104(dev, &op, 1);
 }
 
 /**
@@ -1042,8 +1812,8 @@ static void intset(struct most_dev    *dev,
 
     spin_lock_irqsave(&dev->lock, flags);
 
-    /* read the mask */
-    val = readreg_int(dev, MOST_PCI_INTMASK_REG);
+    /* read the mask from the shadow */
+    val = read_shadow(dev, SHADOW_INTMASK, true);
 
     /* fill the oldmask if necessary */
     if (oldmask) {
@@ -1054,6 +1824,13 @@ static void intset(struct most_dev    *dev,
     val = (val & ~mask) | interrupts;
     writereg_int(dev, val, MOST_PCI_INTMASK_REG);
 
+#ifndef RT_RTDM
+    /* the interrupt thread doesn't process the masked interrupts any more */
+    spin_lock(&PCI_DEV(dev)->int_lock);
+    keep_pending(dev, val);
+    spin_unlock(&PCI_DEV(dev)->int_lock);
+#endif
+
     pr_irq_debug(PR "intset, interrupts = 0x%x, mask = 0x%x => 0x%x\n",
             interrupts, mask, val);
 
@@ -1068,9 +1845,67 @@ static void intset(struct most_dev    *dev,
  */
 static void intclear(struct most_dev *dev, unsigned int interrupts)
 {
+#ifndef RT_RTDM
+    unsigned long   flags;
+
+    /* also the ones the interrupt thread has not processed yet */
+    spin_lock_irqsave(&PCI_DEV(dev)->int_lock, flags);
+    keep_pending(dev, ~interrupts);
+    spin_unlock_irqrestore(&PCI_DEV(dev)->int_lock, flags);
+#endif
+
     writereg_int(dev, interrupts, MOST_PCI_INTSTATUS_REG);
 }
 
+/**
+ * Implements intsync_func. Without @c RT_RTDM, waits for the hard interrupt
+ * handler and for the pass of the interrupt thread which is running, if any.
+ * The following passes see the buffers already removed by the caller. With
+ * @c RT_RTDM, the interrupt handlers of the high drivers run with the lock of
+ * most_base_high_drivers_spin held, so taking it once is enough.
+ *
+ * @param dev the MOST device
+ */
+static void intsync(struct most_dev *dev)
+{
+#ifdef RT_RTDM
+    rtnrt_lockctx_t     flags;
+
+    rtnrt_lock_get_irqsave(&most_base_high_drivers_spin.lock, flags);
+    rtnrt_lock_put_irqrestore(&most_base_high_drivers_spin.lock, flags);
+#else
+    struct most_pci_device  *pci_dev = PCI_DEV(dev);
+    unsigned int            passes;
+    bool                    busy;
+
+    synchronize_irq(pci_dev->interrupt_line);
+    if (!pci_dev->int_task) {
+        return;
+    }
+
+    spin_lock_irq(&pci_dev->int_lock);
+    busy = pci_dev->int_busy;
+    passes = pci_dev->int_passes;
+    spin_unlock_irq(&pci_dev->int_lock);
+
+    if (busy) {
+        wait_event(pci_dev->int_wait, pci_dev->int_passes != passes);
+    }
+#endif
+}
+
+/**
+ * Implements intlatch_func. The state is set by handle_interrupt() before it
+ * calls the handlers, or by the interrupt thread for each pass.
+ *
+ * @param dev the MOST device
+ * @param latch the state is stored there
+ */
+static void intlatch(struct most_dev *dev, struct most_int_latch *latch)
+{
+    *latch = PCI_DEV(dev)->int_latch;
+}
+
 /**
  * Reset the MOST Transceiver
  * 
@@ -1078,18 +1913,23 @@ static void intclear(struct most_dev *dev, unsigned int interrupts)
  */
 static void reset(struct most_dev *dev)
 {
-    unsigned long   flags;
     u32             tmp;
 
-    spin_lock_irqsave(&dev->lock, flags);
+    mutex_lock(&PCI_DEV(dev)->cmd_mutex);
 
     /* wait until commands are finished, from WinCE driver */
     tmp = loop_until_bit_is_clear(PCI_DEV(dev)->mem + MOST_PCI_CMD_REG, EXEC,
             NULL);
 
-    /* perform the reset */
+    /* perform the reset, the page and MAP are lost */
     writereg_int(dev, MRST, MOST_PCI_CMD_REG);
-    spin_unlock_irqrestore(&dev->lock, flags);
+    PCI_DEV(dev)->page = MOST_PCI_NO_PAGE;
+    PCI_DEV(dev)->map_valid = false;
+
+    /* the registers have their default values again */
+    bitmap_zero(PCI_DEV(dev)->reg8104_valid, MOST_8104_REGS);
+
+    mutex_unlock(&PCI_DEV(dev)->cmd_mutex);
 }
 
 /**
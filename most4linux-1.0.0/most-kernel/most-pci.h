@@ -33,12 +33,34 @@
 #endif
 #include <linux/interrupt.h>
 #include <linux/spinlock.h>
+#include <linux/sched.h>
+#include <linux/mutex.h>
+#include <linux/list.h>
 
 #ifdef RT_RTDM
 #   include <rtdm/rtdm_driver.h>
 #endif
 
 #include "most-common.h"
+#include "most-constants.h"
+
+/**
+ * The PCI registers that are shadowed in struct most_pci_device, so that the
+ * masks and control bits can be changed without reading the register first.
+ * Only the page bits of the control registers, which the card changes itself,
+ * are still read when a control register is changed.
+ */
+enum most_pci_shadow_reg {
+    SHADOW_INTMASK,                             /**< MOST_PCI_INTMASK_REG */
+    SHADOW_SRXCTRL,                             /**< MOST_PCI_SRXCTRL_REG */
+    SHADOW_STXCTRL,                             /**< MOST_PCI_STXCTRL_REG */
+    MOST_PCI_SHADOW_REGS                        /**< number of shadowed registers */
+};
+
+/**
+ * Value of most_pci_device.page if the page of the OS8104 is unknown.
+ */
+#define MOST_PCI_NO_PAGE                0xff
 
 /**
  * Private data for the MOST PCI driver. This information is PCI-card specific.
@@ -53,9 +75,58 @@ struct most_pci_device
                                                     address space each time */
     short              fpga_revision;          /**< the revision number of the FPGA */
     unsigned int       fpga_features;          /**< the features of the FPGA */
-    unsigned char      page;                   /**< the current page (valid are 0..3) */
+    unsigned char      page;                   /**< the current page (valid are 0..3,
+                                                    MOST_PCI_NO_PAGE after a reset) */
+    bool               map_valid;              /**< MAP of the OS8104 points to the
+                                                    next register of the current
+                                                    transaction operation */
+    struct mutex       cmd_mutex;              /**< serializes the accesses to the CMD
+                                                    register, protects @c page and
+                                                    @c map_valid */
+    spinlock_t         trans_lock;             /**< protects @c trans_queue and
+                                                    @c trans_task */
+    struct list_head   trans_queue;            /**< the submitted OS8104 transactions,
+                                                    see struct most_8104_trans */
+    struct task_struct *trans_task;            /**< the thread that executes the
+                                                    transactions, @c NULL if the
+                                                    card is removed */
+    unsigned char      reg8104[MOST_8104_REGS]; /**< the cached OS8104 registers,
+                                                    protected by @c cmd_mutex */
+    DECLARE_BITMAP(reg8104_valid, MOST_8104_REGS); /**< the valid entries of
+                                                    @c reg8104 */
+    unsigned long      reg8104_hits;           /**< reads served from @c reg8104 */
+    unsigned long      reg8104_misses;         /**< reads of cacheable registers that
+                                                    had to access the OS8104 */
+    u32                shadow[MOST_PCI_SHADOW_REGS]; /**< the last values written to
+                                                    the shadowed registers, without
+                                                    the bits the card changes itself */
+    struct most_int_latch int_latch;           /**< the page state for the running
+                                                    call of the interrupt handlers,
+                                                    see intlatch() */
 #ifdef RT_RTDM
     rtdm_irq_t         rt_irq_handle;          /**< the IRQ handle for RTDM */
+#else
+    struct task_struct *int_task;              /**< the thread that runs the interrupt
+                                                    handlers of the high drivers if
+                                                    @c int_thread is set, else
+                                                    @c NULL */
+    spinlock_t         int_lock;               /**< protects @c int_pending,
+                                                    @c int_latch_pending,
+                                                    @c int_busy and
+                                                    @c int_passes */
+    u32                int_pending;            /**< interrupts acknowledged by the
+                                                    hard interrupt handler that the
+                                                    thread has not processed yet */
+    struct most_int_latch int_latch_pending;   /**< the page state of the
+                                                    interrupts in @c int_pending */
+    bool               int_busy;               /**< the thread is calling the
+                                                    interrupt handlers */
+    unsigned int       int_passes;             /**< number of calls of the
+                                                    interrupt handlers by the
+                                                    thread */
+    wait_queue_head_t  int_wait;               /**< woken up after each call of
+                                                    the interrupt handlers by the
+                                                    thread, see intsync() */
 #endif
 };
 
@@ -42,24 +42,72 @@
 
 #include "most-rxbuf.h"
 
+#if MOST_SYNC_OPENS > RX_MMAP_CTRL_READERS
+#  error "MOST_SYNC_OPENS must not exceed RX_MMAP_CTRL_READERS"
+#endif
+
 /**
  * Prefix for printk() messages in this module.
  */
 #define PR "rxbuf: "
 
 
-/*
- * Documentation: see header
+/**
+ * Allocates the state of a reader if it doesn't exist yet and resets it.
+ *
+ * @param ring the ring buffer
+ * @param reader_index the index of the reader
+ * @return the reader or @c NULL if there is not enough memory
+ */
+static struct rxbuf_reader *rxbuf_alloc_reader(struct rx_buffer  *ring,
+                                               unsigned int      reader_index)
+{
+    struct rxbuf_reader *reader = ring->readers[reader_index];
+
+    if (!reader) {
+        reader = ker_malloc(sizeof(struct rxbuf_reader));
+        if (unlikely(!reader)) {
+            rtnrt_err(PR "Allocating reader %d failed\n", reader_index);
+            return NULL;
+        }
+    }
+
+    memset(reader, 0, offsetof(struct rxbuf_reader, bounce));
+    rtnrt_lock_init(&reader->stats_lock);
+    reader->watermark = 1;
+
+    return reader;
+}
+
+/**
+ * Common implementation of rxbuf_alloc() and rxbuf_alloc_dma().
+ *
+ * @param reader_count the number of readers
+ * @param frame_count the number of frames in the ring (without the additional
+ *        element of rxbuf_alloc())
+ * @param bytes_per_frame the number of bytes needed per frame
+ * @param parts the frame parts in the demultiplexing mode or @c NULL
+ * @param dma_buffer the ring of rxbuf_alloc_dma() or @c NULL
+ * @return the allocated ring buffer or @c NULL
  */
-struct rx_buffer *rxbuf_alloc(unsigned int reader_count, 
-                     unsigned int frame_count, 
-                     unsigned int bytes_per_frame)
+static struct rx_buffer *rxbuf_create(unsigned int              reader_count, 
+                                      unsigned int              frame_count, 
+                                      unsigned int              bytes_per_frame,
+                                      const struct frame_part   *parts,
+                                      unsigned char             *dma_buffer)
 {
     unsigned int        i;
     struct rx_buffer    *ret;
 
-    /* one element more to determine empty and full rings */
-    frame_count++;
+    return_value_if_fails_dbg(reader_count <= MOST_SYNC_OPENS, NULL);
+
+    /* the ring and the control page must fit in an unsigned int */
+    if (unlikely(frame_count == 0 || 
+                bytes_per_frame > (UINT_MAX - 2 * PAGE_SIZE) / frame_count)) {
+        rtnrt_err(PR "Invalid ring size: %u frames with %u bytes\n",
+                frame_count, bytes_per_frame);
+        return NULL;
+    }
 
     /* allocate the structure */
     ret = ker_malloc(sizeof(struct rx_buffer));
@@ -73,122 +121,1026 @@ struct rx_buffer *rxbuf_alloc(unsigned int reader_count,
     ret->reader_count    = reader_count;
     ret->frame_count     = frame_count;
     ret->bytes_per_frame = bytes_per_frame;
+    ret->hw_bytes_per_frame = bytes_per_frame;
+    ret->capacity        = frame_count - 1;
+    ret->demux           = parts != NULL;
+    ret->dma             = dma_buffer != NULL;
 
-    /* allocate the ring */
-    ret->buffer = vmalloc(bytes_per_frame * frame_count);
-    pr_rxbuf_debug(PR "Allocating %d bytes ringbuffer (0x%p)\n", 
-                   bytes_per_frame * frame_count, ret->buffer);
-    if (unlikely(!ret->buffer)) {
-        rtnrt_err(PR "Allocating ring buffer failed\n");
+    /* the readers, more can be added later, see rxbuf_add_reader() */
+    ret->readers = ker_malloc(MOST_SYNC_OPENS * sizeof(struct rxbuf_reader *));
+    if (unlikely(!ret->readers)) {
+        rtnrt_err(PR "Allocating the reader table failed\n");
         goto err_buf;
     }
-#ifdef DEBUG
-    memset(ret->buffer, 0, bytes_per_frame * frame_count);
-#endif
+    memset(ret->readers, 0, MOST_SYNC_OPENS * sizeof(struct rxbuf_reader *));
+    for (i = 0; i < reader_count; i++) {
+        ret->readers[i] = rxbuf_alloc_reader(ret, i);
+        if (unlikely(!ret->readers[i])) {
+            goto err_readers;
+        }
+    }
+
+    /* 
+     * allocate the control page and the ring, both can be mapped (only the
+     * control page in the demultiplexing mode)
+     */
+    ret->area = vmalloc_user(rxbuf_mmap_size(ret));
+    if (unlikely(!ret->area)) {
+        rtnrt_err(PR "Allocating ring buffer failed\n");
+        goto err_readers;
+    }
+    ret->ctrl = ret->area;
+
+    if (ret->demux) {
+        unsigned int size = 0;
+
+        /* one compact ring per reader */
+        for (i = 0; i < reader_count; i++) {
+            ret->readers[i]->part = parts[i];
+            if (unlikely(parts[i].count > (UINT_MAX - size) / frame_count)) {
+                rtnrt_err(PR "Demultiplexed rings are too large\n");
+                goto err_area;
+            }
+            size += parts[i].count * frame_count;
+        }
+
+        ret->part_area = vmalloc(size);
+        pr_rxbuf_debug(PR "Allocating %d bytes demultiplexed ringbuffers (0x%p)\n", 
+                       size, ret->part_area);
+        if (unlikely(!ret->part_area)) {
+            rtnrt_err(PR "Allocating ring buffers failed\n");
+            goto err_area;
+        }
+
+        size = 0;
+        for (i = 0; i < reader_count; i++) {
+            ret->readers[i]->part_buffer = ret->part_area + size;
+            size += parts[i].count * frame_count;
+        }
+    } else {
+        ret->buffer = ret->dma 
+            ? dma_buffer
+            : (unsigned char *)ret->area + PAGE_SIZE;
+        pr_rxbuf_debug(PR "Allocating %d bytes ringbuffer (0x%p)\n", 
+                       bytes_per_frame * frame_count, ret->buffer);
+    }
+
+    /* the control page (already zeroed by vmalloc_user()) */
+    ret->ctrl->frame_count     = frame_count;
+    ret->ctrl->bytes_per_frame = bytes_per_frame;
+    ret->ctrl->state           = RX_MMAP_VALID;
+
+    return ret;
+    
+err_area:
+    vfree(ret->area);
+err_readers:
+    for (i = 0; i < reader_count; i++) {
+        kfree(ret->readers[i]);
+    }
+    kfree(ret->readers);
+err_buf:
+    kfree(ret);
+    return NULL;
+}
+
+/*
+ * Documentation: see header
+ */
+struct rx_buffer *rxbuf_alloc(unsigned int              reader_count, 
+                              unsigned int              frame_count, 
+                              unsigned int              bytes_per_frame,
+                              const struct frame_part   *parts)
+{
+    /* one element more to determine empty and full rings */
+    return rxbuf_create(reader_count, frame_count + 1, bytes_per_frame, 
+                        parts, NULL);
+}
+
+/*
+ * Documentation: see header
+ */
+struct rx_buffer *rxbuf_alloc_dma(unsigned int      reader_count,
+                                  unsigned int      frame_count,
+                                  unsigned int      bytes_per_frame,
+                                  unsigned int      reserved_frames,
+                                  unsigned char     *buffer)
+{
+    struct rx_buffer *ret;
+
+    return_value_if_fails_dbg(buffer != NULL, NULL);
+    return_value_if_fails_dbg(reserved_frames < frame_count, NULL);
+
+    ret = rxbuf_create(reader_count, frame_count, bytes_per_frame, NULL, buffer);
+    if (likely(ret)) {
+        ret->capacity = frame_count - reserved_frames;
+    }
+
+    return ret;
+}
+
+/*
+ * Documentation: see header
+ */
+void rxbuf_free(struct rx_buffer *ring)
+{
+    unsigned int i;
+
+    if (ring) {
+        if (ring->area) {
+            /* 
+             * pages which are still mapped in userspace stay allocated until
+             * they are unmapped, so tell the user that the ring is gone
+             */
+            ring->ctrl->state = RX_MMAP_STALE;
+            vfree(ring->area);
+        }
+        if (ring->part_area) {
+            vfree(ring->part_area);
+        }
+        for (i = 0; i < MOST_SYNC_OPENS; i++) {
+            kfree(ring->readers[i]);
+        }
+        kfree(ring->readers);
+        kfree(ring);
+    }
+}
+
+/**
+ * Reads @c frames_written and @c write_index of the ring consistently.
+ *
+ * @param ring the ring buffer
+ * @param write_index the write index is stored there
+ * @return the sequence number of the frame which is written next
+ */
+static inline u64 rxbuf_write_position(struct rx_buffer *ring,
+                                       unsigned int     *write_index)
+{
+    unsigned int    seq;
+    u64             ret;
+
+    do {
+        seq = ring->write_seq;
+        smp_rmb();
+        ret = ring->frames_written;
+        *write_index = ring->write_index;
+        smp_rmb();
+    } while (unlikely((seq & 1) || seq != ring->write_seq));
+
+    return ret;
+}
+
+/**
+ * Sets the read position of a reader to @p behind frames before the write
+ * position.
+ *
+ * @param ring the ring buffer
+ * @param reader_index the index of the reader
+ * @param written the sequence number of the frame which is written next
+ * @param write_index the write index that belongs to @p written
+ * @param behind the number of frames, must be less than @c frame_count
+ */
+static inline void rxbuf_seek(struct rx_buffer  *ring,
+                              unsigned int      reader_index,
+                              u64               written,
+                              unsigned int      write_index,
+                              unsigned int      behind)
+{
+    struct rxbuf_reader *reader = ring->readers[reader_index];
+    unsigned int readi;
+
+    readi = (write_index >= behind) 
+        ? write_index - behind
+        : write_index + ring->frame_count - behind;
+
+    reader->read_seq = written - behind;
+    reader->read_index = readi;
+    ring->ctrl->read_offset[reader_index] = readi * ring->bytes_per_frame;
+}
+
+/**
+ * Handles an overrun of a reader: skips to the newest frames and counts the
+ * frames before them as lost. The last page, or the watermark of the reader
+ * if that is more, is kept, so the next read returns the newest data at
+ * once. The @c latest_frames policy limits that.
+ *
+ * @param ring the ring buffer
+ * @param reader_index the index of the reader
+ * @param written the sequence number of the frame which is written next
+ * @param write_index the write index that belongs to @p written
+ * @return @c -EOVERFLOW if the policy of the reader is RX_OVERRUN_ERROR,
+ *         the number of frames which can be read now otherwise
+ */
+static int rxbuf_overrun(struct rx_buffer   *ring,
+                         unsigned int       reader_index,
+                         u64                written,
+                         unsigned int       write_index)
+{
+    struct rxbuf_reader *reader = ring->readers[reader_index];
+    struct rx_stats *stats = &reader->stats;
+    unsigned int    keep = max(ring->page_frames, reader->watermark);
+    rtnrt_lockctx_t flags;
+
+    if (reader->policy.latest_frames != 0) {
+        keep = min(keep, reader->policy.latest_frames);
+    }
+    keep = min(keep, ring->capacity);
+
+    rtnrt_lock_get_irqsave(&reader->stats_lock, flags);
+    stats->lost_frames += written - keep - reader->read_seq;
+    stats->overruns++;
+    rxbuf_seek(ring, reader_index, written, write_index, keep);
+    rtnrt_lock_put_irqrestore(&reader->stats_lock, flags);
+
+    pr_rxbuf_debug(PR "Reader %d overrun, %llu frames lost\n", reader_index,
+                   (unsigned long long)stats->lost_frames);
+
+    return reader->policy.overrun == RX_OVERRUN_ERROR 
+        ? -EOVERFLOW 
+        : (int)keep;
+}
+
+/**
+ * Returns the number of frames which can be read by a reader. Handles
+ * overruns and applies the @c latest_frames policy of the reader, so the
+ * read position may change.
+ *
+ * @param ring the ring buffer
+ * @param reader_index the index of the reader
+ * @return the number of frames, @c -EOVERFLOW (see rxbuf_overrun())
+ */
+static inline int rxbuf_frames_full(struct rx_buffer   *ring,
+                                    unsigned int       reader_index)
+{
+    struct rxbuf_reader *reader = ring->readers[reader_index];
+    unsigned int    write_index;
+    unsigned int    latest = reader->policy.latest_frames;
+    u64             written, frames_full;
+
+    written = rxbuf_write_position(ring, &write_index);
+    frames_full = written - reader->read_seq;
+
+    if (unlikely(frames_full > ring->capacity)) {
+        return rxbuf_overrun(ring, reader_index, written, write_index);
+    }
+
+    if (latest != 0 && frames_full > latest) {
+        rtnrt_lockctx_t flags;
+
+        rtnrt_lock_get_irqsave(&reader->stats_lock, flags);
+        reader->stats.skipped_frames += frames_full - latest;
+        rxbuf_seek(ring, reader_index, written, write_index, latest);
+        rtnrt_lock_put_irqrestore(&reader->stats_lock, flags);
+        frames_full = latest;
+    }
+
+    return frames_full;
+}
+
+/**
+ * Checks after copying if the interrupt service routine has overwritten the
+ * frames of a reader during the copy, i.e. if the reader was overrun.
+ *
+ * @param ring the ring buffer
+ * @param reader_index the index of the reader
+ * @return 0 if not, the return value of rxbuf_overrun() (which has been
+ *         called then) otherwise
+ */
+static inline int rxbuf_check_lapped(struct rx_buffer   *ring,
+                                     unsigned int       reader_index)
+{
+    struct rxbuf_reader *reader = ring->readers[reader_index];
+    unsigned int    write_index;
+    u64             written;
+
+    written = rxbuf_write_position(ring, &write_index);
+    if (likely(written - reader->read_seq <= ring->capacity)) {
+        return 0;
+    }
+
+    rxbuf_overrun(ring, reader_index, written, write_index);
+    return reader->policy.overrun == RX_OVERRUN_ERROR 
+        ? -EOVERFLOW 
+        : -EAGAIN;
+}
+
+/**
+ * Advances the read position of a reader by @p frames frames.
+ *
+ * @param ring the ring buffer
+ * @param reader_index the index of the reader
+ * @param frames the number of frames
+ */
+static inline void rxbuf_consume(struct rx_buffer   *ring,
+                                 unsigned int       reader_index,
+                                 unsigned int       frames)
+{
+    struct rxbuf_reader *reader = ring->readers[reader_index];
+    unsigned int readi = reader->read_index + frames;
+
+    if (readi >= ring->frame_count) {
+        readi -= ring->frame_count;
+    }
+
+    reader->last_seq = reader->read_seq;
+    reader->read_seq += frames;
+    reader->read_index = readi;
+    ring->ctrl->read_offset[reader_index] = readi * ring->bytes_per_frame;
+}
+
+/**
+ * Gathers @p frames frame parts of @p count bytes each, which are @p stride
+ * bytes apart, from @p src into the contiguous buffer @p dst. The loop is
+ * expanded with a fixed @p count so that the compiler can replace the
+ * memcpy() with a single load and store per frame.
+ *
+ * @param dst the destination
+ * @param src the first byte of the frame part in the first frame
+ * @param frames the number of frames
+ * @param stride the number of bytes per frame in the ring
+ * @param count the number of bytes of each frame part, must be a constant
+ */
+#define rxbuf_gather_fixed(dst, src, frames, stride, count)                 \
+    do {                                                                    \
+        unsigned int __i;                                                   \
+                                                                            \
+        for (__i = 0; __i + 4 <= (frames); __i += 4) {                      \
+            memcpy((dst),             (src),                (count));       \
+            memcpy((dst) + (count),   (src) + (stride),     (count));       \
+            memcpy((dst) + 2*(count), (src) + 2*(stride),   (count));       \
+            memcpy((dst) + 3*(count), (src) + 3*(stride),   (count));       \
+            (dst) += 4*(count);                                             \
+            (src) += 4*(stride);                                            \
+        }                                                                   \
+        for (; __i < (frames); __i++) {                                     \
+            memcpy((dst), (src), (count));                                  \
+            (dst) += (count);                                               \
+            (src) += (stride);                                              \
+        }                                                                   \
+    } while (0)
+
+/**
+ * Copies the frame part of @p frames consecutive frames of the ring to the
+ * kernel buffer @p dst. The frames must not wrap at the end of the ring.
+ * There are specialisations for the common frame part sizes.
+ *
+ * @param dst the destination (kernel memory)
+ * @param src the first byte of the frame part in the first frame
+ * @param frames the number of frames
+ * @param stride the number of bytes per frame in the ring
+ * @param count the number of bytes of each frame part
+ */
+static inline void rxbuf_gather(unsigned char          *dst,
+                                const unsigned char    *src,
+                                unsigned int           frames,
+                                unsigned int           stride,
+                                unsigned int           count)
+{
+    switch (count) {
+        case 2:
+            rxbuf_gather_fixed(dst, src, frames, stride, 2);
+            break;
+
+        case 4:
+            rxbuf_gather_fixed(dst, src, frames, stride, 4);
+            break;
+
+        case 8:
+            rxbuf_gather_fixed(dst, src, frames, stride, 8);
+            break;
+
+        case 16:
+            rxbuf_gather_fixed(dst, src, frames, stride, 16);
+            break;
+
+        default:
+            rxbuf_gather_fixed(dst, src, frames, stride, count);
+            break;
+    }
+}
+
+/**
+ * Implementation of rxbuf_get() in the demultiplexing mode: the frame parts of
+ * the reader are stored contiguously, so the data is copied with at most two
+ * calls of the copy function.
+ *
+ * @param ring the ring buffer
+ * @param reader_index the index of the reader
+ * @param frames the number of frames to copy, must be available
+ * @param buffer the destination
+ * @param copy the copy descriptor
+ * @return the number of frames that have been copied
+ */
+static unsigned int rxbuf_get_demux(struct rx_buffer            *ring,
+                                    unsigned int                reader_index,
+                                    unsigned int                frames,
+                                    unsigned char               *buffer,
+                                    struct rtnrt_memcopy_desc   *copy)
+{
+    struct rxbuf_reader *reader = ring->readers[reader_index];
+    unsigned int   count = reader->part.count;
+    unsigned int   readi = reader->read_index;
+    unsigned int   done  = 0;
+    int            err;
+
+    while (done < frames) {
+        /* don't cross the end of the ring */
+        unsigned int chunk = min(frames - done, ring->frame_count - readi);
+
+        err = rtnrt_copy(copy, buffer, 
+                reader->part_buffer + readi * count, chunk * count);
+        if (err != 0) {
+            rtnrt_warn(PR "Error %d in copy, copied %d frames\n", err, done);
+            break;
+        }
+
+        readi += chunk;
+        if (readi >= ring->frame_count) {
+            readi = 0;
+        }
+        buffer += chunk * count;
+        done += chunk;
+    }
+
+    return done;
+}
+
+/**
+ * Implementation of rxbuf_get() for the shared ring: the frame parts are
+ * gathered into the bounce buffer of the reader and each chunk is copied with
+ * one call of the copy function.
+ *
+ * @param ring the ring buffer
+ * @param reader_index the index of the reader
+ * @param frame_part the frame part of the reader
+ * @param frames the number of frames to copy, must be available
+ * @param buffer the destination
+ * @param copy the copy descriptor
+ * @return the number of frames that have been copied
+ */
+static unsigned int rxbuf_get_gather(struct rx_buffer            *ring,
+                                     unsigned int                reader_index,
+                                     struct frame_part           frame_part,
+                                     unsigned int                frames,
+                                     unsigned char               *buffer,
+                                     struct rtnrt_memcopy_desc   *copy)
+{
+    struct rxbuf_reader *reader = ring->readers[reader_index];
+    unsigned char  *bounce    = reader->bounce;
+    unsigned int   chunk_max  = RXBUF_BOUNCE_SIZE / frame_part.count;
+    unsigned int   readi      = reader->read_index;
+    unsigned int   done       = 0;
+    int            err;
+
+    while (done < frames) {
+        unsigned int        chunk;
+        unsigned char       *dst = bounce;
+        const unsigned char *src = ring->buffer + readi * ring->bytes_per_frame
+                                   + frame_part.offset;
+
+        /* don't cross the end of the ring nor the end of the bounce buffer */
+        chunk = min(frames - done, chunk_max);
+        chunk = min(chunk, ring->frame_count - readi);
+
+        rxbuf_gather(dst, src, chunk, ring->bytes_per_frame, frame_part.count);
+
+        err = rtnrt_copy(copy, buffer, bounce, chunk * frame_part.count);
+        if (err != 0) {
+            rtnrt_warn(PR "Error %d in copy, copied %d frames\n", err, done);
+            break;
+        }
+
+        readi += chunk;
+        /* wrap at the end */
+        if (readi >= ring->frame_count) {
+            readi = 0;
+        }
+        buffer += chunk * frame_part.count;
+        done += chunk;
+    }
+
+    return done;
+}
+
+/*
+ * Documentation: see header
+ */
+ssize_t rxbuf_get(struct rx_buffer              *ring,
+                  unsigned int                  reader_index,
+                  struct frame_part             frame_part,
+                  unsigned char                 *buffer,
+                  size_t                        bytes,
+                  struct rtnrt_memcopy_desc     *copy)
+{
+    int            frames_full;
+    unsigned int   frames_to_copy;
+    int            err;
+    
+    /* round down if necessary */
+    bytes -= bytes % frame_part.count;
+
+    /* check the ring size */
+    if (bytes / frame_part.count > ring->frame_count) {
+        rtnrt_err(PR "bytes (%d) must be smaller than ring_size (%d)\n",
+               (int)bytes, ring->frame_count * frame_part.count);
+        return -EINVAL;
+    }
+
+again:
+    /* get the number of elements to copy */
+    frames_full = rxbuf_frames_full(ring, reader_index);
+    if (unlikely(frames_full < 0)) {
+        return frames_full;
+    }
+    frames_to_copy = min((size_t)frames_full, bytes / frame_part.count);
+    
+    pr_rxbuf_debug(PR "frames full: %d, frames to copy: %d\n", 
+                   frames_full, frames_to_copy);
+
+    /* if the ring is empty, we return that */
+    if (frames_to_copy == 0) {
+        return 0;
+    }
+
+    if (ring->demux) {
+        frames_to_copy = rxbuf_get_demux(ring, reader_index, frames_to_copy,
+                                         buffer, copy);
+    } else {
+        frames_to_copy = rxbuf_get_gather(ring, reader_index, frame_part,
+                                          frames_to_copy, buffer, copy);
+    }
+
+    /* the copy failed before the first frame */
+    if (unlikely(frames_to_copy == 0)) {
+        return -EFAULT;
+    }
+
+    /*
+     * the copied frames are garbage if they were overwritten meanwhile,
+     * with RX_OVERRUN_SKIP read again from the new position (the buffer
+     * is overwritten then, or 0 is returned because there's no data)
+     */
+    err = rxbuf_check_lapped(ring, reader_index);
+    if (unlikely(err != 0)) {
+        if (err == -EAGAIN) {
+            goto again;
+        }
+        return err;
+    }
+
+    rxbuf_consume(ring, reader_index, frames_to_copy);
+
+    return frames_to_copy * frame_part.count;
+}
+
+/*
+ * Documentation: see header
+ */
+int rxbuf_stripes_bounds(const struct rx_stripes    *stripes,
+                         struct frame_part          *bounds)
+{
+    unsigned int first = NUM_OF_QUADLETS * 4;
+    unsigned int last  = 0;
+    unsigned int i;
+
+    if (stripes->count == 0 || stripes->count > RX_STRIPES_MAX) {
+        return -EINVAL;
+    }
+    if (stripes->layout != RX_LAYOUT_INTERLEAVED &&
+            stripes->layout != RX_LAYOUT_PLANAR) {
+        return -EINVAL;
+    }
+
+    for (i = 0; i < stripes->count; i++) {
+        const struct frame_part *part = &stripes->part[i];
+
+        if (part->count == 0 || part->count > NUM_OF_QUADLETS * 4 ||
+                part->offset > NUM_OF_QUADLETS * 4 - part->count) {
+            return -EINVAL;
+        }
+
+        first = min(first, part->offset);
+        last = max(last, part->offset + part->count);
+    }
+
+    bounds->offset = first;
+    bounds->count  = last - first;
+
+    return 0;
+}
+
+/**
+ * Copies the stripes of @p frames consecutive frames of the ring to the kernel
+ * buffer @p dst in the interleaved layout. The frames must not wrap at the end
+ * of the ring.
+ *
+ * @param dst the destination (kernel memory)
+ * @param src the first frame in the ring
+ * @param frames the number of frames
+ * @param stride the number of bytes per frame in the ring
+ * @param stripes the stripes
+ * @param base the offset of the first byte of @p src in the MOST frame
+ */
+static inline void rxbuf_gather_interleaved(unsigned char           *dst,
+                                            const unsigned char     *src,
+                                            unsigned int            frames,
+                                            unsigned int            stride,
+                                            const struct rx_stripes *stripes,
+                                            unsigned int            base)
+{
+    unsigned int i, s;
+
+    for (i = 0; i < frames; i++) {
+        for (s = 0; s < stripes->count; s++) {
+            memcpy(dst, src + stripes->part[s].offset - base,
+                   stripes->part[s].count);
+            dst += stripes->part[s].count;
+        }
+        src += stride;
+    }
+}
+
+/*
+ * Documentation: see header
+ */
+ssize_t rxbuf_get_stripes(struct rx_buffer              *ring,
+                          unsigned int                  reader_index,
+                          const struct rx_stripes       *stripes,
+                          unsigned char                 *buffer,
+                          size_t                        bytes,
+                          struct rtnrt_memcopy_desc     *copy)
+{
+    struct rxbuf_reader *reader = ring->readers[reader_index];
+    unsigned char       *bounce = reader->bounce;
+    const unsigned char *base   = ring->buffer;
+    unsigned int        stride  = ring->bytes_per_frame;
+    unsigned int        first   = 0;
+    unsigned int        frame_bytes = 0, max_count = 0;
+    unsigned int        frames_to_copy, chunk_max, readi, done, s;
+    int                 frames_full;
+    int                 err;
+
+    /* in the demultiplexing mode, the ring only contains the bounds */
+    if (ring->demux) {
+        base   = reader->part_buffer;
+        stride = reader->part.count;
+        first  = reader->part.offset;
+    }
+
+    for (s = 0; s < stripes->count; s++) {
+        frame_bytes += stripes->part[s].count;
+        max_count = max(max_count, stripes->part[s].count);
+    }
+
+    /* check the ring size */
+    if (bytes / frame_bytes > ring->frame_count) {
+        rtnrt_err(PR "bytes (%d) must be smaller than ring_size (%d)\n",
+               (int)bytes, ring->frame_count * frame_bytes);
+        return -EINVAL;
+    }
+
+again:
+    /* get the number of elements to copy */
+    frames_full = rxbuf_frames_full(ring, reader_index);
+    if (unlikely(frames_full < 0)) {
+        return frames_full;
+    }
+    frames_to_copy = min((size_t)frames_full, bytes / frame_bytes);
+    if (frames_to_copy == 0) {
+        return 0;
+    }
+
+    chunk_max = RXBUF_BOUNCE_SIZE / (stripes->layout == RX_LAYOUT_INTERLEAVED
+                                     ? frame_bytes : max_count);
+    readi = reader->read_index;
+    done  = 0;
+
+    /* one pass over the ring, each chunk is copied to all stripes */
+    while (done < frames_to_copy) {
+        const unsigned char *src = base + readi * stride;
+        unsigned int        chunk;
+
+        /* don't cross the end of the ring nor the end of the bounce buffer */
+        chunk = min(frames_to_copy - done, chunk_max);
+        chunk = min(chunk, ring->frame_count - readi);
+
+        if (stripes->layout == RX_LAYOUT_INTERLEAVED) {
+            rxbuf_gather_interleaved(bounce, src, chunk, stride, stripes, first);
+            err = rtnrt_copy(copy, buffer + done * frame_bytes, bounce,
+                    chunk * frame_bytes);
+        } else {
+            unsigned char *plane = buffer;
+
+            err = 0;
+            for (s = 0; s < stripes->count && err == 0; s++) {
+                unsigned int count = stripes->part[s].count;
+
+                rxbuf_gather(bounce, src + stripes->part[s].offset - first,
+                        chunk, stride, count);
+                err = rtnrt_copy(copy, plane + done * count, bounce,
+                        chunk * count);
+                plane += frames_to_copy * count;
+            }
+        }
+
+        /* a partial copy would break the layout */
+        if (err != 0) {
+            rtnrt_warn(PR "Error %d in copy, copied %d frames\n", err, done);
+            return -EFAULT;
+        }
+
+        readi += chunk;
+        if (readi >= ring->frame_count) {
+            readi = 0;
+        }
+        done += chunk;
+    }
+
+    /* the copied frames are garbage if they were overwritten, see rxbuf_get() */
+    err = rxbuf_check_lapped(ring, reader_index);
+    if (unlikely(err != 0)) {
+        if (err == -EAGAIN) {
+            goto again;
+        }
+        return err;
+    }
+
+    rxbuf_consume(ring, reader_index, frames_to_copy);
+
+    return frames_to_copy * frame_bytes;
+}
+
+/*
+ * Documentation: see header
+ */
+ssize_t rxbuf_advance(struct rx_buffer  *ring,
+                      unsigned int      reader_index,
+                      size_t            frames)
+{
+    int frames_full;
+
+    /* get the number of frames that can be skipped */
+    frames_full = rxbuf_frames_full(ring, reader_index);
+    if (unlikely(frames_full < 0)) {
+        return frames_full;
+    }
+    frames = min((size_t)frames_full, frames);
+
+    rxbuf_consume(ring, reader_index, frames);
+
+    return frames;
+}
+
+/*
+ * Documentation: see header
+ */
+void rxbuf_set_policy(struct rx_buffer          *ring,
+                      unsigned int              reader_index,
+                      const struct rx_policy    *policy)
+{
+    ring->readers[reader_index]->policy = *policy;
+}
+
+/*
+ * Documentation: see header
+ */
+void rxbuf_get_stats(struct rx_buffer   *ring,
+                     unsigned int       reader_index,
+                     struct rx_stats    *stats)
+{
+    struct rxbuf_reader *reader = ring->readers[reader_index];
+    unsigned int write_index;
+    rtnrt_lockctx_t flags;
+
+    rtnrt_lock_get_irqsave(&reader->stats_lock, flags);
+    *stats = reader->stats;
+    stats->position        = reader->read_seq;
+    rtnrt_lock_put_irqrestore(&reader->stats_lock, flags);
+
+    stats->frames_received = rxbuf_write_position(ring, &write_index);
+    stats->reserved        = 0;
+}
+
+/*
+ * Documentation: see header
+ */
+void rxbuf_set_hw_width(struct rx_buffer *ring, unsigned int bytes)
+{
+    return_if_fails_dbg(bytes > 0 && bytes <= ring->bytes_per_frame);
+
+    ring->hw_bytes_per_frame = bytes;
+}
+
+/*
+ * Documentation: see header
+ */
+int rxbuf_add_reader(struct rx_buffer *ring, unsigned int reader_index)
+{
+    struct rxbuf_reader *reader;
+    unsigned int        write_index;
+    u64                 written;
+
+    return_value_if_fails_dbg(ring != NULL, -EINVAL);
+    return_value_if_fails_dbg(reader_index < MOST_SYNC_OPENS, -EINVAL);
+
+    if (ring->demux) {
+        return -EINVAL;
+    }
+
+    reader = rxbuf_alloc_reader(ring, reader_index);
+    if (unlikely(!reader)) {
+        return -ENOMEM;
+    }
+
+    /* the new reader must not see the frames before it was added */
+    ring->readers[reader_index] = reader;
+    written = rxbuf_write_position(ring, &write_index);
+    rxbuf_seek(ring, reader_index, written, write_index, 0);
+    reader->last_seq = written;
+
+    /* the interrupt service routine may look at the reader from now on */
+    smp_wmb();
+    if (reader_index >= ring->reader_count) {
+        ring->reader_count = reader_index + 1;
+    }
+
+    return 0;
+}
+
+/**
+ * Converts a number of frames to nanoseconds.
+ *
+ * @param frames the number of frames
+ * @return the duration of @p frames frames
+ */
+static inline u64 rxbuf_frames_to_ns(u64 frames)
+{
+    u64 nsec = frames * NSEC_PER_SEC;
+
+    do_div(nsec, STD_MOST_FRAMES_PER_SEC);
+    return nsec;
+}
+
+/**
+ * Returns the time at which a frame was received. That's the timestamp of the
+ * page that contains the frame minus the duration of the frames after it. If
+ * the page is older than the timestamps kept, the time is extrapolated from
+ * the oldest timestamp.
+ *
+ * @param ring the ring buffer
+ * @param seq the sequence number of the frame
+ * @param nsec the time is stored there
+ * @return @c true if the time is known, @c false if the frame has not been
+ *         received yet
+ */
+static bool rxbuf_frame_time(struct rx_buffer *ring, u64 seq, u64 *nsec)
+{
+    struct rxbuf_stamp  stamp = { 0, 0 };
+    unsigned int        write_seq, count, i;
+
+    do {
+        write_seq = ring->write_seq;
+        smp_rmb();
+
+        /* the oldest page that ends after the frame */
+        count = ring->stamp_count;
+        for (i = 1; i <= min(count, (unsigned int)RXBUF_STAMPS); i++) {
+            const struct rxbuf_stamp *s = 
+                &ring->stamps[(count - i) & (RXBUF_STAMPS - 1)];
+            if (s->seq <= seq) {
+                break;
+            }
+            stamp = *s;
+        }
+
+        smp_rmb();
+    } while (unlikely((write_seq & 1) || write_seq != ring->write_seq));
+
+    if (stamp.seq <= seq) {
+        return false;
+    }
+
+    *nsec = stamp.nsec - rxbuf_frames_to_ns(stamp.seq - 1 - seq);
+    return true;
+}
+
+/*
+ * Documentation: see header
+ */
+void rxbuf_get_timestamps(struct rx_buffer      *ring,
+                          unsigned int          reader_index,
+                          u64                   now,
+                          struct rx_timestamps  *timestamps)
+{
+    struct rxbuf_reader *reader = ring->readers[reader_index];
+    unsigned int    write_index;
+    u64             queued, oldest;
 
-    /* set the pointers right */
-    for (i = 0; i < ret->reader_count; i++) {
-        ret->readptr[i] = ret->buffer;
+    timestamps->position  = reader->last_seq;
+    timestamps->now       = now;
+    if (!rxbuf_frame_time(ring, timestamps->position, &timestamps->timestamp)) {
+        timestamps->timestamp = 0;
     }
-    ret->writeptr = ret->buffer;
 
-    return ret;
-    
-err_buf:
-    kfree(ret);
-    return NULL;
+    queued = rxbuf_write_position(ring, &write_index) - reader->read_seq;
+    timestamps->queued_frames = min(queued, (u64)ring->capacity);
+    timestamps->queue_delay   = 0;
+    if (queued != 0 && rxbuf_frame_time(ring, reader->read_seq, &oldest)
+            && now > oldest) {
+        oldest = now - oldest;
+        do_div(oldest, NSEC_PER_USEC);
+        timestamps->queue_delay = oldest;
+    }
 }
 
 /*
  * Documentation: see header
  */
-void rxbuf_free(struct rx_buffer *ring)
+bool rxbuf_is_empty(struct rx_buffer *ring, int reader_index)
 {
-    if (ring) {
-        if (ring->buffer) {
-            vfree(ring->buffer);
-        }
-        kfree(ring);
-    }
+    unsigned int write_index;
+
+    return rxbuf_write_position(ring, &write_index) == 
+        ring->readers[reader_index]->read_seq;
 }
 
 /*
  * Documentation: see header
  */
-ssize_t rxbuf_get(struct rx_buffer              *ring,
-                  unsigned int                  reader_index,
-                  struct frame_part             frame_part,
-                  unsigned char                 *buffer,
-                  size_t                        bytes,
-                  struct rtnrt_memcopy_desc     *copy)
+void rxbuf_set_watermark(struct rx_buffer   *ring,
+                         unsigned int       reader_index,
+                         unsigned int       frames)
 {
-    int            frames_to_copy, still_to_copy;
-    int            bytes_full;
-    unsigned char  *readp        = ring->readptr[reader_index];
-    unsigned int   ring_size     = ring->bytes_per_frame * ring->frame_count;
-    unsigned char  *ring_end     = ring->buffer + ring_size;
-    int            err;
-    
-    /* round down if necessary */
-    bytes -= bytes % frame_part.count;
-
-    /* check the ring size */
-    if (bytes > ring_size) {
-        rtnrt_err(PR "bytes (%d) must be smaller than ring_size (%d)\n",
-               (int)bytes, ring_size);
-        return -EINVAL;
-    }
+    ring->readers[reader_index]->watermark = max(frames, 1U);
+}
 
-    /* get the number of elements to copy */
-    bytes_full = ring->writeptr - readp;
-    if (bytes_full < 0) {
-        bytes_full = ring_size + bytes_full;
-    }
-    frames_to_copy = min((size_t)bytes_full / ring->bytes_per_frame, bytes / 
-            frame_part.count);
-    
-    pr_rxbuf_debug(PR "bytes full: %d, frames to copy: %d\n", 
-                   bytes_full, frames_to_copy);
+/*
+ * Documentation: see header
+ */
+bool rxbuf_watermark_reached(struct rx_buffer *ring, unsigned int reader_index)
+{
+    struct rxbuf_reader *reader = ring->readers[reader_index];
+    unsigned int write_index;
+    u64          frames_full;
 
-    /* if the ring is empty, we return that */
-    if (frames_to_copy == 0) {
-        return 0;
-    }
+    frames_full = rxbuf_write_position(ring, &write_index) -
+        reader->read_seq;
 
-    /* now we have frames to copy, let's do it */
-    still_to_copy = frames_to_copy;
-    while (still_to_copy > 0) {
-        //pr_debugm("frame_part.offset = %d, frame_part.count = %d\n", 
-        //          frame_part.offset, frame_part.count);
-        err = rtnrt_copy(copy, buffer, readp + frame_part.offset, frame_part.count);
+    return frames_full >= min(reader->watermark, ring->capacity);
+}
 
-        if (err != 0) {
-            rtnrt_warn(PR "Error %d in copy, copied %d bytes\n", 
-                       err, frames_to_copy - still_to_copy);
-            return (frames_to_copy - still_to_copy) * frame_part.count;
-        }
+/**
+ * Starts writing frames into the ring. The readers check the data after
+ * copying, see rxbuf_check_lapped().
+ *
+ * @param ring the ring buffer
+ */
+static inline void rxbuf_write_begin(struct rx_buffer *ring)
+{
+    ring->write_seq++;
+    ring->ctrl->write_seq = ring->write_seq;
+    smp_wmb();
+}
 
-        readp += ring->bytes_per_frame;
-        /* wrap at the end */
-        if (readp >= ring_end) {
-            readp = ring->buffer;
-        }
-        buffer += frame_part.count;
-        still_to_copy--;
+/**
+ * Publishes the frames written after rxbuf_write_begin().
+ *
+ * @param ring the ring buffer
+ * @param frames the number of frames that have been written
+ * @param write_index the new write index
+ */
+static inline void rxbuf_write_end(struct rx_buffer    *ring,
+                                   unsigned int        frames,
+                                   unsigned int        write_index)
+{
+    /* the data must be visible before the write index */
+    smp_wmb();
+    if (frames != 0) {
+        ring->page_frames = frames;
     }
-
-    ring->readptr[reader_index] = readp;
-
-    return frames_to_copy * frame_part.count;
-
+    ring->frames_written += frames;
+    ring->write_index = write_index;
+    ring->ctrl->write_offset = write_index * ring->bytes_per_frame;
+    ring->ctrl->frames_written = ring->frames_written;
+    smp_wmb();
+    ring->write_seq++;
+    ring->ctrl->write_seq = ring->write_seq;
 }
 
 /*
  * Documentation: see header
  */
-bool rxbuf_is_empty(struct rx_buffer *ring, int reader_index)
+void rxbuf_timestamp(struct rx_buffer *ring, u64 nsec)
 {
-    return ring->writeptr == ring->readptr[reader_index];
+    struct rxbuf_stamp *stamp;
+
+    stamp = &ring->stamps[ring->stamp_count & (RXBUF_STAMPS - 1)];
+
+    rxbuf_write_begin(ring);
+    stamp->seq  = ring->frames_written;
+    stamp->nsec = nsec;
+    ring->stamp_count++;
+    rxbuf_write_end(ring, 0, ring->write_index);
 }
 
 /*
@@ -198,51 +1150,137 @@ ssize_t rxbuf_put(struct rx_buffer      *ring,
                   unsigned char         *buffer,
                   size_t                bytes)
 {
-    int       to_copy;
-    int       ring_size = ring->bytes_per_frame * ring->frame_count;
+    unsigned int    frames, writei, i, hw_bpf;
 
     return_value_if_fails_dbg(ring != NULL, -EINVAL);
     return_value_if_fails_dbg(buffer != NULL, -EINVAL);
-    pr_rxbuf_debug(PR "rxbuf_put=%d\n", bytes);
+    pr_rxbuf_debug(PR "rxbuf_put=%d\n", (int)bytes);
+
+    hw_bpf = ring->hw_bytes_per_frame;
 
     /* check if bytes is ok */
-    if ((bytes % ring->bytes_per_frame != 0)) {
+    if ((bytes % hw_bpf != 0)) {
         rtnrt_err(PR "bytes (%d) must be dividable by %d or is too large\n",
-               (int)bytes, ring->bytes_per_frame);
+               (int)bytes, hw_bpf);
         return -EINVAL;
     }
 
-    /* number of bytes to copy in the first step */
-    to_copy = min((int)bytes,
-                  (int)(ring_size - (unsigned long)(ring->writeptr - ring->buffer)));
+    frames = bytes / hw_bpf;
+    writei = ring->write_index;
 
-    if (to_copy == 0) {
-        return 0;
+    rxbuf_write_begin(ring);
+
+    while (frames > 0) {
+        /* don't cross the end of the ring */
+        unsigned int chunk = min(frames, ring->frame_count - writei);
+
+        if (ring->demux) {
+            /* split the frames into the rings of the readers */
+            for (i = 0; i < ring->reader_count; i++) {
+                unsigned int count = ring->readers[i]->part.count;
+
+                rxbuf_gather(ring->readers[i]->part_buffer + writei * count,
+                             buffer + ring->readers[i]->part.offset, chunk,
+                             hw_bpf, count);
+            }
+        } else if (hw_bpf == ring->bytes_per_frame) {
+            memcpy(ring->buffer + writei * ring->bytes_per_frame, buffer,
+                   chunk * ring->bytes_per_frame);
+        } else {
+            /* the card writes narrower frames than the ring stores */
+            unsigned char *dst = ring->buffer + writei * ring->bytes_per_frame;
+
+            for (i = 0; i < chunk; i++) {
+                memcpy(dst + i * ring->bytes_per_frame, buffer + i * hw_bpf,
+                       hw_bpf);
+            }
+        }
+
+        buffer += chunk * hw_bpf;
+        frames -= chunk;
+        writei += chunk;
+        if (writei >= ring->frame_count) {
+            writei = 0;
+        }
+    }
+
+    rxbuf_write_end(ring, bytes / hw_bpf, writei);
+
+    return bytes;
+}
+
+/*
+ * Documentation: see header
+ */
+ssize_t rxbuf_commit(struct rx_buffer *ring, size_t frames)
+{
+    unsigned int writei;
+
+    return_value_if_fails_dbg(ring != NULL, -EINVAL);
+    return_value_if_fails_dbg(frames <= ring->frame_count, -EINVAL);
+
+    writei = ring->write_index + frames;
+    if (writei >= ring->frame_count) {
+        writei -= ring->frame_count;
     }
 
-    /* copy data */
-    memcpy(ring->writeptr, buffer, to_copy);
+    /* the device has already written the frames, only publish them */
+    rxbuf_write_begin(ring);
+    rxbuf_write_end(ring, frames, writei);
+
+    return frames;
+}
+
+/*
+ * Documentation: see header
+ */
+void rxbuf_drop(struct rx_buffer *ring, unsigned int frames)
+{
+    struct rxbuf_reader *reader;
+    rtnrt_lockctx_t     flags;
+    unsigned int        i;
 
-    /* no overflow? */
-    if ((unsigned int)to_copy == bytes) {
-        /* adjust the ring */
-        ring->writeptr += to_copy;
-        if (ring->writeptr >= (ring->buffer + ring_size)) {
-            ring->writeptr = ring->buffer;
+    for (i = 0; i < ring->reader_count; i++) {
+        reader = ring->readers[i];
+        if (!reader) {
+            continue;
         }
-    } else {
-        /* copy the rest */
-        buffer += to_copy;
-        to_copy = bytes - to_copy;
 
-        memcpy(ring->buffer, buffer, to_copy);
+        rtnrt_lock_get_irqsave(&reader->stats_lock, flags);
+        reader->stats.lost_frames += frames;
+        reader->stats.overruns++;
+        rtnrt_lock_put_irqrestore(&reader->stats_lock, flags);
+    }
+
+    pr_rxbuf_debug(PR "%u frames dropped\n", frames);
+}
+
+#ifndef USP_TEST
+/*
+ * Documentation: see header
+ */
+int rxbuf_mmap(struct rx_buffer *ring, struct vm_area_struct *vma)
+{
+    unsigned long size = vma->vm_end - vma->vm_start;
+
+    /* the readers have no common ring or the ring is DMA memory */
+    if (ring->demux || ring->dma) {
+        return -ENODEV;
+    }
 
-        /* adjust the ring */
-        ring->writeptr = ring->buffer + to_copy;
+    if (vma->vm_pgoff != 0 || size > rxbuf_mmap_size(ring)) {
+        return -EINVAL;
     }
 
-    return bytes;
+    /* the ring is written by the interrupt service routine only */
+    if (vma->vm_flags & VM_WRITE) {
+        return -EPERM;
+    }
+    vma->vm_flags &= ~VM_MAYWRITE;
+
+    return remap_vmalloc_range(vma, ring->area, 0);
 }
+#endif
 
 #ifdef DEBUG
 static spinlock_t print_lock = RTNRT_LSPINLOCK_UNLOCKED(print_lock);
@@ -252,21 +1290,34 @@ static spinlock_t print_lock = RTNRT_LSPINLOCK_UNLOCKED(print_lock);
  */
 void rxbuf_print_debug(struct rx_buffer *ring, bool data)
 {
-    unsigned int i;
+    unsigned int i, j;
 
     spin_lock(&print_lock);
 
     rtnrt_debug("Frames in ring       : %d\n", ring->frame_count);
     rtnrt_debug("Bytes per frame      : %d\n", ring->bytes_per_frame);
-    rtnrt_debug("Write offset         : %d\n", ring->writeptr - ring->buffer);
+    rtnrt_debug("Demultiplexed        : %d\n", ring->demux);
+    rtnrt_debug("Write index          : %d\n", ring->write_index);
 
-    /* now print the information per writer */
+    /* now print the information per reader, there may be unused slots */
     for (i = 0; i < ring->reader_count; i++) {
-        rtnrt_debug("Read offset    [%2d]  : %d\n", i, 
-                ring->readptr[i] - ring->buffer);
+        if (!ring->readers[i]) {
+            continue;
+        }
+        rtnrt_debug("Read index     [%2d]  : %d\n", i, ring->readers[i]->read_index);
     }
 
-    if (data) {
+    if (data && ring->demux) {
+        for (i = 0; i < ring->reader_count; i++) {
+            if (!ring->readers[i]) {
+                continue;
+            }
+            for (j = 0; j < ring->frame_count * ring->readers[i]->part.count; j++) {
+                rtnrt_printk("%-2.2X ", ring->readers[i]->part_buffer[j]);
+            }
+            rtnrt_printk("\n");
+        }
+    } else if (data) {
         for (i = 0; i < (ring->frame_count * ring->bytes_per_frame); i++)
         {
             rtnrt_printk("%-2.2X ", ring->buffer[i]);
@@ -280,21 +1331,237 @@ void rxbuf_print_debug(struct rx_buffer *ring, bool data)
 #endif
 
 #ifdef USP_TEST
-/* Use `gcc -DDEBUG -DUSP_TEST -o most-rxbuf most-rxbuf.c' */
+/* Use `gcc -O2 -DDEBUG -DUSP_TEST -o most-rxbuf most-rxbuf.c' */
 /* -------------------------------------------------------------------------- */
+#include <time.h>
+
+/**
+ * Number of frames in the benchmark ring (one second).
+ */
+#define BENCH_FRAMES            44100
+
+/**
+ * Number of bytes per frame in the benchmark ring (15 quadlets).
+ */
+#define BENCH_BYTES_PER_FRAME   60
+
+/**
+ * Number of frames read per rxbuf_get() call in the benchmark, that's the
+ * 176 KB read of sync-rx.c with 4 bytes per frame.
+ */
+#define BENCH_READ_FRAMES       44000
+
+/**
+ * Number of repetitions of each benchmark run.
+ */
+#define BENCH_RUNS              50
+
+/**
+ * Copy function of the test, not inlined like copy_to_user() in the kernel.
+ */
+static unsigned long __attribute__((noinline)) usp_copy(void           *to,
+                                                        const void     *from,
+                                                        unsigned long  count,
+                                                        void           *cookie)
+{
+    memcpy(to, from, count);
+    return 0;
+}
+
+/**
+ * The implementation of rxbuf_get() without gathering, i.e. one call of the
+ * copy function per frame. Only used as reference for the benchmark.
+ */
+static ssize_t rxbuf_get_per_frame(struct rx_buffer              *ring,
+                                   unsigned int                  reader_index,
+                                   struct frame_part             frame_part,
+                                   unsigned char                 *buffer,
+                                   size_t                        bytes,
+                                   struct rtnrt_memcopy_desc     *copy)
+{
+    unsigned int   readi = ring->readers[reader_index]->read_index;
+    unsigned int   frames, i;
+
+    frames = min((size_t)rxbuf_frames_full(ring, reader_index),
+                 bytes / frame_part.count);
+
+    for (i = 0; i < frames; i++) {
+        if (rtnrt_copy(copy, buffer, ring->buffer + readi * ring->bytes_per_frame
+                    + frame_part.offset, frame_part.count)) {
+            return -EFAULT;
+        }
+        if (++readi >= ring->frame_count) {
+            readi = 0;
+        }
+        buffer += frame_part.count;
+    }
+    rxbuf_consume(ring, reader_index, frames);
+
+    return frames * frame_part.count;
+}
+
+/**
+ * Returns the time in nanoseconds.
+ */
+static unsigned long long bench_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * Sets the read position of the first reader back to the first frame.
+ *
+ * @param ring the ring buffer
+ */
+static void bench_rewind(struct rx_buffer *ring)
+{
+    ring->readers[0]->read_index = 0;
+    ring->readers[0]->read_seq   = 0;
+}
+
+/**
+ * Fills @p ring with one second of frames, page by page like the interrupt
+ * service routine does.
+ *
+ * @param ring the ring buffer
+ * @param page buffer of one page (44 frames)
+ * @return the time needed in nanoseconds
+ */
+static unsigned long long bench_fill(struct rx_buffer *ring, unsigned char *page)
+{
+    unsigned long long  t = 0, start;
+    unsigned int        i, j;
+
+    for (i = 0; i < BENCH_FRAMES / 44; i++) {
+        for (j = 0; j < BENCH_BYTES_PER_FRAME * 44; j++) {
+            page[j] = (unsigned char)(i * 7 + j);
+        }
+        start = bench_now();
+        rxbuf_put(ring, page, BENCH_BYTES_PER_FRAME * 44);
+        t += bench_now() - start;
+    }
+
+    return t;
+}
+
+/**
+ * Compares the gathering rxbuf_get() and the demultiplexing mode with the
+ * per-frame reference for various frame part sizes. Prints the time per frame
+ * of each.
+ *
+ * @return 0 on success, -1 if the results differ
+ */
+static int bench_rxbuf_get(void)
+{
+    static const unsigned int   counts[] = { 2, 4, 6, 8, 16 };
+    struct rtnrt_memcopy_desc   copy = { usp_copy, NULL };
+    struct rx_buffer            *ring, *demux;
+    unsigned char               *page, *out_ref, *out;
+    unsigned long long          t_put;
+    unsigned int                i, j;
+    int                         ret = 0;
+
+    ring    = rxbuf_alloc(1, BENCH_FRAMES, BENCH_BYTES_PER_FRAME, NULL);
+    page    = malloc(BENCH_BYTES_PER_FRAME * 44);
+    out_ref = malloc(BENCH_READ_FRAMES * 16);
+    out     = malloc(BENCH_READ_FRAMES * 16);
+    if (!ring || !page || !out_ref || !out) {
+        printf("Allocation failed\n");
+        return -1;
+    }
+
+    t_put = bench_fill(ring, page);
+    printf("== put: %6.2f ns/frame\n", (double)t_put / (BENCH_FRAMES / 44 * 44));
+
+    for (i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+        struct frame_part       part = { counts[i], 12 };
+        size_t                  bytes = BENCH_READ_FRAMES * part.count;
+        unsigned long long      start, t_ref, t_gather, t_demux;
+        ssize_t                 r1 = 0, r2 = 0, r3 = 0;
+
+        demux = rxbuf_alloc(1, BENCH_FRAMES, BENCH_BYTES_PER_FRAME, &part);
+        if (!demux) {
+            printf("Allocation failed\n");
+            ret = -1;
+            break;
+        }
+        t_put = bench_fill(demux, page);
+
+        start = bench_now();
+        for (j = 0; j < BENCH_RUNS; j++) {
+            bench_rewind(ring);
+            r1 = rxbuf_get_per_frame(ring, 0, part, out_ref, bytes, &copy);
+        }
+        t_ref = bench_now() - start;
+
+        start = bench_now();
+        for (j = 0; j < BENCH_RUNS; j++) {
+            bench_rewind(ring);
+            r2 = rxbuf_get(ring, 0, part, out, bytes, &copy);
+        }
+        t_gather = bench_now() - start;
+
+        if (r1 != r2 || memcmp(out_ref, out, r1) != 0) {
+            printf("== count %2u: results differ (%zd, %zd)\n", part.count, r1, r2);
+            ret = -1;
+        }
+
+        start = bench_now();
+        for (j = 0; j < BENCH_RUNS; j++) {
+            bench_rewind(demux);
+            r3 = rxbuf_get(demux, 0, part, out, bytes, &copy);
+        }
+        t_demux = bench_now() - start;
+        rxbuf_free(demux);
+
+        if (r1 != r3 || memcmp(out_ref, out, r1) != 0) {
+            printf("== count %2u: demux results differ (%zd, %zd)\n", 
+                   part.count, r1, r3);
+            ret = -1;
+        }
+
+        printf("== count %2u: per frame %6.2f ns/frame, gather %6.2f ns/frame "
+               "(%.1fx), demux %6.2f ns/frame (%.1fx, put %6.2f ns/frame)\n",
+               part.count,
+               (double)t_ref / (BENCH_RUNS * BENCH_READ_FRAMES),
+               (double)t_gather / (BENCH_RUNS * BENCH_READ_FRAMES),
+               (double)t_ref / t_gather,
+               (double)t_demux / (BENCH_RUNS * BENCH_READ_FRAMES),
+               (double)t_ref / t_demux,
+               (double)t_put / (BENCH_FRAMES / 44 * 44));
+    }
+
+    free(out);
+    free(out_ref);
+    free(page);
+    rxbuf_free(ring);
+
+    return ret;
+}
+
 int main(int argc, char *argv[])
 {
-    int                 i;
-    unsigned char       user_data[] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 
-                                        11, 12, 13, 14, 15, 16 };
-    struct frame_part   part;
-    unsigned char       data[1024];
-    struct rx_buffer    *buffer;
-    int                 err;
+    int                         i;
+    unsigned char               user_data[] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 
+                                                11, 12, 13, 14, 15, 16 };
+    struct frame_part           part;
+    struct frame_part           demux_parts[2];
+    struct rx_policy            policy;
+    struct rx_stats             stats;
+    struct rx_stripes           stripes;
+    struct rx_timestamps        timestamps;
+    unsigned char               dma_area[8 * 6];
+    struct rtnrt_memcopy_desc   copy = { usp_copy, NULL };
+    unsigned char               data[1024];
+    struct rx_buffer            *buffer;
+    int                         err;
 
     pr_debugm("BEGIN\n");
 
-    buffer = rxbuf_alloc(2, 5, 6);
+    buffer = rxbuf_alloc(2, 5, 6, NULL);
     if (!buffer) {
         pr_debugm("Error in tvbuf_alloc\n\n\n");
         return -1;
@@ -313,18 +1580,18 @@ int main(int argc, char *argv[])
     rxbuf_print_debug(buffer, true);
     part.count = 4;
     part.offset = 0;
-    err = rxbuf_get(buffer, 0, part, data, 12);
+    err = rxbuf_get(buffer, 0, part, data, 12, &copy);
     pr_debugm("*Ret=%d\n", err);
     printf("== Empty? %d, %d\n", rxbuf_is_empty(buffer, 0), rxbuf_is_empty(buffer, 1));
 
     for (i = 0; i < min(err, 12); i++) {
-        most_printk("%-2.2X ", data[i]);
+        printf("%-2.2X ", data[i]);
     }
     printf("\n");
 
     part.count = 4;
     part.offset = 0;
-    err = rxbuf_get(buffer, 0, part, data, 4);
+    err = rxbuf_get(buffer, 0, part, data, 4, &copy);
     pr_debugm("Ret=%d\n", err);
 
     for (i = 0; i < min(err, 4); i++) {
@@ -340,7 +1607,7 @@ int main(int argc, char *argv[])
 
     part.count = 4;
     part.offset = 0;
-    err = rxbuf_get(buffer, 0, part, data, 12);
+    err = rxbuf_get(buffer, 0, part, data, 12, &copy);
     pr_debugm("Ret=%d\n", err);
 
     for (i = 0; i < min(err, 12); i++) {
@@ -349,8 +1616,177 @@ int main(int argc, char *argv[])
     printf("\n");
 
     rxbuf_free(buffer);
-    
-    return 0;
+
+    /* demultiplexing mode: reader 0 takes bytes 1-2, reader 1 bytes 3-5 */
+    demux_parts[0].count  = 2;
+    demux_parts[0].offset = 1;
+    demux_parts[1].count  = 3;
+    demux_parts[1].offset = 3;
+    buffer = rxbuf_alloc(2, 5, 6, demux_parts);
+    if (!buffer) {
+        pr_debugm("Error in rxbuf_alloc\n\n\n");
+        return -1;
+    }
+
+    err = rxbuf_put(buffer, user_data, 12);
+    pr_debugm("Ret=%d\n", err);
+    rxbuf_print_debug(buffer, true);
+
+    err = rxbuf_get(buffer, 0, demux_parts[0], data, 12, &copy);
+    for (i = 0; i < err; i++) {
+        printf("%-2.2X ", data[i]);
+    }
+    printf("\n");
+
+    err = rxbuf_get(buffer, 1, demux_parts[1], data, 12, &copy);
+    for (i = 0; i < err; i++) {
+        printf("%-2.2X ", data[i]);
+    }
+    printf("\n");
+
+    rxbuf_free(buffer);
+
+    /* overruns: 5 frames in the ring, 8 frames put */
+    buffer = rxbuf_alloc(1, 5, 6, NULL);
+    if (!buffer) {
+        pr_debugm("Error in rxbuf_alloc\n\n\n");
+        return -1;
+    }
+    part.count = 2;
+    part.offset = 0;
+
+    for (i = 0; i < 4; i++) {
+        rxbuf_put(buffer, user_data, 12);
+    }
+    err = rxbuf_get(buffer, 0, part, data, 12, &copy);
+    rxbuf_get_stats(buffer, 0, &stats);
+    printf("== Skip: ret=%d, received=%llu, position=%llu, lost=%llu, "
+           "overruns=%u\n", err, stats.frames_received, stats.position,
+           stats.lost_frames, stats.overruns);
+
+    policy.overrun = RX_OVERRUN_ERROR;
+    policy.latest_frames = 0;
+    rxbuf_set_policy(buffer, 0, &policy);
+    for (i = 0; i < 4; i++) {
+        rxbuf_put(buffer, user_data, 12);
+    }
+    err = rxbuf_get(buffer, 0, part, data, 12, &copy);
+    rxbuf_get_stats(buffer, 0, &stats);
+    printf("== Error: ret=%d, received=%llu, position=%llu, lost=%llu, "
+           "overruns=%u\n", err, stats.frames_received, stats.position,
+           stats.lost_frames, stats.overruns);
+
+    /* latest 2 frames */
+    policy.latest_frames = 2;
+    rxbuf_set_policy(buffer, 0, &policy);
+    rxbuf_put(buffer, user_data, 12);
+    rxbuf_put(buffer, user_data + 6, 6);
+    err = rxbuf_get(buffer, 0, part, data, 12, &copy);
+    rxbuf_get_stats(buffer, 0, &stats);
+    printf("== Latest: ret=%d, data=%d %d %d %d, skipped=%llu\n", err, 
+           data[0], data[1], data[2], data[3], stats.skipped_frames);
+
+    /* watermark of 3 frames */
+    rxbuf_set_watermark(buffer, 0, 3);
+    rxbuf_put(buffer, user_data, 12);
+    i = rxbuf_watermark_reached(buffer, 0);
+    rxbuf_put(buffer, user_data, 6);
+    printf("== Watermark: %d, %d\n", i, rxbuf_watermark_reached(buffer, 0));
+
+    rxbuf_free(buffer);
+
+    /* timestamps of two pages of 2 frames */
+    buffer = rxbuf_alloc(1, 8, 6, NULL);
+    if (!buffer) {
+        pr_debugm("Error in rxbuf_alloc\n\n\n");
+        return -1;
+    }
+    rxbuf_put(buffer, user_data, 12);
+    rxbuf_timestamp(buffer, 1000000);
+    rxbuf_put(buffer, user_data, 12);
+    rxbuf_timestamp(buffer, 2000000);
+    part.offset = 0;
+    part.count = 6;
+    rxbuf_get(buffer, 0, part, data, 12, &copy);
+    rxbuf_get_timestamps(buffer, 0, 3000000, &timestamps);
+    printf("== Timestamps: position=%llu, timestamp=%llu, queued=%u, delay=%u\n",
+           timestamps.position, timestamps.timestamp, timestamps.queued_frames,
+           timestamps.queue_delay);
+    rxbuf_free(buffer);
+
+    /* stripes at 4 and 0, shared ring and demultiplexing mode */
+    stripes.count = 2;
+    stripes.part[0].offset = 4;
+    stripes.part[0].count = 2;
+    stripes.part[1].offset = 0;
+    stripes.part[1].count = 1;
+    stripes.layout = RX_LAYOUT_INTERLEAVED;
+    rxbuf_stripes_bounds(&stripes, &demux_parts[0]);
+    for (i = 0; i < 4; i++) {
+        buffer = rxbuf_alloc(1, 5, 6, (i & 2) ? demux_parts : NULL);
+        if (!buffer) {
+            pr_debugm("Error in rxbuf_alloc\n\n\n");
+            return -1;
+        }
+        stripes.layout = (i & 1) ? RX_LAYOUT_PLANAR : RX_LAYOUT_INTERLEAVED;
+        rxbuf_put(buffer, user_data, 12);
+        err = rxbuf_get_stripes(buffer, 0, &stripes, data, 8, &copy);
+        printf("== Stripes %s%s: ret=%d, data=%d %d %d %d %d %d\n",
+               (i & 2) ? "demux " : "", (i & 1) ? "planar" : "interleaved",
+               err, data[0], data[1], data[2], data[3], data[4], data[5]);
+        rxbuf_free(buffer);
+    }
+
+    /* 
+     * a second reader is added to the running ring and the card writes
+     * 4 bytes of the 6 byte frames after that
+     */
+    buffer = rxbuf_alloc(1, 5, 6, NULL);
+    if (!buffer) {
+        pr_debugm("Error in rxbuf_alloc\n\n\n");
+        return -1;
+    }
+    rxbuf_put(buffer, user_data, 12);
+    rxbuf_add_reader(buffer, 1);
+    rxbuf_set_hw_width(buffer, 4);
+    rxbuf_put(buffer, user_data, 8);
+    part.offset = 2;
+    part.count = 4;
+    err = rxbuf_get(buffer, 1, part, data, 12, &copy);
+    i = rxbuf_get(buffer, 0, part, data + 8, 16, &copy);
+    printf("== Add reader: ret=%d, %d, data=%d %d %d %d, first=%d %d\n", err, i,
+           data[0], data[1], data[2], data[3], data[8], data[12]);
+    rxbuf_free(buffer);
+
+    /* DMA mode: 4 pages of 2 frames, the card owns 2 pages */
+    buffer = rxbuf_alloc_dma(1, 8, 6, 4, dma_area);
+    if (!buffer) {
+        pr_debugm("Error in rxbuf_alloc_dma\n\n\n");
+        return -1;
+    }
+    part.count = 2;
+    part.offset = 0;
+
+    for (i = 0; i < 2; i++) {
+        memcpy(dma_area + (i % 4) * 12, user_data + 2 * i, 12);
+        rxbuf_commit(buffer, 2);
+    }
+    err = rxbuf_get(buffer, 0, part, data, 12, &copy);
+    rxbuf_get_stats(buffer, 0, &stats);
+    printf("== DMA: ret=%d, data=%d %d, received=%llu, lost=%llu\n", err, 
+           data[0], data[1], stats.frames_received, stats.lost_frames);
+
+    rxbuf_commit(buffer, 2);
+    rxbuf_commit(buffer, 2);
+    rxbuf_commit(buffer, 2);
+    err = rxbuf_get(buffer, 0, part, data, 12, &copy);
+    rxbuf_get_stats(buffer, 0, &stats);
+    printf("== DMA overrun: ret=%d, received=%llu, lost=%llu\n", err, 
+           stats.frames_received, stats.lost_frames);
+
+    rxbuf_free(buffer);
+
+    return bench_rxbuf_get() == 0 ? 0 : 1;
 }
 
 #endif
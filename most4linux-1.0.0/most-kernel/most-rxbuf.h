@@ -35,6 +35,7 @@
 #  include <asm/uaccess.h>            /* copy_from_user() */
 #  include <linux/module.h>
 #  include <linux/wait.h>
+#  include <linux/mm.h>
 #  include "most-common.h"
 #else
 #  include "usp-test.h"
@@ -43,6 +44,59 @@
 #include "most-constants.h"
 #include "most-common.h"
 
+/**
+ * Size of the bounce buffer of each reader in bytes. rxbuf_get() gathers the
+ * frame parts of up to that many bytes before the data is copied to the
+ * reader with one call of the copy function.
+ */
+#define RXBUF_BOUNCE_SIZE       1024
+
+/**
+ * Number of pages whose timestamps are kept in the ring, see rxbuf_timestamp().
+ * Must be a power of 2.
+ */
+#define RXBUF_STAMPS            64
+
+/**
+ * Timestamp of a page in the ring.
+ */
+struct rxbuf_stamp {
+    u64               seq;                        /**< sequence number of the frame
+                                                       after the page */
+    u64               nsec;                       /**< time at which the page was
+                                                       received */
+};
+
+/**
+ * State of one reader of a struct rx_buffer. Each reader is allocated
+ * separately and on its own cache lines, so the number of readers doesn't
+ * change the cost of reading and readers on different CPUs don't share cache
+ * lines.
+ */
+struct rxbuf_reader {
+    unsigned int      read_index;                 /**< The read index. Number of
+                                                       the frame which should be
+                                                       read next. */
+    u64               read_seq;                   /**< sequence number of the frame
+                                                       which is read next */
+    u64               last_seq;                   /**< sequence number of the first
+                                                       frame of the last read */
+    unsigned int      watermark;                  /**< number of frames the reader
+                                                       waits for, see
+                                                       rxbuf_watermark_reached() */
+    struct rx_policy  policy;                     /**< read policy */
+    struct rx_stats   stats;                      /**< overrun counters */
+    rtnrt_lock_t      stats_lock;                 /**< protects @c stats against
+                                                       rxbuf_get_stats() */
+    struct frame_part part;                       /**< the frame part in the
+                                                       demultiplexing mode */
+    unsigned char     *part_buffer;               /**< the ring of the reader in
+                                                       the demultiplexing mode */
+    unsigned char     bounce[RXBUF_BOUNCE_SIZE];  /**< the bounce buffer of
+                                                       rxbuf_get() and
+                                                       rxbuf_get_stripes() */
+} ____cacheline_aligned_in_smp;
+
 /**
  * Receive buffer for MOST, implemented as ringbuffer. The buffer is one large
  * buffer. It contains the complete MOST frames as passed by the PCI card
@@ -50,37 +104,147 @@
  * interrupt service routine to place them in the alternating buffer.
  *
  * The processes (read syscall) read the contents from this ring buffer. As
- * this happen asynchronously, there's a read pointer for each reader which
- * points to the frame which should be read next (to the beginning of the
- * frame).
+ * this happen asynchronously, there's a read index for each reader which
+ * is the number of the frame which should be read next. The state of the
+ * readers is in struct rxbuf_reader, up to MOST_SYNC_OPENS readers are
+ * allocated on demand.
  *
  * There's no need to determine the number of full/empty frames in the
- * interrupt service routine, it just overwrites old frames. The processes read
- * garbage then.
+ * interrupt service routine, it just overwrites old frames. To detect that,
+ * each frame has a 64 bit sequence number: @c frames_written counts all frames
+ * that have been put in the ring and each reader has the sequence number of
+ * the frame it reads next. A reader that is more than <tt>frame_count - 1</tt>
+ * frames behind has been overrun and is handled according to its struct
+ * rx_policy. The interrupt service routine is the only writer. @c write_seq
+ * is odd while it writes frames and updates @c frames_written and
+ * @c write_index, so both can be read consistently without a lock also on 32
+ * bit machines, and a reader can check after copying if its frames have been
+ * overwritten meanwhile.
+ *
+ * The ring is allocated with vmalloc_user() together with a control page in
+ * front of it (see struct rx_mmap_ctrl) so that both can be mapped into
+ * userspace with rxbuf_mmap(). The control page mirrors the write index and
+ * the read indices as byte offsets.
+ *
+ * In the demultiplexing mode (@c demux is @c true), there's no shared ring.
+ * Instead, rxbuf_put() splits the frames once into one compact ring per reader
+ * which only contains the frame part of that reader. rxbuf_get() is then a
+ * contiguous copy and the memory needed is the sum of the frame parts instead
+ * of the whole frames for each frame. The rings cannot be mapped in this mode.
+ *
+ * In the DMA mode (@c dma is @c true, see rxbuf_alloc_dma()), the ring is
+ * DMA memory which the card writes directly. The interrupt service routine
+ * only publishes the frames with rxbuf_commit(). The pages which the card
+ * may be writing are not available for the readers, so @c capacity (the number
+ * of frames a reader may be behind) is smaller. The ring cannot be mapped in
+ * this mode.
  */
 struct rx_buffer {
-    unsigned char     *buffer;                    /**< the ring buffer */
-    unsigned char     *readptr[MOST_SYNC_OPENS];  /**< The read pointers. Points to 
-                                                       the first byte of the quadlet
-                                                       which should be read next. */
-    unsigned int      reader_count;               /**< number of readers */
-    unsigned char     *writeptr;                  /**< the write pointer */
+    void              *area;                      /**< the allocated memory: control
+                                                       page followed by the ring */
+    struct rx_mmap_ctrl *ctrl;                    /**< the control page (start of
+                                                       @c area) */
+    unsigned char     *buffer;                    /**< the ring buffer, @c NULL in
+                                                       the demultiplexing mode */
+    unsigned char     *part_area;                 /**< the memory of all rings in
+                                                       the demultiplexing mode */
+    struct rxbuf_reader **readers;                /**< the readers, MOST_SYNC_OPENS
+                                                       entries, @c NULL if not
+                                                       allocated */
+    struct rxbuf_stamp stamps[RXBUF_STAMPS];      /**< timestamps of the last
+                                                       pages */
+    unsigned int      stamp_count;                /**< number of timestamps, the
+                                                       newest is at
+                                                       <tt>stamp_count - 1</tt> */
+    unsigned int      reader_count;               /**< number of readers, i.e. the
+                                                       highest reader index plus
+                                                       one */
+    unsigned int      write_index;                /**< number of the frame which
+                                                       is written next */
+    u64               frames_written;             /**< sequence number of the frame
+                                                       which is written next */
+    unsigned int      write_seq;                  /**< sequence counter for
+                                                       @c frames_written and
+                                                       @c write_index */
     unsigned int      frame_count;                /**< number of maximum frames in
                                                        the ring */
+    unsigned int      capacity;                   /**< number of frames a reader
+                                                       can be behind without
+                                                       being overrun */
+    unsigned int      page_frames;                /**< number of frames of the
+                                                       last page put into the
+                                                       ring */
     unsigned int      bytes_per_frame;            /**< number of quadlets per frame */
+    unsigned int      hw_bytes_per_frame;         /**< number of bytes per frame in
+                                                       the pages of the card, at
+                                                       most @c bytes_per_frame,
+                                                       see rxbuf_set_hw_width() */
+    bool              demux;                      /**< demultiplexing mode */
+    bool              dma;                        /**< DMA mode, @c buffer is
+                                                       not owned by the ring */
 };
 
 /**
  * @param reader_count the number of readers
  * @param frame_count the number of frames that are in the ring buffer
  * @param bytes_per_frame the number of bytes needed per frame
+ * @param parts the frame part of each of the @p reader_count readers to
+ *        allocate a ring in the demultiplexing mode, or @c NULL to allocate
+ *        a shared ring of whole frames
  * 
  * @return the allocated ring buffer or NULL if the ring buffer could not be 
  *         allocated (an error message will be printed)
  */
-struct rx_buffer *rxbuf_alloc(unsigned int reader_count, 
-                     unsigned int frame_count, 
-                     unsigned int bytes_per_frame);
+struct rx_buffer *rxbuf_alloc(unsigned int              reader_count, 
+                              unsigned int              frame_count, 
+                              unsigned int              bytes_per_frame,
+                              const struct frame_part   *parts);
+
+/**
+ * Allocates a ring buffer whose frames are written directly by the card, see
+ * struct rx_buffer. The ring has exactly @p frame_count frames.
+ *
+ * @param reader_count the number of readers
+ * @param frame_count the number of frames in @p buffer
+ * @param bytes_per_frame the number of bytes needed per frame
+ * @param reserved_frames the number of frames after the write index which
+ *        may be written by the card at any time
+ * @param buffer the DMA memory, it's not freed by rxbuf_free()
+ *
+ * @return the allocated ring buffer or NULL if the ring buffer could not be 
+ *         allocated (an error message will be printed)
+ */
+struct rx_buffer *rxbuf_alloc_dma(unsigned int      reader_count,
+                                  unsigned int      frame_count,
+                                  unsigned int      bytes_per_frame,
+                                  unsigned int      reserved_frames,
+                                  unsigned char     *buffer);
+
+/**
+ * Sets the number of bytes per frame which the card writes into its pages,
+ * i.e. the frame width used in rxbuf_put(). If this is less than
+ * @c bytes_per_frame of the ring, the frames are padded. Must be called in
+ * the context of the interrupt handler or with the interrupt disabled.
+ *
+ * @param ring the ring buffer
+ * @param bytes the number of bytes, at most @c bytes_per_frame
+ */
+void rxbuf_set_hw_width(struct rx_buffer *ring, unsigned int bytes);
+
+/**
+ * Adds a reader to a running ring buffer which has not been allocated in
+ * the demultiplexing mode. The reader starts at the write position, the
+ * other readers are not affected. The state of the reader is allocated if the
+ * index has not been used before, otherwise it is reset. Must not be called
+ * in interrupt context.
+ *
+ * @param ring the ring buffer
+ * @param reader_index the index of the new reader, less than
+ *        MOST_SYNC_OPENS
+ * @return 0 on success, @c -EINVAL if the ring is demultiplexed, @c -ENOMEM
+ *         if the reader could not be allocated
+ */
+int rxbuf_add_reader(struct rx_buffer *ring, unsigned int reader_index);
 
 /**
  * Frees the ring buffer. Don't use @p ring after calling this function any more.
@@ -94,11 +258,15 @@ void rxbuf_free(struct rx_buffer *ring);
  *
  * @param ring the ring buffer
  * @param reader_index the index of the reader
- * @param frame_part the interesting frame part
+ * @param frame_part the interesting frame part, must be the frame part which
+ *        was passed to rxbuf_alloc() in the demultiplexing mode
  * @param buffer buffer from which the data is copied
  * @param bytes the number of frames that should be copied
  * @param copy the copy descriptor, see description of struct rtnrt_memcopy_desc.
- * @return the number of bytes that have been copied successfully
+ * @return the number of bytes that have been copied successfully (0 if the
+ *         ring is empty), @c -EOVERFLOW if the reader was overrun and its
+ *         policy is RX_OVERRUN_ERROR, @c -EFAULT if the copy failed before
+ *         the first frame
  */
 ssize_t rxbuf_get(struct rx_buffer              *ring,
                   unsigned int                  reader_index,
@@ -107,6 +275,40 @@ ssize_t rxbuf_get(struct rx_buffer              *ring,
                   size_t                        bytes,
                   struct rtnrt_memcopy_desc     *copy);
 
+/**
+ * Checks the stripes of a reader and returns the frame part that covers all
+ * of them. That is the frame part of the reader for rxbuf_alloc().
+ *
+ * @param stripes the stripes
+ * @param bounds the frame part is stored there
+ * @return 0 on success, @c -EINVAL if the stripes are invalid
+ */
+int rxbuf_stripes_bounds(const struct rx_stripes    *stripes,
+                         struct frame_part          *bounds);
+
+/**
+ * Reads several frame parts of the same frames from the ring buffer with one
+ * pass over the ring. The data is stored in the layout of @p stripes.
+ *
+ * @param ring the ring buffer
+ * @param reader_index the index of the reader, in the demultiplexing mode its
+ *        frame part must be the result of rxbuf_stripes_bounds()
+ * @param stripes the stripes, checked with rxbuf_stripes_bounds()
+ * @param buffer the destination
+ * @param bytes the size of @p buffer, only whole frames of all stripes are
+ *        copied
+ * @param copy the copy descriptor, see description of struct rtnrt_memcopy_desc.
+ * @return the number of bytes that have been copied, @c -EOVERFLOW if the
+ *         reader was overrun and its policy is RX_OVERRUN_ERROR, @c -EFAULT
+ *         if the copy failed
+ */
+ssize_t rxbuf_get_stripes(struct rx_buffer              *ring,
+                          unsigned int                  reader_index,
+                          const struct rx_stripes       *stripes,
+                          unsigned char                 *buffer,
+                          size_t                        bytes,
+                          struct rtnrt_memcopy_desc     *copy);
+
 /**
  * Checks if data is available for reading.
  *
@@ -115,6 +317,30 @@ ssize_t rxbuf_get(struct rx_buffer              *ring,
  */
 bool rxbuf_is_empty(struct rx_buffer *ring, int reader_index);
 
+/**
+ * Sets the number of frames a reader waits for, see rxbuf_watermark_reached().
+ * The default is 1.
+ *
+ * @param ring the ring buffer
+ * @param reader_index the index of the reader
+ * @param frames the number of frames, 0 is treated like 1
+ */
+void rxbuf_set_watermark(struct rx_buffer   *ring,
+                         unsigned int       reader_index,
+                         unsigned int       frames);
+
+/**
+ * Checks if at least the watermark of a reader (limited to the capacity of the
+ * ring) is available for reading. Other than rxbuf_get(), this doesn't modify
+ * the reader, so it can be called from the interrupt service routine to
+ * decide if the reader must be woken up. A reader that was overrun has always
+ * reached its watermark.
+ *
+ * @param ring the ring buffer
+ * @param reader_index the index of the reader
+ */
+bool rxbuf_watermark_reached(struct rx_buffer *ring, unsigned int reader_index);
+
 /**
  * Puts @p bytes in the ring.
  *
@@ -129,6 +355,119 @@ ssize_t rxbuf_put(struct rx_buffer      *ring,
                   unsigned char         *buffer,
                   size_t                bytes);
 
+/**
+ * Publishes @p frames frames which the card has written into the ring after
+ * the write index. Only for rings allocated with rxbuf_alloc_dma().
+ *
+ * @param ring the ring buffer
+ * @param frames the number of frames
+ * @return the number of frames or a negative error code
+ */
+ssize_t rxbuf_commit(struct rx_buffer *ring, size_t frames);
+
+/**
+ * Counts @p frames frames which the card has received but which could not be
+ * put into the ring, e.g. because the interrupt handler ran after the card
+ * had overwritten the page, as an overrun of all readers. Called from the
+ * interrupt service routine.
+ *
+ * @param ring the ring buffer
+ * @param frames the number of frames
+ */
+void rxbuf_drop(struct rx_buffer *ring, unsigned int frames);
+
+/**
+ * Advances the read pointer of a reader without copying data. This is used by
+ * readers that consume the frames in place via rxbuf_mmap().
+ *
+ * @param ring the ring buffer
+ * @param reader_index the index of the reader
+ * @param frames the number of frames the reader has consumed
+ * @return the number of frames the read pointer was advanced, this is less than
+ *         @p frames if less frames are available, @c -EOVERFLOW if the reader
+ *         was overrun and its policy is RX_OVERRUN_ERROR
+ */
+ssize_t rxbuf_advance(struct rx_buffer  *ring,
+                      unsigned int      reader_index,
+                      size_t            frames);
+
+/**
+ * Sets the read policy of a reader.
+ *
+ * @param ring the ring buffer
+ * @param reader_index the index of the reader
+ * @param policy the new policy
+ */
+void rxbuf_set_policy(struct rx_buffer          *ring,
+                      unsigned int              reader_index,
+                      const struct rx_policy    *policy);
+
+/**
+ * Returns the statistics of a reader.
+ *
+ * @param ring the ring buffer
+ * @param reader_index the index of the reader
+ * @param stats the statistics are stored there
+ */
+void rxbuf_get_stats(struct rx_buffer   *ring,
+                     unsigned int       reader_index,
+                     struct rx_stats    *stats);
+
+/**
+ * Records the time at which the frames that have been put into the ring since
+ * the last call were received, i.e. the time at which the last of them was
+ * received. Called from the interrupt service routine after each page.
+ *
+ * @param ring the ring buffer
+ * @param nsec the time in nanoseconds
+ */
+void rxbuf_timestamp(struct rx_buffer *ring, u64 nsec);
+
+/**
+ * Returns the timing of a reader: the time at which the first frame of its
+ * last read was received and the age of the oldest frame that is available.
+ * The time of a frame is derived from the timestamp of its page and
+ * STD_MOST_FRAMES_PER_SEC.
+ *
+ * @param ring the ring buffer
+ * @param reader_index the index of the reader
+ * @param now the current time in nanoseconds
+ * @param timestamps the timing is stored there
+ */
+void rxbuf_get_timestamps(struct rx_buffer      *ring,
+                          unsigned int          reader_index,
+                          u64                   now,
+                          struct rx_timestamps  *timestamps);
+
+/**
+ * Returns the number of bytes that can be mapped with rxbuf_mmap(), i.e. the
+ * size of the control page plus the page-aligned size of the ring. In the
+ * demultiplexing mode and in the DMA mode, that's only the control page.
+ *
+ * @param ring the ring buffer
+ */
+static inline size_t rxbuf_mmap_size(struct rx_buffer *ring)
+{
+    if (ring->demux || ring->dma) {
+        return PAGE_SIZE;
+    }
+    return PAGE_SIZE + PAGE_ALIGN(ring->bytes_per_frame * ring->frame_count);
+}
+
+#ifndef USP_TEST
+/**
+ * Maps the control page and the ring read-only into the address space
+ * described by @p vma. The mapping must start at offset 0. Not supported in
+ * the demultiplexing mode and in the DMA mode.
+ *
+ * @param ring the ring buffer
+ * @param vma the virtual memory area as passed to the mmap() file operation
+ * @return 0 on success, a negative error code on failure (@c -ENODEV in the
+ *         demultiplexing mode and in the DMA mode)
+ */
+int rxbuf_mmap(struct rx_buffer *ring, struct vm_area_struct *vma);
+#endif
+
 /**
  * Prints debug information (printk()) of the ring buffer. Don't call this
  * function on large ring buffers because the whole buffer is printed in hex
@@ -43,11 +43,25 @@
 #ifdef HAVE_CONFIG_H
 #include "config/config.h"
 #endif
+#include <linux/delay.h>
+#include <linux/bitmap.h>
 #include "most-constants.h"
 #include "most-base.h"
 
 struct most_sync_file;
 
+/**
+ * Number of milliseconds the setup waits for the interrupt handler to switch
+ * the frame width of a running device, see most_sync_rx_switch().
+ */
+#define MOST_SYNC_SWITCH_TIMEOUT        100
+
+/**
+ * Value written into a page of the DMA ring before it is handed to the card,
+ * see most_sync_rx_dma_ring_int().
+ */
+#define MOST_SYNC_RX_DMA_CANARY         0x5a0ff1ceU
+
 
 /**
  * Sets the Synchronous Bandwidth And Node Position (SBC_NPOS) Register
@@ -63,13 +77,261 @@ static inline void most_sync_set_sbc_reg(struct most_dev *dev)
     most_changereg(dev, MOST_PCI_SBC_NPOS_REG, buf - 1, 0xf);
 }
 
+/**
+ * Gets the reader or writer indices which are used by the other running files
+ * of the device.
+ *
+ * @param file the file which is not taken into account
+ * @param sync_dev the synchronous device
+ * @param running the running flag of the direction (@c rx_running or
+ *        @c tx_running)
+ * @param part the frame part of the direction (@c part_rx or @c part_tx)
+ * @param index the index of the direction (@c reader_index or
+ *        @c writer_index)
+ * @param used the bitmap (MOST_SYNC_OPENS bits) where the used indices are
+ *        stored
+ * @param max_byte the variable where the maximum last byte of the frame parts
+ *        of the other files is stored
+ * @param most_sync_file_name the name of the file structure
+ */
+#define most_sync_used_indices(file, sync_dev, running, part, index, used,   \
+                               max_byte, most_sync_file_name)                \
+    do {                                                                     \
+        struct most_sync_file_name  *other;                                  \
+        struct list_head            *pos;                                    \
+                                                                             \
+        bitmap_zero(used, MOST_SYNC_OPENS);                                  \
+        max_byte = 0;                                                        \
+        list_for_each(pos, &sync_dev->file_list) {                           \
+            other = list_entry(pos, struct most_sync_file_name, list);       \
+                                                                             \
+            if (other != file && other->running) {                           \
+                __set_bit(other->index, used);                               \
+                max_byte = max(max_byte,                                     \
+                        other->part.count + other->part.offset - 1);         \
+            }                                                                \
+        }                                                                    \
+    } while (0)
+
+/**
+ * Lets the interrupt handler switch the receiver to @p quadlets quadlets per
+ * frame and waits until this is done. If no interrupt comes in
+ * MOST_SYNC_SWITCH_TIMEOUT milliseconds (e.g. because the card is not locked),
+ * the switch is done here with the interrupt disabled and after waiting for
+ * a handler that may still be running (most_intsync()).
+ *
+ * The DMA buffer must be large enough for pages of @p quadlets quadlets. Must
+ * be called in Linux context with the configuration lock held.
+ *
+ * @param sync_dev the synchronous device (struct most_sync_dev or struct
+ *        most_sync_rt_dev)
+ * @param quadlets the new number of quadlets per frame
+ */
+#define most_sync_rx_switch(sync_dev, quadlets)                              \
+    do {                                                                     \
+        int timeout = MOST_SYNC_SWITCH_TIMEOUT;                              \
+                                                                             \
+        most_sync_set_sbc_reg(sync_dev->most_dev);                           \
+        sync_dev->rx_switch_quadlets = quadlets;                             \
+        smp_wmb();                                                           \
+                                                                             \
+        while (sync_dev->rx_switch_quadlets != 0 && timeout-- > 0) {         \
+            msleep(1);                                                       \
+        }                                                                    \
+                                                                             \
+        if (sync_dev->rx_switch_quadlets != 0) {                             \
+            most_intset(sync_dev->most_dev, 0, IESRX, NULL);                 \
+            most_intsync(sync_dev->most_dev);                                \
+                                                                             \
+            /* a late interrupt may have switched meanwhile */               \
+            if (sync_dev->rx_switch_quadlets != 0) {                         \
+                pr_sync_debug(PR "No RX interrupt, switching directly\n");   \
+                most_sync_rx_switch_int(sync_dev,                            \
+                        most_readreg(sync_dev->most_dev,                     \
+                                     MOST_PCI_SRXCTRL_REG),                  \
+                        most_writereg);                                      \
+            }                                                                \
+            most_intset(sync_dev->most_dev, IESRX, IESRX, NULL);             \
+        }                                                                    \
+    } while (0)
+
+/**
+ * Transmit counterpart of most_sync_rx_switch().
+ *
+ * @param sync_dev the synchronous device (struct most_sync_dev or struct
+ *        most_sync_rt_dev)
+ * @param quadlets the new number of quadlets per frame
+ */
+#define most_sync_tx_switch(sync_dev, quadlets)                              \
+    do {                                                                     \
+        int timeout = MOST_SYNC_SWITCH_TIMEOUT;                              \
+                                                                             \
+        most_sync_set_sbc_reg(sync_dev->most_dev);                           \
+        sync_dev->tx_switch_quadlets = quadlets;                             \
+        smp_wmb();                                                           \
+                                                                             \
+        while (sync_dev->tx_switch_quadlets != 0 && timeout-- > 0) {         \
+            msleep(1);                                                       \
+        }                                                                    \
+                                                                             \
+        if (sync_dev->tx_switch_quadlets != 0) {                             \
+            most_intset(sync_dev->most_dev, 0, IESTX, NULL);                 \
+            most_intsync(sync_dev->most_dev);                                \
+                                                                             \
+            /* a late interrupt may have switched meanwhile */               \
+            if (sync_dev->tx_switch_quadlets != 0) {                         \
+                pr_sync_debug(PR "No TX interrupt, switching directly\n");   \
+                most_sync_tx_switch_int(sync_dev,                            \
+                        most_readreg(sync_dev->most_dev,                     \
+                                     MOST_PCI_STXCTRL_REG),                  \
+                        most_writereg);                                      \
+            }                                                                \
+            most_intset(sync_dev->most_dev, IESTX, IESTX, NULL);             \
+        }                                                                    \
+    } while (0)
+
+/**
+ * Computes the receive page size in frames for the adaptive page sizing
+ * (module parameter @c adaptive_pages): the smallest wakeup watermark of the
+ * running readers, where a reader without a watermark counts with the hardware
+ * receive buffer size of the device. So the page only grows if all readers
+ * read in larger chunks. The result is limited to @c hw_rx_frames ...
+ * @c rx_max_page_frames, so a small watermark can't make the card interrupt
+ * every few frames.
+ *
+ * @param sync_dev the synchronous device (struct most_sync_dev or struct
+ *        most_sync_rt_dev)
+ * @param result the variable where the page size is stored
+ * @param most_sync_file_name the name of the file structure
+ */
+#define most_sync_rx_page_frames(sync_dev, result, most_sync_file_name)      \
+    do {                                                                     \
+        struct most_sync_file_name  *other;                                  \
+        struct list_head            *pos;                                    \
+        unsigned int                want;                                    \
+                                                                             \
+        result = sync_dev->rx_max_page_frames;                               \
+        list_for_each(pos, &sync_dev->file_list) {                           \
+            other = list_entry(pos, struct most_sync_file_name, list);       \
+                                                                             \
+            if (other->rx_running) {                                         \
+                want = other->watermark_rx != 0                              \
+                        ? other->watermark_rx                                \
+                        : sync_dev->hw_rx_frames;                            \
+                result = min(result, want);                                  \
+            }                                                                \
+        }                                                                    \
+        result = max(result, min(sync_dev->hw_rx_frames,                     \
+                    sync_dev->rx_max_page_frames));                          \
+    } while (0)
+
+/**
+ * Transmit counterpart of most_sync_rx_page_frames(). A writer with a latency
+ * cap (see MOST_SYNC_TX_SET_LATENCY) wants pages of half the cap, so that it
+ * can refill the queue while the card transmits the other page. The result is
+ * limited to @c hw_tx_frames ... @c tx_max_page_frames.
+ *
+ * @param sync_dev the synchronous device (struct most_sync_dev or struct
+ *        most_sync_rt_dev)
+ * @param result the variable where the page size is stored
+ * @param most_sync_file_name the name of the file structure
+ */
+#define most_sync_tx_page_frames(sync_dev, result, most_sync_file_name)      \
+    do {                                                                     \
+        struct most_sync_file_name  *other;                                  \
+        struct list_head            *pos;                                    \
+        unsigned int                want;                                    \
+                                                                             \
+        result = sync_dev->tx_max_page_frames;                               \
+        list_for_each(pos, &sync_dev->file_list) {                           \
+            other = list_entry(pos, struct most_sync_file_name, list);       \
+                                                                             \
+            if (other->tx_running) {                                         \
+                want = other->latency_tx != 0                                \
+                        ? max(other->latency_tx / 2, 1U)                     \
+                        : sync_dev->hw_tx_frames;                            \
+                result = min(result, want);                                  \
+            }                                                                \
+        }                                                                    \
+        result = max(result, min(sync_dev->hw_tx_frames,                     \
+                    sync_dev->tx_max_page_frames));                          \
+    } while (0)
+
+/**
+ * Lets the interrupt handler switch the receive page size to
+ * most_sync_rx_page_frames() if the adaptive page sizing is enabled and the
+ * tightest latency requirement of the readers has changed. The switch works
+ * like the one of the frame width (see most_sync_rx_switch_int()), so the
+ * frames of the page the card is writing are lost. Only the alternating buffer
+ * changes its page size, the pages of the DMA ring are fixed.
+ *
+ * Must be called in Linux context with the configuration lock held.
+ *
+ * @param sync_dev the synchronous device (struct most_sync_dev or struct
+ *        most_sync_rt_dev)
+ * @param most_sync_file_name the name of the file structure
+ */
+#define most_sync_adapt_rx_pages(sync_dev, most_sync_file_name)              \
+    do {                                                                     \
+        unsigned int frames;                                                 \
+                                                                             \
+        if (adaptive_pages && sync_dev->sw_receive_buf &&                    \
+                sync_dev->rx_dma_slots == 2) {                               \
+            most_sync_rx_page_frames(sync_dev, frames, most_sync_file_name); \
+            if (frames != sync_dev->rx_dma_page_frames) {                    \
+                pr_sync_debug(PR "Switching to receive pages of %u "         \
+                        "frames\n", frames);                                 \
+                sync_dev->rx_switch_page_frames = frames;                    \
+                smp_wmb();                                                   \
+                most_sync_rx_switch(sync_dev, sync_dev->rx_quadlets);        \
+            }                                                                \
+        }                                                                    \
+    } while (0)
+
+/**
+ * Transmit counterpart of most_sync_adapt_rx_pages(). Both pages of the card
+ * are cleared on the switch, see most_sync_tx_switch_int().
+ *
+ * @param sync_dev the synchronous device (struct most_sync_dev or struct
+ *        most_sync_rt_dev)
+ * @param most_sync_file_name the name of the file structure
+ */
+#define most_sync_adapt_tx_pages(sync_dev, most_sync_file_name)              \
+    do {                                                                     \
+        unsigned int frames;                                                 \
+                                                                             \
+        if (adaptive_pages && sync_dev->sw_transmit_buf) {                   \
+            most_sync_tx_page_frames(sync_dev, frames, most_sync_file_name); \
+            if (frames != sync_dev->tx_page_frames) {                        \
+                pr_sync_debug(PR "Switching to transmit pages of %u "        \
+                        "frames\n", frames);                                 \
+                sync_dev->tx_switch_page_frames = frames;                    \
+                smp_wmb();                                                   \
+                most_sync_tx_switch(sync_dev, sync_dev->tx_quadlets);        \
+            }                                                                \
+        }                                                                    \
+    } while (0)
+
 /**
  * See documentation of MOST_SYNC_RT_SETUP_RX.
  *
  * Most be locked, this is done in most_sync_setup_rx() or
  * most_sync_rt_setup_rx() respectively.
  *
- * The device must be stopped before calling this function! 
+ * If the receiver already runs with a shared ring buffer, the reader is added
+ * to the running ring and the other readers don't lose any frame. Only if the
+ * new frame part needs more quadlets, the interrupt handler switches the card
+ * to the wider frames (see most_sync_rx_switch_int()), which loses the frames
+ * of the page the card is writing. In the DMA ring mode, the ring only has the
+ * current width, so this is only possible if the frame part fits in it.
+ *
+ * Otherwise, the device is stopped, reconfigured and started again: in the
+ * demultiplexing mode (the rings of the readers are laid out for their frame
+ * parts), in the DMA ring mode if wider frames are needed and if the buffer
+ * sizes of the device have been changed with MOST_SYNC_SET_BUFFER_SIZES
+ * (@c rx_resize). The ring is then allocated again, the readers are numbered
+ * again and all of them continue at the newest frame, i.e. the frames which
+ * they have not read yet are dropped.
  *
  * This must be a macro because it can be used with RT and NRT structures,
  * so a function is not suitable. Using a common "base" structure leads to more
@@ -80,24 +342,85 @@ static inline void most_sync_set_sbc_reg(struct most_dev *dev)
  *        structure
  * @param sync_dev the synchronous device (struct most_sync_dev or 
  *        struct most_sync_dev_rt)
- * @param hw_buffer_size the hardware buffer size (kernel module 
- *        parameter)
- * @param sw_buffer_size the software buffer size
+ * @param hw_buffer_size the hardware buffer size (@c hw_rx_frames of the
+ *        device)
+ * @param sw_buffer_size the software buffer size (@c sw_rx_frames of the
+ *        device)
+ * @param demux if the software buffer should be allocated in the
+ *        demultiplexing mode, see struct rx_buffer
+ * @param dma_ring if the card should write directly into a DMA ring of the
+ *        size of the software buffer, see most_sync_rx_dma_ring_int()
  * @param error_var the variable where errors (negative value) are stored
  * @param most_sync_file_name the name of the structure (some kind of 
  *        <tt>typeof(file)</tt>)
  * @return 0 on success, a negative error code on failure.
  */
 #define most_sync_setup_rx_common(param, file, sync_dev, hw_buffer_size,     \
-                                  sw_buffer_size, error_var,                 \
-                                  most_sync_file_name)                       \
+                                  sw_buffer_size, demux, dma_ring,           \
+                                  error_var, most_sync_file_name)            \
     do {                                                                     \
         struct most_sync_file_name  *entry;                                  \
+        struct rx_buffer            *ring = sync_dev->sw_receive_buf;        \
         int                         number_quadlets;                         \
         unsigned int                dma_size;                                \
+        unsigned int                page_size;                               \
+        unsigned int                page_frames;                             \
+        unsigned int                alloc_page_size;                         \
+        unsigned int                slots;                                   \
+        DECLARE_BITMAP(used, MOST_SYNC_OPENS);                               \
         int                         reader_count = 0;                        \
         unsigned int                max_byte     = 0;                        \
+        bool                        was_running  = file->rx_running;         \
         struct list_head            *ptr;                                    \
+        struct frame_part           parts[MOST_SYNC_OPENS];                  \
+                                                                             \
+        /*                                                                   \
+         * add the reader to the running shared ring, the DMA ring has the   \
+         * width of the card, so a reader that fits in needs no switch       \
+         */                                                                  \
+        if (ring && !ring->demux && !sync_dev->rx_resize &&                  \
+                (param).offset + (param).count <= ring->bytes_per_frame) {   \
+            most_sync_used_indices(file, sync_dev, rx_running, part_rx,      \
+                    reader_index, used, max_byte, most_sync_file_name);      \
+            max_byte = max(max_byte, (param).count + (param).offset - 1);    \
+            number_quadlets = (max_byte + 3) / 4; /* integer ceil */         \
+                                                                             \
+            if (number_quadlets > sync_dev->rx_quadlets) {                   \
+                pr_sync_debug(PR "Switching to %d quadlets\n",               \
+                        number_quadlets);                                    \
+                most_sync_rx_switch(sync_dev, number_quadlets);              \
+            }                                                                \
+                                                                             \
+            if (!was_running) {                                              \
+                file->reader_index = find_first_zero_bit(used,               \
+                        MOST_SYNC_OPENS);                                    \
+            }                                                                \
+            error_var = rxbuf_add_reader(ring, file->reader_index);          \
+            if (error_var != 0) {                                            \
+                if (was_running) {                                           \
+                    file->rx_running = false;                                \
+                    atomic_dec(&sync_dev->receiver_count);                   \
+                }                                                            \
+                break;                                                       \
+            }                                                                \
+            if (!was_running) {                                              \
+                atomic_inc(&sync_dev->receiver_count);                       \
+            }                                                                \
+            rxbuf_set_policy(ring, file->reader_index, &file->policy_rx);    \
+            rxbuf_set_watermark(ring, file->reader_index,                    \
+                    file->watermark_rx);                                     \
+                                                                             \
+            file->part_rx = param;                                           \
+            file->rx_running = true;                                         \
+            most_sync_adapt_rx_pages(sync_dev, most_sync_file_name);         \
+            error_var = 0;                                                   \
+            break;                                                           \
+        }                                                                    \
+                                                                             \
+        /* the device must be stopped for the reconfiguration */             \
+        if (ring) {                                                          \
+            most_sync_stop_rx_common(sync_dev, file);                        \
+        }                                                                    \
                                                                              \
         /* enable the interrupt */                                           \
         most_intset(sync_dev->most_dev, IESRX, IESRX, NULL);                 \
@@ -114,6 +437,7 @@ static inline void most_sync_set_sbc_reg(struct most_dev *dev)
             if (entry->rx_running) {                                         \
                 unsigned int last_byte;                                      \
                                                                              \
+                parts[reader_count] = entry->part_rx;                        \
                 entry->reader_index = reader_count++;                        \
                                                                              \
                 last_byte = entry->part_rx.count + entry->part_rx.offset - 1;\
@@ -131,12 +455,45 @@ static inline void most_sync_set_sbc_reg(struct most_dev *dev)
                 number_quadlets);                                            \
         most_sync_set_sbc_reg(sync_dev->most_dev);                           \
                                                                              \
-        /* set the page size */                                              \
-        dma_size = number_quadlets * 4 * 2 * hw_buffer_size;                 \
+        /*                                                                   \
+         * set the page size, the alternating buffer is allocated for the    \
+         * largest page of the adaptive page sizing (see                     \
+         * most_sync_adapt_rx_pages())                                       \
+         */                                                                  \
+        page_frames = hw_buffer_size;                                        \
+        sync_dev->rx_max_page_frames = hw_buffer_size;                       \
+        if (adaptive_pages && !(dma_ring)) {                                 \
+            sync_dev->rx_max_page_frames = max((unsigned int)hw_buffer_size, \
+                    min((unsigned int)MOST_SYNC_MAX_PAGE_FRAMES,             \
+                        (unsigned int)(sw_buffer_size) / 2));                \
+            most_sync_rx_page_frames(sync_dev, page_frames,                  \
+                    most_sync_file_name);                                    \
+        }                                                                    \
+        page_size = number_quadlets * 4 * page_frames;                       \
                                                                              \
-        most_writereg(sync_dev->most_dev, dma_size / 2, MOST_PCI_SRXPS_REG); \
+        most_writereg(sync_dev->most_dev, page_size, MOST_PCI_SRXPS_REG);    \
         pr_sync_debug(PR "Setting receive page size to %d\n",                \
-                dma_size/2);                                                 \
+                page_size);                                                  \
+                                                                             \
+        /*                                                                   \
+         * the number of pages: two for the alternating buffer or the        \
+         * software buffer plus the two pages of the card for the DMA ring   \
+         * (even, see most_sync_rx_dma_ring_int())                           \
+         */                                                                  \
+        slots = 2;                                                           \
+        if (dma_ring) {                                                      \
+            slots = (sw_buffer_size + hw_buffer_size - 1) / hw_buffer_size   \
+                    + 2;                                                     \
+            slots += slots & 1;                                              \
+        }                                                                    \
+                                                                             \
+        /*                                                                   \
+         * the alternating buffer of the shared ring takes the widest        \
+         * frames, see most_sync_rx_switch_int()                             \
+         */                                                                  \
+        alloc_page_size = ((demux) ? number_quadlets : NUM_OF_QUADLETS) * 4  \
+                * sync_dev->rx_max_page_frames;                              \
+        dma_size = (slots > 2) ? page_size * slots : alloc_page_size * slots;\
                                                                              \
         /* allocate the DMA buffer if needed */                              \
         if (dma_size > sync_dev->hw_receive_buf.size) {                      \
@@ -148,6 +505,15 @@ static inline void most_sync_set_sbc_reg(struct most_dev *dev)
             sync_dev->hw_receive_buf.size = dma_size;                        \
             error_var = most_dma_allocate(sync_dev->most_dev,                \
                     &sync_dev->hw_receive_buf);                              \
+            if (error_var < 0 && slots > 2) {                                \
+                rtnrt_warn(PR "No DMA ring of %d bytes, using the "          \
+                        "alternating buffer\n", dma_size);                   \
+                slots = 2;                                                   \
+                dma_size = alloc_page_size * slots;                          \
+                sync_dev->hw_receive_buf.size = dma_size;                    \
+                error_var = most_dma_allocate(sync_dev->most_dev,            \
+                        &sync_dev->hw_receive_buf);                          \
+            }                                                                \
             if (error_var < 0) {                                             \
                 sync_dev->hw_receive_buf.size = 0;                           \
                 rtnrt_err(PR "most_dma_allocate failed");                    \
@@ -168,6 +534,15 @@ static inline void most_sync_set_sbc_reg(struct most_dev *dev)
         /* set the hardware start address */                                 \
         most_writereg(sync_dev->most_dev, sync_dev->hw_receive_buf.addr_bus, \
                      MOST_PCI_SRXSA_REG);                                    \
+        sync_dev->rx_dma_slots       = slots;                                \
+        sync_dev->rx_dma_slot        = 0;                                    \
+        sync_dev->rx_dma_armed       = false;                                \
+        sync_dev->rx_dma_failed      = false;                                \
+        sync_dev->rx_dma_page_frames = page_frames;                          \
+        sync_dev->rx_quadlets        = number_quadlets;                      \
+        sync_dev->rx_switch_quadlets = 0;                                    \
+        sync_dev->rx_switch_page_frames = 0;                                 \
+        sync_dev->rx_resize          = false;                                \
                                                                              \
         /* free the old ringbuffer */                                        \
         if (sync_dev->sw_receive_buf) {                                      \
@@ -175,15 +550,44 @@ static inline void most_sync_set_sbc_reg(struct most_dev *dev)
             sync_dev->sw_receive_buf = NULL;                                 \
         }                                                                    \
                                                                              \
-        /* allocate ring buffer */                                           \
-        sync_dev->sw_receive_buf = rxbuf_alloc(reader_count, sw_buffer_size, \
-                                               number_quadlets * 4);         \
+        /*                                                                   \
+         * allocate ring buffer, the shared ring stores whole frames so      \
+         * that readers can be added without reallocating it                \
+         */                                                                  \
+        if (slots > 2) {                                                     \
+            sync_dev->sw_receive_buf = rxbuf_alloc_dma(reader_count,         \
+                    slots * hw_buffer_size, number_quadlets * 4,             \
+                    2 * hw_buffer_size,                                      \
+                    sync_dev->hw_receive_buf.addr_virt);                     \
+        } else if (demux) {                                                  \
+            sync_dev->sw_receive_buf = rxbuf_alloc(reader_count,             \
+                    sw_buffer_size, number_quadlets * 4, parts);             \
+        } else {                                                             \
+            sync_dev->sw_receive_buf = rxbuf_alloc(reader_count,             \
+                    sw_buffer_size, NUM_OF_QUADLETS * 4, NULL);              \
+            if (likely(sync_dev->sw_receive_buf)) {                          \
+                rxbuf_set_hw_width(sync_dev->sw_receive_buf,                 \
+                        number_quadlets * 4);                                \
+            }                                                                \
+        }                                                                    \
         if (unlikely(!sync_dev->sw_receive_buf)) {                           \
             rtnrt_err(PR "Not enough memory available\n");                   \
             error_var = -ENOMEM;                                             \
             goto out;                                                        \
         }                                                                    \
                                                                              \
+        /* the read policies and watermarks of the files */                  \
+        list_for_each(ptr, &sync_dev->file_list) {                           \
+            entry = list_entry(ptr, struct most_sync_file_name, list);       \
+                                                                             \
+            if (entry->rx_running) {                                         \
+                rxbuf_set_policy(sync_dev->sw_receive_buf,                   \
+                        entry->reader_index, &entry->policy_rx);             \
+                rxbuf_set_watermark(sync_dev->sw_receive_buf,                \
+                        entry->reader_index, entry->watermark_rx);           \
+            }                                                                \
+        }                                                                    \
+                                                                             \
         /*                                                                   \
          * ensure that no reordering takes place between setting the         \
          * start bit and configuration bits                                  \
@@ -192,12 +596,17 @@ static inline void most_sync_set_sbc_reg(struct most_dev *dev)
                                                                              \
         most_changereg(sync_dev->most_dev, MOST_PCI_SRXCTRL_REG,             \
                 SRXST, SRXST);                                               \
-        atomic_inc(&sync_dev->receiver_count);                               \
+        if (!was_running) {                                                  \
+            atomic_inc(&sync_dev->receiver_count);                           \
+        }                                                                    \
         break;                                                               \
                                                                              \
 out:                                                                         \
         /* release the lock for the sync device */                           \
         file->rx_running = false;                                            \
+        if (was_running) {                                                   \
+            atomic_dec(&sync_dev->receiver_count);                           \
+        }                                                                    \
                                                                              \
     } while (0)
 
@@ -207,7 +616,13 @@ out:                                                                         \
  * Most be locked, this is done in most_sync_setup_tx() or
  * most_sync_rt_setup_tx() respectively.
  *
- * The device must be stopped before calling this function! 
+ * If the transmitter already runs, the writer is added to the running ring
+ * and the other writers are not interrupted. Only if the new frame part needs
+ * more quadlets, the interrupt handler switches the card to the wider frames
+ * (see most_sync_tx_switch_int()), which transmits up to two pages of
+ * silence. Otherwise, and if the buffer sizes of the device have been changed
+ * with MOST_SYNC_SET_BUFFER_SIZES (@c tx_resize), the device is configured and
+ * started.
  *
  * This must be a macro because it can be used with RT and NRT structures,
  * so a function is not suitable. Using a common "base" structure leads to more
@@ -217,24 +632,92 @@ out:                                                                         \
  * @param file the struct most_sync_file or struct most_sync_rt_file structure
  * @param sync_dev the synchronous device (struct most_sync_dev or struct
  *        most_sync_dev_rt)
- * @param hw_buffer_size the hardware buffer size (kernel module parameter)
- * @param sw_buffer_size the software buffer size
+ * @param hw_buffer_size the hardware buffer size (@c hw_tx_frames of the
+ *        device)
+ * @param sw_buffer_size the software buffer size (@c sw_tx_frames of the
+ *        device)
+ * @param independent @c true if each writer gets its own ring, see struct
+ *        tx_buffer
  * @param error_var the variable where errors (negative value) are stored
  * @param most_sync_file_name the name of the structure (some kind of
  *        <tt>typeof(file)</tt>)
  * @return 0 on success, a negative error code on failure.
  */
 #define most_sync_setup_tx_common(param, file, sync_dev, hw_buffer_size,     \
-                                  sw_buffer_size, error_var,                 \
+                                  sw_buffer_size, independent, error_var,    \
                                   most_sync_file_name)                       \
     do {                                                                     \
         struct most_sync_file_name *entry;                                   \
+        struct tx_buffer           *ring = sync_dev->sw_transmit_buf;        \
         int                        number_quadlets;                          \
         unsigned int               dma_size;                                 \
+        unsigned int               page_frames;                              \
+        DECLARE_BITMAP(used, MOST_SYNC_OPENS);                               \
         int                        writer_count = 0;                         \
+        int                        index;                                    \
         unsigned int               max_byte     = 0;                         \
+        bool                       was_running  = file->tx_running;          \
         struct list_head           *ptr;                                     \
                                                                              \
+        /* add the writer to the running ring */                             \
+        if (ring && !sync_dev->tx_resize && (param).offset + (param).count <=\
+                (unsigned int)ring->bytes_per_frame) {                       \
+            most_sync_used_indices(file, sync_dev, tx_running, part_tx,      \
+                    writer_index, used, max_byte, most_sync_file_name);      \
+            max_byte = max(max_byte, (param).count + (param).offset - 1);    \
+            number_quadlets = (max_byte + 3) / 4; /* integer ceil */         \
+                                                                             \
+            if (number_quadlets > sync_dev->tx_quadlets) {                   \
+                pr_sync_debug(PR "Switching to %d quadlets\n",               \
+                        number_quadlets);                                    \
+                most_sync_tx_switch(sync_dev, number_quadlets);              \
+            }                                                                \
+                                                                             \
+            /*                                                               \
+             * in the independent mode, a running writer moves to a new      \
+             * index, so the interrupt handler never sees its ring change    \
+             */                                                              \
+            if (was_running && !ring->independent) {                         \
+                txbuf_remove_writer(ring, file->writer_index, file->part_tx);\
+                index = file->writer_index;                                  \
+            } else {                                                         \
+                if (was_running) {                                           \
+                    __set_bit(file->writer_index, used);                     \
+                }                                                            \
+                index = find_first_zero_bit(used, MOST_SYNC_OPENS);          \
+            }                                                                \
+            error_var = index < MOST_SYNC_OPENS ?                            \
+                    txbuf_add_writer(ring, index, param) : -EBUSY;           \
+            if (error_var != 0) {                                            \
+                if (was_running && !ring->independent) {                     \
+                    file->tx_running = false;                                \
+                    atomic_dec(&sync_dev->transmitter_count);                \
+                }                                                            \
+                break;                                                       \
+            }                                                                \
+            txbuf_set_policy(ring, index, &file->policy_tx);                 \
+            txbuf_set_max_queued(ring, index, file->latency_tx);             \
+            if (was_running && ring->independent) {                          \
+                txbuf_remove_writer(ring, file->writer_index, file->part_tx);\
+                most_intsync(sync_dev->most_dev);                            \
+            }                                                                \
+            if (!was_running) {                                              \
+                atomic_inc(&sync_dev->transmitter_count);                    \
+            }                                                                \
+                                                                             \
+            file->writer_index = index;                                      \
+            file->part_tx = param;                                           \
+            file->tx_running = true;                                         \
+            most_sync_adapt_tx_pages(sync_dev, most_sync_file_name);         \
+            error_var = 0;                                                   \
+            break;                                                           \
+        }                                                                    \
+                                                                             \
+        /* the device must be stopped for the reconfiguration */             \
+        if (ring) {                                                          \
+            most_sync_stop_tx_common(sync_dev, file);                        \
+        }                                                                    \
+                                                                             \
         /* enable the interrupt */                                           \
         most_intset(sync_dev->most_dev, IESTX, IESTX, NULL);                 \
                                                                              \
@@ -267,12 +750,23 @@ out:                                                                         \
                 number_quadlets);                                            \
         most_sync_set_sbc_reg(sync_dev->most_dev);                           \
                                                                              \
-        /* set the page size */                                              \
-        dma_size = number_quadlets * 4 * 2 * hw_buffer_size;                 \
-                                                                             \
-        most_writereg(sync_dev->most_dev, dma_size / 2, MOST_PCI_STXPS_REG); \
+        /* set the page size, see most_sync_adapt_tx_pages() */              \
+        page_frames = hw_buffer_size;                                        \
+        sync_dev->tx_max_page_frames = hw_buffer_size;                       \
+        if (adaptive_pages) {                                                \
+            sync_dev->tx_max_page_frames = max((unsigned int)hw_buffer_size, \
+                    min((unsigned int)MOST_SYNC_MAX_PAGE_FRAMES,             \
+                        (unsigned int)(sw_buffer_size) / 2));                \
+            most_sync_tx_page_frames(sync_dev, page_frames,                  \
+                    most_sync_file_name);                                    \
+        }                                                                    \
+        most_writereg(sync_dev->most_dev, number_quadlets * 4 *              \
+                page_frames, MOST_PCI_STXPS_REG);                            \
         pr_sync_debug(PR "Setting transmit page size to %d\n",               \
-                dma_size/2);                                                 \
+                number_quadlets * 4 * page_frames);                          \
+                                                                             \
+        /* the pages can take the widest frames and the largest pages */     \
+        dma_size = NUM_OF_QUADLETS * 4 * 2 * sync_dev->tx_max_page_frames;   \
                                                                              \
         /* allocate the DMA buffer if needed */                              \
         if (dma_size > sync_dev->hw_transmit_buf.size) {                     \
@@ -304,6 +798,11 @@ out:                                                                         \
         /* set the hardware start address */                                 \
         most_writereg(sync_dev->most_dev, sync_dev->hw_transmit_buf.addr_bus,\
                       MOST_PCI_STXSA_REG);                                   \
+        sync_dev->tx_quadlets        = number_quadlets;                      \
+        sync_dev->tx_switch_quadlets = 0;                                    \
+        sync_dev->tx_switch_page_frames = 0;                                 \
+        sync_dev->tx_page_frames     = page_frames;                          \
+        sync_dev->tx_resize          = false;                                \
                                                                              \
         /* free the old ringbuffer */                                        \
         if (sync_dev->sw_transmit_buf) {                                     \
@@ -311,13 +810,34 @@ out:                                                                         \
             sync_dev->sw_transmit_buf = NULL;                                \
         }                                                                    \
                                                                              \
-        /* allocate ring buffer */                                           \
-        sync_dev->sw_transmit_buf = txbuf_alloc(writer_count, sw_buffer_size,\
-                                                number_quadlets * 4);        \
+        /*                                                                   \
+         * allocate ring buffer, it stores whole frames so that writers can  \
+         * be added without reallocating it                                  \
+         */                                                                  \
+        sync_dev->sw_transmit_buf = txbuf_alloc(sw_buffer_size,              \
+                NUM_OF_QUADLETS * 4, independent);                           \
         if (unlikely(!sync_dev->sw_transmit_buf)) {                          \
             rtnrt_err(PR "Not enough memory available\n");                   \
             error_var = -ENOMEM;                                             \
             goto out;                                                        \
+        }                                                                    \
+        txbuf_set_hw_width(sync_dev->sw_transmit_buf, number_quadlets * 4);  \
+                                                                             \
+        /* add the writers */                                                \
+        list_for_each(ptr, &sync_dev->file_list) {                           \
+            entry = list_entry(ptr, struct most_sync_file_name, list);       \
+                                                                             \
+            if (entry->tx_running) {                                         \
+                error_var = txbuf_add_writer(sync_dev->sw_transmit_buf,      \
+                        entry->writer_index, entry->part_tx);                \
+                if (error_var != 0) {                                        \
+                    goto out;                                                \
+                }                                                            \
+                txbuf_set_policy(sync_dev->sw_transmit_buf,                  \
+                        entry->writer_index, &entry->policy_tx);             \
+                txbuf_set_max_queued(sync_dev->sw_transmit_buf,              \
+                        entry->writer_index, entry->latency_tx);             \
+            }                                                                \
         }                                                                    \
                                                                              \
         /*                                                                   \
@@ -328,18 +848,183 @@ out:                                                                         \
                                                                              \
         most_changereg(sync_dev->most_dev, MOST_PCI_STXCTRL_REG,             \
                 STXST, STXST);                                               \
-        atomic_inc(&sync_dev->transmitter_count);                            \
+        if (!was_running) {                                                  \
+            atomic_inc(&sync_dev->transmitter_count);                        \
+        }                                                                    \
                                                                              \
         break;                                                               \
                                                                              \
 out:                                                                         \
         /* release the lock for the sync device */                           \
         file->tx_running = false;                                            \
+        if (was_running) {                                                   \
+            atomic_dec(&sync_dev->transmitter_count);                        \
+        }                                                                    \
                                                                              \
     } while (0)
 
 /**
- * Common part of most_sync_stop_rx() and most_sync_nrt_stop_rx().
+ * Switches the receiver to the number of quadlets requested by
+ * most_sync_rx_switch(), if any. Called in the receive interrupt after the
+ * page has been processed. The card is stopped and restarted at page 0 with
+ * the new frame width, the frames of the page it was writing are lost. The
+ * DMA buffer was allocated for the widest frames, so it is not moved. The
+ * page size requested by most_sync_adapt_rx_pages() is set at the same time,
+ * the DMA buffer also takes the largest page (@c rx_max_page_frames).
+ *
+ * @param sync_dev the synchronous device (struct most_sync_dev or struct
+ *        most_sync_rt_dev)
+ * @param srxctrl the content of the SRXCTRL register
+ * @param writereg the function to write a register of the card
+ */
+#define most_sync_rx_switch_int(sync_dev, srxctrl, writereg)                  \
+    do {                                                                      \
+        unsigned int quadlets = sync_dev->rx_switch_quadlets;                 \
+        unsigned int frames;                                                  \
+                                                                              \
+        if (unlikely(quadlets != 0)) {                                        \
+            /* a new page size, see most_sync_adapt_rx_pages() */             \
+            smp_rmb();                                                        \
+            frames = sync_dev->rx_switch_page_frames;                         \
+            if (frames != 0) {                                                \
+                sync_dev->rx_dma_page_frames = frames;                        \
+                sync_dev->rx_switch_page_frames = 0;                          \
+            }                                                                 \
+            writereg(sync_dev->most_dev, (srxctrl) & ~SRXST,                  \
+                    MOST_PCI_SRXCTRL_REG);                                    \
+            writereg(sync_dev->most_dev, quadlets - 1, MOST_PCI_SRXCA_REG);   \
+            writereg(sync_dev->most_dev, quadlets * 4 *                       \
+                    sync_dev->rx_dma_page_frames, MOST_PCI_SRXPS_REG);        \
+            writereg(sync_dev->most_dev, sync_dev->hw_receive_buf.addr_bus,   \
+                    MOST_PCI_SRXSA_REG);                                      \
+                                                                              \
+            rxbuf_set_hw_width(sync_dev->sw_receive_buf, quadlets * 4);       \
+            sync_dev->rx_quadlets = quadlets;                                 \
+            sync_dev->rx_current_page = 0;                                    \
+            wmb();                                                            \
+                                                                              \
+            writereg(sync_dev->most_dev, (srxctrl) | SRXST,                   \
+                    MOST_PCI_SRXCTRL_REG);                                    \
+            sync_dev->rx_switch_quadlets = 0;                                 \
+        }                                                                     \
+    } while (0)
+
+/**
+ * Transmit counterpart of most_sync_rx_switch_int(), called in the transmit
+ * interrupt after the page has been filled. Both pages are cleared because
+ * they contain frames of the old width, so the card transmits silence until
+ * the next interrupt fills a page.
+ *
+ * @param sync_dev the synchronous device (struct most_sync_dev or struct
+ *        most_sync_rt_dev)
+ * @param stxctrl the content of the STXCTRL register
+ * @param writereg the function to write a register of the card
+ */
+#define most_sync_tx_switch_int(sync_dev, stxctrl, writereg)                  \
+    do {                                                                      \
+        unsigned int quadlets = sync_dev->tx_switch_quadlets;                 \
+        unsigned int frames;                                                  \
+                                                                              \
+        if (unlikely(quadlets != 0)) {                                        \
+            /* a new page size, see most_sync_adapt_tx_pages() */             \
+            smp_rmb();                                                        \
+            frames = sync_dev->tx_switch_page_frames;                         \
+            if (frames != 0) {                                                \
+                sync_dev->tx_page_frames = frames;                            \
+                sync_dev->tx_switch_page_frames = 0;                          \
+            }                                                                 \
+            writereg(sync_dev->most_dev, (stxctrl) & ~STXST,                  \
+                    MOST_PCI_STXCTRL_REG);                                    \
+            writereg(sync_dev->most_dev, quadlets - 1, MOST_PCI_STXCA_REG);   \
+            writereg(sync_dev->most_dev, quadlets * 4 *                       \
+                    sync_dev->tx_page_frames, MOST_PCI_STXPS_REG);            \
+            writereg(sync_dev->most_dev, sync_dev->hw_transmit_buf.addr_bus,  \
+                    MOST_PCI_STXSA_REG);                                      \
+                                                                              \
+            memset(sync_dev->hw_transmit_buf.addr_virt, 0,                    \
+                    sync_dev->hw_transmit_buf.size);                          \
+            txbuf_set_hw_width(sync_dev->sw_transmit_buf, quadlets * 4);      \
+            sync_dev->tx_quadlets = quadlets;                                 \
+            sync_dev->tx_current_page = 0;                                    \
+            wmb();                                                            \
+                                                                              \
+            writereg(sync_dev->most_dev, (stxctrl) | STXST,                   \
+                    MOST_PCI_STXCTRL_REG);                                    \
+            sync_dev->tx_switch_quadlets = 0;                                 \
+        }                                                                     \
+    } while (0)
+
+/**
+ * Handles a receive interrupt in the DMA ring mode, i.e. if the software
+ * receive buffer is the DMA memory (see rxbuf_alloc_dma()).
+ *
+ * The card writes page 0 at SRXSA and page 1 at SRXSA + SRXPS. The start
+ * address is assumed to be taken when the card switches to page 0 again, so it
+ * can be moved while the card writes page 1. Page 0 is always an even page of
+ * the ring. Each interrupt completes the next page of the ring, so only the
+ * write index of the ring is published and no data is copied. After the switch
+ * to page 1, SRXSA is moved two pages forward.
+ *
+ * The datasheet doesn't say when SRXSA is taken, so the mode is only enabled
+ * with the @c rx_dma_ring parameter and checked at runtime: before a page is
+ * handed to the card, its first and last frame get MOST_SYNC_RX_DMA_CANARY.
+ * If both are still there when the card reports the page as complete, the
+ * card has written somewhere else. Then no more frames are published (the
+ * readers get no data instead of wrong data) and an error is printed.
+ *
+ * @param sync_dev the synchronous device (struct most_sync_dev or struct
+ *        most_sync_rt_dev)
+ * @param srxctrl the content of the SRXCTRL register
+ * @param writereg the function to write a register of the card
+ */
+#define most_sync_rx_dma_ring_int(sync_dev, srxctrl, writereg)               \
+    do {                                                                      \
+        unsigned int page_bytes = sync_dev->rx_dma_page_frames *              \
+                sync_dev->sw_receive_buf->bytes_per_frame;                    \
+        unsigned int last = (page_bytes -                                     \
+                sync_dev->sw_receive_buf->bytes_per_frame) / 4;               \
+        u32 *page;                                                            \
+                                                                              \
+        if (unlikely(sync_dev->rx_dma_failed)) {                              \
+            break;                                                            \
+        }                                                                     \
+                                                                              \
+        /* page 0 is complete, check that the card really wrote it */         \
+        if (((srxctrl) & SRXPP) && sync_dev->rx_dma_armed) {                  \
+            page = (u32 *)((unsigned char *)sync_dev->hw_receive_buf.addr_virt\
+                    + sync_dev->rx_dma_slot * page_bytes);                    \
+            rmb();                                                            \
+            if (unlikely(page[0] == MOST_SYNC_RX_DMA_CANARY &&                \
+                        page[last] == MOST_SYNC_RX_DMA_CANARY)) {             \
+                rtnrt_err(PR "The card didn't write the DMA ring page "       \
+                        "at SRXSA, load the driver without rx_dma_ring\n");   \
+                sync_dev->rx_dma_failed = true;                               \
+                break;                                                        \
+            }                                                                 \
+        }                                                                     \
+                                                                              \
+        rxbuf_commit(sync_dev->sw_receive_buf, sync_dev->rx_dma_page_frames); \
+                                                                              \
+        if ((srxctrl) & SRXPP) {                                              \
+            sync_dev->rx_dma_slot += 2;                                       \
+            if (sync_dev->rx_dma_slot >= sync_dev->rx_dma_slots) {            \
+                sync_dev->rx_dma_slot = 0;                                    \
+            }                                                                 \
+            page = (u32 *)((unsigned char *)sync_dev->hw_receive_buf.addr_virt\
+                    + sync_dev->rx_dma_slot * page_bytes);                    \
+            page[0] = page[last] = MOST_SYNC_RX_DMA_CANARY;                   \
+            sync_dev->rx_dma_armed = true;                                    \
+            wmb();                                                            \
+            writereg(sync_dev->most_dev, sync_dev->hw_receive_buf.addr_bus +  \
+                    sync_dev->rx_dma_slot * page_bytes,                       \
+                    MOST_PCI_SRXSA_REG);                                      \
+        }                                                                     \
+    } while (0)
+
+/**
+ * Common part of most_sync_stop_rx() and most_sync_nrt_stop_rx(). Waits for
+ * the interrupt handler, so the receive ring and the DMA pages can be freed
+ * or reset afterwards.
  *
  * @param sync_dev the synchronous device (struct most_sync_rt_dev or struct
  *        struct most_sync_dev
@@ -351,12 +1036,15 @@ out:                                                                         \
         most_intset(sync_dev->most_dev, 0, IESRX, NULL);                      \
         most_changereg(sync_dev->most_dev, MOST_PCI_SRXCTRL_REG, 0, SRXST);   \
         most_intclear(sync_dev->most_dev, ISSRX);                             \
+        most_intsync(sync_dev->most_dev);                                     \
                                                                               \
         file->rx_running = false;                                             \
     } while (0)
 
 /**
- * Common part of most_sync_stop_tx() and most_sync_nrt_stop_tx().
+ * Common part of most_sync_stop_tx() and most_sync_nrt_stop_tx(). Waits for
+ * the interrupt handler, so the transmit ring and the DMA pages can be freed
+ * or reset afterwards.
  *
  * @param sync_dev the synchronous device (struct most_sync_rt_dev or struct
  *        struct most_sync_dev
@@ -368,6 +1056,7 @@ out:                                                                         \
         most_intset(sync_dev->most_dev, 0, IESTX, NULL);                      \
         most_changereg(sync_dev->most_dev, MOST_PCI_STXCTRL_REG, 0, STXST);   \
         most_intclear(sync_dev->most_dev, ISSTX);                             \
+        most_intsync(sync_dev->most_dev);                                     \
                                                                               \
         file->tx_running = false;                                             \
     } while (0)
@@ -397,6 +1086,7 @@ out:                                                                         \
         /* mark all as deallocated */                                         \
         sync_dev->sw_receive_buf = NULL;                                      \
         sync_dev->hw_receive_buf.size = 0;                                    \
+        sync_dev->rx_dma_slots = 0;                                           \
     } while (0)
 
 /**
@@ -428,26 +1118,68 @@ out:                                                                         \
 
 
 /**
- * Module parameter that holds the size of the software receive buffer in
- * number of stored frame parts.
+ * Must be called if a writer is closed which is not the last writer. The
+ * writer is removed from the transmit ring, so the other writers are not
+ * stalled, and the interrupt handler is waited for, so the index can be
+ * reused. The config_lock must be held if this macro is called.
+ *
+ * @param sync_dev the synchronous device
+ * @param file the sync file
+ */
+#define most_sync_closed_tx(sync_dev, file)                                   \
+    do {                                                                      \
+        txbuf_remove_writer(sync_dev->sw_transmit_buf, file->writer_index,    \
+                file->part_tx);                                               \
+        most_intsync(sync_dev->most_dev);                                     \
+        file->tx_running = false;                                             \
+    } while (0)
+
+/**
+ * Module parameter that holds the default size of the software receive buffer
+ * of each device in number of stored frame parts, see
+ * MOST_SYNC_SET_BUFFER_SIZES.
  */
 extern long sw_rx_buffer_size;
 
 /**
- * Module parameter that holds the size of the software transmit buffer in
- * number of stored frame parts.
+ * Module parameter that selects the demultiplexing mode of the software
+ * receive buffer, see struct rx_buffer.
+ */
+extern int rx_demux;
+
+/**
+ * Module parameter that selects the DMA ring mode of the receive buffer, see
+ * most_sync_rx_dma_ring_int().
+ */
+extern int rx_dma_ring;
+
+/**
+ * Module parameter that holds the default size of the software transmit
+ * buffer of each device in number of stored frame parts.
  */
 extern long sw_tx_buffer_size;
 
 /**
- * Module parameter that holds the size of the hardware receive buffer in
- * number of stored frame parts.
+ * Module parameter that selects the independent mode of the transmit buffer,
+ * see struct tx_buffer.
+ */
+extern int tx_independent;
+
+/**
+ * Module parameter that enables the adaptive page sizing, see
+ * most_sync_adapt_rx_pages().
+ */
+extern int adaptive_pages;
+
+/**
+ * Module parameter that holds the default size of the hardware receive buffer
+ * of each device in number of stored frame parts.
  */
 extern long hw_rx_buffer_size;
 
 /**
- * Module parameter that holds the size of the hardware transmit buffer in number of
- * stored frame parts.
+ * Module parameter that holds the default size of the hardware transmit buffer
+ * of each device in number of stored frame parts.
  */
 extern long hw_tx_buffer_size;
 
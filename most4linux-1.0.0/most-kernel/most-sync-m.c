@@ -31,6 +31,7 @@
 #endif
 #include <linux/module.h>
 #include <linux/fs.h>
+#include <linux/poll.h>
 #include <linux/dma-mapping.h>
 #include <linux/timer.h>
 #include <asm/msr.h>
@@ -38,7 +39,9 @@
 #include <asm/system.h>
 #include <asm/semaphore.h>
 #include <asm/uaccess.h>
+#include <asm/div64.h>
 #include <linux/rwsem.h>
+#include <linux/capability.h>
 
 #include "most-constants.h"
 #include "most-base.h"
@@ -81,8 +84,11 @@ static ssize_t    most_sync_do_write    (struct file *, const char __user *,
                                          size_t, loff_t *);
 static int        most_sync_do_ioctl    (struct inode *, struct file *,
                                          unsigned int, unsigned long);
+static int        most_sync_do_mmap     (struct file *, struct vm_area_struct *);
+static unsigned int most_sync_do_poll   (struct file *, poll_table *);
 static inline int most_sync_do_setup_tx (struct file *, unsigned long);
 static inline int most_sync_do_setup_rx (struct file *, unsigned long);
+static int        most_sync_do_setup_rx_stripes (struct file *, unsigned long);
 
 /* module parameters ------------------------------------------------------- */
 
@@ -91,11 +97,31 @@ static inline int most_sync_do_setup_rx (struct file *, unsigned long);
  */
 long sw_rx_buffer_size = STD_MOST_FRAMES_PER_SEC; /* 1 s */
 
+/*
+ * see header
+ */
+int rx_demux = 0;
+
+/*
+ * see header
+ */
+int rx_dma_ring = 0;
+
 /*
  * see header
  */
 long sw_tx_buffer_size = STD_MOST_FRAMES_PER_SEC; /* 1 s */
 
+/*
+ * see header
+ */
+int tx_independent = 0;
+
+/*
+ * see header
+ */
+int adaptive_pages = 0;
+
 /*
  * see header
  */
@@ -112,11 +138,35 @@ MODULE_PARM_DESC(sw_rx_buffer_size,
         "Size of the software receive buffer in frame parts "
         "(default: " __MODULE_STRING(STD_MOST_FRAMES_PER_SEC) ")");
 
+module_param(rx_demux, bool, S_IRUGO);
+MODULE_PARM_DESC(rx_demux,
+        "Split the received frames into one ring per reader in the interrupt "
+        "service routine, mmap() is not available then (default: 0)");
+
+module_param(rx_dma_ring, bool, S_IRUGO);
+MODULE_PARM_DESC(rx_dma_ring,
+        "Let the card write directly into a DMA ring of sw_rx_buffer_size "
+        "frames instead of copying each page, takes precedence over rx_demux "
+        "(experimental, relies on the card taking a new SRXSA at each page "
+        "switch; default: 0)");
+
 module_param(sw_tx_buffer_size, long, S_IRUGO);
 MODULE_PARM_DESC(sw_tx_buffer_size, 
         "Size of the software transmit buffer in frame parts "
         "(default: " __MODULE_STRING(STD_MOST_FRAMES_PER_SEC) ")");
 
+module_param(tx_independent, bool, S_IRUGO);
+MODULE_PARM_DESC(tx_independent,
+        "Give each writer its own ring which is merged in the interrupt "
+        "service routine, so a writer without data doesn't hold back the "
+        "others (default: 0)");
+
+module_param(adaptive_pages, bool, S_IRUGO);
+MODULE_PARM_DESC(adaptive_pages,
+        "Choose the page size of the card from the tightest latency "
+        "requirement of the open files, with pages of up to 100 ms "
+        "(default: 0)");
+
 module_param(hw_rx_buffer_size, long, S_IRUGO);
 MODULE_PARM_DESC(hw_rx_buffer_size,
         "Size of the hardware receive buffer in frame parts "
@@ -138,7 +188,9 @@ static struct file_operations most_sync_file_operations = {
     .ioctl   = most_sync_do_ioctl,
     .release = most_sync_do_release,
     .read    = most_sync_do_read,
-    .write   = most_sync_do_write
+    .write   = most_sync_do_write,
+    .mmap    = most_sync_do_mmap,
+    .poll    = most_sync_do_poll
 };
 
 #ifdef DEBUG
@@ -187,6 +239,7 @@ static int most_sync_probe(struct most_dev *most_dev)
     int                   err    = 0;
     struct most_sync_dev  *sync_dev;
     char                  buffer[10];
+    int                   i;
 
     return_value_if_fails_dbg(number < MOST_DEVICE_NUMBER, -EINVAL);
 
@@ -205,7 +258,9 @@ static int most_sync_probe(struct most_dev *most_dev)
     /* initialize some members */
     sync_dev->most_dev = most_dev;
     INIT_LIST_HEAD(&sync_dev->file_list);
-    init_waitqueue_head(&sync_dev->rx_queue);
+    for (i = 0; i < MOST_SYNC_OPENS; i++) {
+        init_waitqueue_head(&sync_dev->rx_queue[i]);
+    }
     init_waitqueue_head(&sync_dev->tx_queue);
     init_rwsem(&sync_dev->config_lock_rx);
     init_rwsem(&sync_dev->config_lock_tx);
@@ -213,6 +268,12 @@ static int most_sync_probe(struct most_dev *most_dev)
     atomic_set(&sync_dev->transmitter_count, 0);
     atomic_set(&sync_dev->open_count, -MOST_SYNC_OPENS);
 
+    /* the module parameters are the defaults, see MOST_SYNC_SET_BUFFER_SIZES */
+    sync_dev->sw_rx_frames = sw_rx_buffer_size;
+    sync_dev->hw_rx_frames = hw_rx_buffer_size;
+    sync_dev->sw_tx_frames = sw_tx_buffer_size;
+    sync_dev->hw_tx_frames = hw_tx_buffer_size;
+
     /* register the new character device */
     cdev_init(&sync_dev->cdev, &most_sync_file_operations);
     sync_dev->cdev.owner = THIS_MODULE;
@@ -257,7 +318,34 @@ static int most_sync_remove(struct most_dev *dev)
 }
 
 /**
- * Interrupt handler of a synchronous driver.
+ * Wakes up the readers whose watermark is reached, see
+ * MOST_SYNC_RX_SET_WATERMARK. Called from the interrupt handler after new
+ * frames have been put into the receive ring.
+ *
+ * @param[in] sync_dev the synchronous device
+ */
+static inline void most_sync_wake_up_readers(struct most_sync_dev *sync_dev)
+{
+    struct rx_buffer    *ring = sync_dev->sw_receive_buf;
+    unsigned int        i;
+
+    /* pairs with the barrier of wait_event_interruptible() */
+    smp_mb();
+
+    for (i = 0; i < ring->reader_count; i++) {
+        if (waitqueue_active(&sync_dev->rx_queue[i]) &&
+                rxbuf_watermark_reached(ring, i)) {
+            wake_up_interruptible(&sync_dev->rx_queue[i]);
+        }
+    }
+}
+
+/**
+ * Interrupt handler of a synchronous driver. The pages are taken from the
+ * state latched with the interrupt (see most_intlatch()), so in the interrupt
+ * thread of most-pci, a late handler doesn't copy the page the card is
+ * writing now. The receive pages which were overwritten before the handler
+ * ran are counted as overruns of the readers.
  *
  * @param[in] dev the MOST device
  * @param[in] intstatus the interrupt status register content
@@ -267,21 +355,25 @@ static void most_sync_int_handler(struct most_dev        *dev,
 {
     int                   card = MOST_DEV_CARDNUMBER(dev);
     struct most_sync_dev  *sync_dev = most_sync_devices[card];
+    struct most_int_latch latch;
     u32                   val;
     int                   err;
     int                   current_page;
 
     assert(sync_dev != NULL);
 
+    most_intlatch(dev, &latch);
+
     if (intstatus & ISSRX) {
         void          *dma_start;
         size_t        siz;
+        unsigned int  lost, i;
         
         pr_irq_debug(PR "RX INT\n");
 
-        val = most_readreg(sync_dev->most_dev, MOST_PCI_SRXCTRL_REG);
+        val = latch.srxctrl;
         dma_start = sync_dev->hw_receive_buf.addr_virt;
-        siz = sync_dev->hw_receive_buf.size / 2;
+        siz = sync_dev->rx_quadlets * 4 * sync_dev->rx_dma_page_frames;
 
         /* 
          * current page == 0 
@@ -292,21 +384,58 @@ static void most_sync_int_handler(struct most_dev        *dev,
         }
 
         measuring_receive_isr_start(sync_dev->sw_receive_buf);
-        err = rxbuf_put(sync_dev->sw_receive_buf, dma_start, siz);
-        if (unlikely(err < 0)) {
-            rtnrt_warn(PR "rxbuf_put in most_pci_int_handler returned %d\n", err);
-        } else {
-            memset(dma_start, 0, siz);
+        if (sync_dev->rx_dma_slots > 2) {
+            /* each interrupt has completed the next page of the ring */
+            for (i = latch.rx_count; i > 0; i--) {
+                most_sync_rx_dma_ring_int(sync_dev, 
+                        (i & 1) ? val : val ^ SRXPP, most_writereg);
+            }
+            rxbuf_timestamp(sync_dev->sw_receive_buf, rtnrt_clock_read());
             measuring_receive_isr_wakeup();
-            wake_up_interruptible(&sync_dev->rx_queue);
+            most_sync_wake_up_readers(sync_dev);
+        } else {
+            /* 
+             * the pages of the earlier interrupts have been overwritten, and
+             * so has the last one if the card has switched again meanwhile
+             */
+            lost = latch.rx_count - 1;
+            if (latch.deferred && ((val ^ most_readreg(sync_dev->most_dev, 
+                                MOST_PCI_SRXCTRL_REG)) & SRXPP)) {
+                lost++;
+            }
+            if (unlikely(lost > 0)) {
+                pr_irq_debug(PR "RX handler late, %u pages lost\n", lost);
+                rxbuf_drop(sync_dev->sw_receive_buf, 
+                        lost * sync_dev->rx_dma_page_frames);
+            }
+
+            /* otherwise the card is writing the page, don't touch it */
+            if (lost < latch.rx_count) {
+                err = rxbuf_put(sync_dev->sw_receive_buf, dma_start, siz);
+                if (unlikely(err < 0)) {
+                    rtnrt_warn(PR "rxbuf_put in most_pci_int_handler "
+                            "returned %d\n", err);
+                } else {
+                    rxbuf_timestamp(sync_dev->sw_receive_buf, 
+                            rtnrt_clock_read());
+                    memset(dma_start, 0, siz);
+                    measuring_receive_isr_wakeup();
+                    most_sync_wake_up_readers(sync_dev);
+                }
+            }
         }
 
+        /* an even number of switches ends on the same page */
         current_page = (val & SRXPP) ? 1 : 2;
-        if ((sync_dev->rx_current_page != 0) 
+        if ((sync_dev->rx_current_page != 0) && (latch.rx_count & 1)
                 && (sync_dev->rx_current_page == current_page)) {
             rtnrt_warn(PR "sync_dev->rx_current_page == current_page\n");
         }
         sync_dev->rx_current_page = current_page;
+
+        if (sync_dev->rx_dma_slots == 2) {
+            most_sync_rx_switch_int(sync_dev, val, most_writereg);
+        }
     }
     
     if (intstatus & ISSTX) {
@@ -317,9 +446,9 @@ static void most_sync_int_handler(struct most_dev        *dev,
 
         pr_irq_debug(PR "TX INT\n");
 
-        val = most_readreg(sync_dev->most_dev, MOST_PCI_STXCTRL_REG);
+        val = latch.stxctrl;
         dma_start = sync_dev->hw_transmit_buf.addr_virt;
-        siz = sync_dev->hw_transmit_buf.size / 2;
+        siz = sync_dev->tx_quadlets * 4 * sync_dev->tx_page_frames;
 
         /* 
          * current page == 0 
@@ -340,10 +469,13 @@ static void most_sync_int_handler(struct most_dev        *dev,
         }
 
         current_page = (val & STXPP) ? 1 : 2;
-        if ((sync_dev->tx_current_page != 0) && (sync_dev->tx_current_page == current_page)) {
+        if ((sync_dev->tx_current_page != 0) && (latch.tx_count & 1) &&
+                (sync_dev->tx_current_page == current_page)) {
             rtnrt_warn(PR "TX: sync_dev->tx_current_page == current_page\n");
         }
         sync_dev->tx_current_page = current_page;
+
+        most_sync_tx_switch_int(sync_dev, val, most_writereg);
     }
 }
 
@@ -473,6 +605,11 @@ static int most_sync_do_release(struct inode *inode, struct file *filp)
         down_write(&sync_dev->config_lock_rx);
         most_sync_last_closed_rx(sync_dev, file, most_sync_stop_rx);
         up_write(&sync_dev->config_lock_rx);
+    } else if (file->rx_running) {
+        /* the page size may grow without this reader */
+        down_write(&sync_dev->config_lock_rx);
+        most_sync_adapt_rx_pages(sync_dev, most_sync_file);
+        up_write(&sync_dev->config_lock_rx);
     }
 
     /* check if it's the last writer */
@@ -481,6 +618,12 @@ static int most_sync_do_release(struct inode *inode, struct file *filp)
         down_write(&sync_dev->config_lock_tx);
         most_sync_last_closed_tx(sync_dev, file, most_sync_stop_tx);
         up_write(&sync_dev->config_lock_tx);
+    } else if (file->tx_running) {
+        /* the other writers must not wait for this one */
+        down_write(&sync_dev->config_lock_tx);
+        most_sync_closed_tx(sync_dev, file);
+        most_sync_adapt_tx_pages(sync_dev, most_sync_file);
+        up_write(&sync_dev->config_lock_tx);
     }
 
     /* free the memory */
@@ -519,16 +662,16 @@ ssize_t most_sync_read(struct file                  *filp,
     down_read(&sync_dev->config_lock_rx);
 
     while (copied == 0) {
-        copied = rxbuf_get(sync_dev->sw_receive_buf, file->reader_index, 
-                file->part_rx, buff, count, copy);
-        if (unlikely(copied < 0)) {
-            rtnrt_err(PR "Error in rxbuf_get: %d\n", copied);
-            goto out_read;
-        }
-
-        if (copied == 0) {
-            err = wait_event_interruptible(sync_dev->rx_queue, 
-                    !rxbuf_is_empty(sync_dev->sw_receive_buf, file->reader_index) );
+        if (filp->f_flags & O_NONBLOCK) {
+            if (rxbuf_is_empty(sync_dev->sw_receive_buf, file->reader_index)) {
+                copied = -EAGAIN;
+                goto out_read;
+            }
+        } else {
+            /* sleep until the watermark of the reader is reached */
+            err = wait_event_interruptible(sync_dev->rx_queue[file->reader_index],
+                    rxbuf_watermark_reached(sync_dev->sw_receive_buf,
+                        file->reader_index) );
             if (err < 0) {
                 pr_sync_debug(PR "wait_event_interruptible "
                         " returned with %d\n", err);
@@ -536,6 +679,20 @@ ssize_t most_sync_read(struct file                  *filp,
                 goto out_read;
             }
         }
+
+        if (file->stripes_rx.count != 0) {
+            copied = rxbuf_get_stripes(sync_dev->sw_receive_buf,
+                    file->reader_index, &file->stripes_rx, buff, count, copy);
+        } else {
+            copied = rxbuf_get(sync_dev->sw_receive_buf, file->reader_index, 
+                    file->part_rx, buff, count, copy);
+        }
+        if (unlikely(copied < 0)) {
+            if (copied != -EOVERFLOW) {
+                rtnrt_err(PR "Error in rxbuf_get: %d\n", copied);
+            }
+            goto out_read;
+        }
     }
 
 out_read:
@@ -600,6 +757,13 @@ ssize_t most_sync_write(struct file                 *filp,
         
         copied += err;
         if (err == 0) {
+            if (filp->f_flags & O_NONBLOCK) {
+                if (copied == 0) {
+                    copied = -EAGAIN;
+                }
+                goto out_write;
+            }
+
             err = wait_event_interruptible(sync_dev->tx_queue, 
                      !txbuf_is_full(sync_dev->sw_transmit_buf, 
                          file->writer_index) );
@@ -638,6 +802,576 @@ static ssize_t most_sync_do_write(struct file         *filp,
     return most_sync_write(filp, (void *)buff, count, &copy);
 }
 
+/**
+ * Poll method for a synchronous MOST device. The file is readable if its
+ * reader has frames in the receive ring and writable if its writer has space
+ * in the transmit ring.
+ *
+ * @param filp the file pointer of Linux, holds the private_data which is of type
+ *        struct most_sync_file.
+ * @param wait the poll table
+ * @return the poll mask, @c POLLERR if neither receiving nor transmitting
+ *         was set up
+ */
+static unsigned int most_sync_do_poll(struct file *filp, poll_table *wait)
+{
+    struct most_sync_file       *file = filp->private_data;
+    struct most_sync_dev        *sync_dev = file->sync_dev;
+    unsigned int                mask = 0;
+
+    if (!file->rx_running && !file->tx_running) {
+        return POLLERR;
+    }
+
+    if (file->rx_running) {
+        poll_wait(filp, &sync_dev->rx_queue[file->reader_index], wait);
+
+        down_read(&sync_dev->config_lock_rx);
+        if (rxbuf_watermark_reached(sync_dev->sw_receive_buf,
+                    file->reader_index)) {
+            mask |= POLLIN | POLLRDNORM;
+        }
+        up_read(&sync_dev->config_lock_rx);
+    }
+
+    if (file->tx_running) {
+        poll_wait(filp, &sync_dev->tx_queue, wait);
+
+        down_read(&sync_dev->config_lock_tx);
+        if (!txbuf_is_full(sync_dev->sw_transmit_buf, file->writer_index)) {
+            mask |= POLLOUT | POLLWRNORM;
+        }
+        up_read(&sync_dev->config_lock_tx);
+    }
+
+    return mask;
+}
+
+/**
+ * Maps the receive ring of the device read-only into userspace (offset 0, see
+ * MOST_SYNC_RX_MMAP_INFO) or the transmit area of the file
+ * (MOST_SYNC_TX_MMAP_OFFSET, see MOST_SYNC_TX_MMAP_INFO).
+ *
+ * @param filp the file pointer of Linux, holds the private_data which is of type
+ *        struct most_sync_file.
+ * @param vma the virtual memory area
+ * @return 0 on success, a negative error code on failure
+ */
+static int most_sync_do_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+    struct most_sync_file       *file = filp->private_data;
+    struct most_sync_dev        *sync_dev = file->sync_dev;
+    int                         err;
+
+    if (vma->vm_pgoff == MOST_SYNC_TX_MMAP_OFFSET >> PAGE_SHIFT) {
+        down_read(&sync_dev->config_lock_tx);
+        if (file->tx_running) {
+            err = txbuf_mmap(sync_dev->sw_transmit_buf, file->writer_index, vma);
+        } else {
+            rtnrt_err(PR "Cannot map the transmit area at this time\n");
+            err = -EBUSY;
+        }
+        up_read(&sync_dev->config_lock_tx);
+
+        return err;
+    }
+
+    down_read(&sync_dev->config_lock_rx);
+    if (file->rx_running) {
+        err = rxbuf_mmap(sync_dev->sw_receive_buf, vma);
+    } else {
+        rtnrt_err(PR "Cannot map the receive ring at this time\n");
+        err = -EBUSY;
+    }
+    up_read(&sync_dev->config_lock_rx);
+
+    return err;
+}
+
+/**
+ * See documentation of MOST_SYNC_RX_MMAP_INFO.
+ *
+ * @param filp the Linux struct file
+ * @param ioctl_arg the already checked ioctl argument
+ */
+static int most_sync_do_rx_mmap_info(struct file *filp, unsigned long ioctl_arg)
+{
+    struct most_sync_file           *file = filp->private_data;
+    struct most_sync_dev            *sync_dev = file->sync_dev;
+    struct most_sync_rx_mmap_info   info;
+
+    down_read(&sync_dev->config_lock_rx);
+    if (!file->rx_running) {
+        up_read(&sync_dev->config_lock_rx);
+        return -EBUSY;
+    }
+    if (sync_dev->sw_receive_buf->demux || sync_dev->sw_receive_buf->dma) {
+        up_read(&sync_dev->config_lock_rx);
+        return -ENODEV;
+    }
+    info.mmap_size    = rxbuf_mmap_size(sync_dev->sw_receive_buf);
+    info.ring_offset  = PAGE_SIZE;
+    info.reader_index = file->reader_index;
+    info.reserved     = 0;
+    up_read(&sync_dev->config_lock_rx);
+
+    if (__copy_to_user((void __user *)ioctl_arg, &info, sizeof(info))) {
+        return -EFAULT;
+    }
+
+    return 0;
+}
+
+/**
+ * See documentation of MOST_SYNC_RX_ADVANCE.
+ *
+ * @param filp the Linux struct file
+ * @param ioctl_arg the already checked ioctl argument
+ */
+static int most_sync_do_rx_advance(struct file *filp, unsigned long ioctl_arg)
+{
+    struct most_sync_file   *file = filp->private_data;
+    struct most_sync_dev    *sync_dev = file->sync_dev;
+    __u32                   frames;
+    int                     ret;
+
+    if (__get_user(frames, (__u32 __user *)ioctl_arg)) {
+        return -EFAULT;
+    }
+
+    down_read(&sync_dev->config_lock_rx);
+    ret = file->rx_running
+        ? rxbuf_advance(sync_dev->sw_receive_buf, file->reader_index, frames)
+        : -EBUSY;
+    up_read(&sync_dev->config_lock_rx);
+
+    return ret;
+}
+
+/**
+ * See documentation of MOST_SYNC_RX_SET_POLICY.
+ *
+ * @param filp the Linux struct file
+ * @param ioctl_arg the already checked ioctl argument
+ */
+static int most_sync_do_rx_set_policy(struct file *filp, unsigned long ioctl_arg)
+{
+    struct most_sync_file   *file = filp->private_data;
+    struct most_sync_dev    *sync_dev = file->sync_dev;
+    struct rx_policy        policy;
+
+    if (__copy_from_user(&policy, (void __user *)ioctl_arg, sizeof(policy))) {
+        return -EFAULT;
+    }
+
+    if (policy.overrun != RX_OVERRUN_SKIP && policy.overrun != RX_OVERRUN_ERROR) {
+        return -EINVAL;
+    }
+
+    down_read(&sync_dev->config_lock_rx);
+    file->policy_rx = policy;
+    if (file->rx_running) {
+        rxbuf_set_policy(sync_dev->sw_receive_buf, file->reader_index, &policy);
+    }
+    up_read(&sync_dev->config_lock_rx);
+
+    return 0;
+}
+
+/**
+ * See documentation of MOST_SYNC_TX_SET_POLICY.
+ *
+ * @param filp the Linux struct file
+ * @param ioctl_arg the already checked ioctl argument
+ */
+static int most_sync_do_tx_set_policy(struct file *filp, unsigned long ioctl_arg)
+{
+    struct most_sync_file   *file = filp->private_data;
+    struct most_sync_dev    *sync_dev = file->sync_dev;
+    struct tx_policy        policy;
+
+    if (__copy_from_user(&policy, (void __user *)ioctl_arg, sizeof(policy))) {
+        return -EFAULT;
+    }
+
+    if ((policy.underrun != TX_UNDERRUN_SILENCE && 
+                policy.underrun != TX_UNDERRUN_REPEAT) || policy.reserved != 0) {
+        return -EINVAL;
+    }
+
+    down_read(&sync_dev->config_lock_tx);
+    file->policy_tx = policy;
+    if (file->tx_running) {
+        txbuf_set_policy(sync_dev->sw_transmit_buf, file->writer_index, &policy);
+    }
+    up_read(&sync_dev->config_lock_tx);
+
+    return 0;
+}
+
+/**
+ * See documentation of MOST_SYNC_TX_GET_STATS.
+ *
+ * @param filp the Linux struct file
+ * @param ioctl_arg the already checked ioctl argument
+ */
+static int most_sync_do_tx_get_stats(struct file *filp, unsigned long ioctl_arg)
+{
+    struct most_sync_file   *file = filp->private_data;
+    struct most_sync_dev    *sync_dev = file->sync_dev;
+    struct tx_stats         stats;
+
+    if (!file->tx_running) {
+        return -EBUSY;
+    }
+
+    down_read(&sync_dev->config_lock_tx);
+    txbuf_get_stats(sync_dev->sw_transmit_buf, file->writer_index, &stats);
+    up_read(&sync_dev->config_lock_tx);
+
+    if (__copy_to_user((void __user *)ioctl_arg, &stats, sizeof(stats))) {
+        return -EFAULT;
+    }
+
+    return 0;
+}
+
+/**
+ * See documentation of MOST_SYNC_TX_SET_LATENCY.
+ *
+ * @param filp the Linux struct file
+ * @param ioctl_arg the already checked ioctl argument
+ */
+static int most_sync_do_tx_set_latency(struct file *filp, unsigned long ioctl_arg)
+{
+    struct most_sync_file           *file = filp->private_data;
+    struct most_sync_dev            *sync_dev = file->sync_dev;
+    struct most_sync_tx_latency     latency;
+    unsigned int                    cap;
+    u64                             frames;
+
+    if (__copy_from_user(&latency, (void __user *)ioctl_arg, sizeof(latency))) {
+        return -EFAULT;
+    }
+
+    /* round down, the writer wants at most that time, but at least a frame */
+    cap = latency.frames;
+    if (latency.usecs != 0) {
+        frames = (u64)latency.usecs * STD_MOST_FRAMES_PER_SEC;
+        do_div(frames, USEC_PER_SEC);
+        frames = max(frames, (u64)1);
+        cap = cap != 0 ? min(cap, (unsigned int)frames) : (unsigned int)frames;
+    }
+
+    /* exclusive because the page size may follow the cap */
+    down_write(&sync_dev->config_lock_tx);
+    file->latency_tx = cap;
+    if (file->tx_running) {
+        txbuf_set_max_queued(sync_dev->sw_transmit_buf, file->writer_index, cap);
+        most_sync_adapt_tx_pages(sync_dev, most_sync_file);
+    }
+    up_write(&sync_dev->config_lock_tx);
+
+    /* a writer waiting for a larger cap may continue now */
+    wake_up_interruptible(&sync_dev->tx_queue);
+
+    return 0;
+}
+
+/**
+ * See documentation of MOST_SYNC_TX_GET_DELAY.
+ *
+ * @param filp the Linux struct file
+ * @param ioctl_arg the already checked ioctl argument
+ */
+static int most_sync_do_tx_get_delay(struct file *filp, unsigned long ioctl_arg)
+{
+    struct most_sync_file   *file = filp->private_data;
+    struct most_sync_dev    *sync_dev = file->sync_dev;
+    struct tx_stats         stats;
+    u64                     usecs;
+
+    if (!file->tx_running) {
+        return -EBUSY;
+    }
+
+    down_read(&sync_dev->config_lock_tx);
+    txbuf_get_stats(sync_dev->sw_transmit_buf, file->writer_index, &stats);
+    usecs = (u64)(stats.queued_frames + sync_dev->tx_page_frames) * USEC_PER_SEC;
+    up_read(&sync_dev->config_lock_tx);
+
+    do_div(usecs, STD_MOST_FRAMES_PER_SEC);
+
+    return __put_user((__u32)usecs, (__u32 __user *)ioctl_arg);
+}
+
+/**
+ * Checks a hardware and a software buffer size of
+ * MOST_SYNC_SET_BUFFER_SIZES, 0 means that the current value is kept.
+ *
+ * @param sw the new software buffer size or 0
+ * @param hw the new hardware buffer size or 0
+ * @param cur_sw the current software buffer size
+ * @param cur_hw the current hardware buffer size
+ * @return @c true if the sizes are valid, @c false otherwise
+ */
+static bool most_sync_buffer_sizes_valid(__u32 sw, __u32 hw,
+                                         unsigned int cur_sw,
+                                         unsigned int cur_hw)
+{
+    sw = sw != 0 ? sw : cur_sw;
+    hw = hw != 0 ? hw : cur_hw;
+
+    return hw <= MOST_SYNC_MAX_PAGE_FRAMES && 
+        sw <= MOST_SYNC_MAX_BUFFER_FRAMES && sw >= 2 * hw;
+}
+
+/**
+ * See documentation of MOST_SYNC_SET_BUFFER_SIZES.
+ *
+ * @param filp the Linux struct file
+ * @param ioctl_arg the already checked ioctl argument
+ */
+static int most_sync_do_set_buffer_sizes(struct file *filp, unsigned long ioctl_arg)
+{
+    struct most_sync_file           *file = filp->private_data;
+    struct most_sync_dev            *sync_dev = file->sync_dev;
+    struct most_sync_buffer_sizes   sizes;
+    int                             err = 0;
+
+    /* the buffers are allocated in the kernel and affect all files */
+    if (!capable(CAP_SYS_ADMIN)) {
+        return -EPERM;
+    }
+
+    if (__copy_from_user(&sizes, (void __user *)ioctl_arg, sizeof(sizes))) {
+        return -EFAULT;
+    }
+
+    down_write(&sync_dev->config_lock_rx);
+    down_write(&sync_dev->config_lock_tx);
+
+    if (!most_sync_buffer_sizes_valid(sizes.sw_rx_frames, sizes.hw_rx_frames,
+                sync_dev->sw_rx_frames, sync_dev->hw_rx_frames) ||
+            !most_sync_buffer_sizes_valid(sizes.sw_tx_frames, sizes.hw_tx_frames,
+                sync_dev->sw_tx_frames, sync_dev->hw_tx_frames)) {
+        err = -EINVAL;
+        goto out;
+    }
+
+    /* the running rings are reallocated by the next setup */
+    if (sizes.sw_rx_frames != 0 || sizes.hw_rx_frames != 0) {
+        if (sizes.sw_rx_frames != 0) {
+            sync_dev->sw_rx_frames = sizes.sw_rx_frames;
+        }
+        if (sizes.hw_rx_frames != 0) {
+            sync_dev->hw_rx_frames = sizes.hw_rx_frames;
+        }
+        sync_dev->rx_resize = sync_dev->sw_receive_buf != NULL;
+    }
+    if (sizes.sw_tx_frames != 0 || sizes.hw_tx_frames != 0) {
+        if (sizes.sw_tx_frames != 0) {
+            sync_dev->sw_tx_frames = sizes.sw_tx_frames;
+        }
+        if (sizes.hw_tx_frames != 0) {
+            sync_dev->hw_tx_frames = sizes.hw_tx_frames;
+        }
+        sync_dev->tx_resize = sync_dev->sw_transmit_buf != NULL;
+    }
+
+    pr_sync_debug(PR "Buffer sizes: rx %u/%u, tx %u/%u frames\n",
+            sync_dev->sw_rx_frames, sync_dev->hw_rx_frames,
+            sync_dev->sw_tx_frames, sync_dev->hw_tx_frames);
+
+out:
+    up_write(&sync_dev->config_lock_tx);
+    up_write(&sync_dev->config_lock_rx);
+
+    return err;
+}
+
+/**
+ * See documentation of MOST_SYNC_GET_BUFFER_SIZES.
+ *
+ * @param filp the Linux struct file
+ * @param ioctl_arg the already checked ioctl argument
+ */
+static int most_sync_do_get_buffer_sizes(struct file *filp, unsigned long ioctl_arg)
+{
+    struct most_sync_file           *file = filp->private_data;
+    struct most_sync_dev            *sync_dev = file->sync_dev;
+    struct most_sync_buffer_sizes   sizes;
+
+    down_read(&sync_dev->config_lock_rx);
+    sizes.sw_rx_frames = sync_dev->sw_rx_frames;
+    sizes.hw_rx_frames = sync_dev->hw_rx_frames;
+    up_read(&sync_dev->config_lock_rx);
+
+    down_read(&sync_dev->config_lock_tx);
+    sizes.sw_tx_frames = sync_dev->sw_tx_frames;
+    sizes.hw_tx_frames = sync_dev->hw_tx_frames;
+    up_read(&sync_dev->config_lock_tx);
+
+    if (__copy_to_user((void __user *)ioctl_arg, &sizes, sizeof(sizes))) {
+        return -EFAULT;
+    }
+
+    return 0;
+}
+
+/**
+ * See documentation of MOST_SYNC_TX_MMAP_INFO.
+ *
+ * @param filp the Linux struct file
+ * @param ioctl_arg the already checked ioctl argument
+ */
+static int most_sync_do_tx_mmap_info(struct file *filp, unsigned long ioctl_arg)
+{
+    struct most_sync_file           *file = filp->private_data;
+    struct most_sync_dev            *sync_dev = file->sync_dev;
+    struct most_sync_tx_mmap_info   info;
+
+    if (!file->tx_running) {
+        return -EBUSY;
+    }
+
+    down_read(&sync_dev->config_lock_tx);
+    if (!sync_dev->sw_transmit_buf->independent) {
+        up_read(&sync_dev->config_lock_tx);
+        return -ENODEV;
+    }
+    info.mmap_size    = txbuf_mmap_size(sync_dev->sw_transmit_buf, 
+                                        file->writer_index);
+    info.mmap_offset  = MOST_SYNC_TX_MMAP_OFFSET;
+    info.ring_offset  = PAGE_SIZE;
+    info.reserved     = 0;
+    up_read(&sync_dev->config_lock_tx);
+
+    if (__copy_to_user((void __user *)ioctl_arg, &info, sizeof(info))) {
+        return -EFAULT;
+    }
+
+    return 0;
+}
+
+/**
+ * See documentation of MOST_SYNC_TX_COMMIT.
+ *
+ * @param filp the Linux struct file
+ * @param ioctl_arg the already checked ioctl argument
+ */
+static int most_sync_do_tx_commit(struct file *filp, unsigned long ioctl_arg)
+{
+    struct most_sync_file   *file = filp->private_data;
+    struct most_sync_dev    *sync_dev = file->sync_dev;
+    __u32                   frames;
+    int                     ret;
+
+    if (__get_user(frames, (__u32 __user *)ioctl_arg)) {
+        return -EFAULT;
+    }
+
+    if (!file->tx_running) {
+        return -EBUSY;
+    }
+
+    down_read(&sync_dev->config_lock_tx);
+    ret = txbuf_commit(sync_dev->sw_transmit_buf, file->writer_index, frames);
+    up_read(&sync_dev->config_lock_tx);
+
+    return ret;
+}
+
+/**
+ * See documentation of MOST_SYNC_RX_GET_TIMESTAMP.
+ *
+ * @param filp the Linux struct file
+ * @param ioctl_arg the already checked ioctl argument
+ */
+static int most_sync_do_rx_get_timestamp(struct file *filp, unsigned long ioctl_arg)
+{
+    struct most_sync_file   *file = filp->private_data;
+    struct most_sync_dev    *sync_dev = file->sync_dev;
+    struct rx_timestamps    timestamps;
+
+    if (!file->rx_running) {
+        return -EBUSY;
+    }
+
+    down_read(&sync_dev->config_lock_rx);
+    rxbuf_get_timestamps(sync_dev->sw_receive_buf, file->reader_index,
+            rtnrt_clock_read(), &timestamps);
+    up_read(&sync_dev->config_lock_rx);
+
+    if (__copy_to_user((void __user *)ioctl_arg, &timestamps, sizeof(timestamps))) {
+        return -EFAULT;
+    }
+
+    return 0;
+}
+
+/**
+ * See documentation of MOST_SYNC_RX_SET_WATERMARK.
+ *
+ * @param filp the Linux struct file
+ * @param ioctl_arg the already checked ioctl argument
+ */
+static int most_sync_do_rx_set_watermark(struct file *filp, unsigned long ioctl_arg)
+{
+    struct most_sync_file           *file = filp->private_data;
+    struct most_sync_dev            *sync_dev = file->sync_dev;
+    struct most_sync_rx_watermark   watermark;
+    u64                             frames;
+
+    if (__copy_from_user(&watermark, (void __user *)ioctl_arg,
+                sizeof(watermark))) {
+        return -EFAULT;
+    }
+
+    /* round up, the reader wants at least that time */
+    frames = (u64)watermark.usecs * STD_MOST_FRAMES_PER_SEC + USEC_PER_SEC - 1;
+    do_div(frames, USEC_PER_SEC);
+
+    /* exclusive because the page size may follow the watermark */
+    down_write(&sync_dev->config_lock_rx);
+    file->watermark_rx = max((unsigned int)frames, watermark.frames);
+    if (file->rx_running) {
+        rxbuf_set_watermark(sync_dev->sw_receive_buf, file->reader_index,
+                file->watermark_rx);
+        most_sync_adapt_rx_pages(sync_dev, most_sync_file);
+    }
+    up_write(&sync_dev->config_lock_rx);
+
+    return 0;
+}
+
+/**
+ * See documentation of MOST_SYNC_RX_GET_STATS.
+ *
+ * @param filp the Linux struct file
+ * @param ioctl_arg the already checked ioctl argument
+ */
+static int most_sync_do_rx_get_stats(struct file *filp, unsigned long ioctl_arg)
+{
+    struct most_sync_file   *file = filp->private_data;
+    struct most_sync_dev    *sync_dev = file->sync_dev;
+    struct rx_stats         stats;
+
+    if (!file->rx_running) {
+        return -EBUSY;
+    }
+
+    down_read(&sync_dev->config_lock_rx);
+    rxbuf_get_stats(sync_dev->sw_receive_buf, file->reader_index, &stats);
+    up_read(&sync_dev->config_lock_rx);
+
+    if (__copy_to_user((void __user *)ioctl_arg, &stats, sizeof(stats))) {
+        return -EFAULT;
+    }
+
+    return 0;
+}
+
 /**
  * Implements the ioctl method of a MOST Synchronous device.
  *
@@ -686,6 +1420,51 @@ static int most_sync_do_ioctl(struct inode        *inode,
         case MOST_SYNC_SETUP_TX:
             return most_sync_do_setup_tx(filp, arg);
 
+        case MOST_SYNC_RX_MMAP_INFO:
+            return most_sync_do_rx_mmap_info(filp, arg);
+
+        case MOST_SYNC_RX_ADVANCE:
+            return most_sync_do_rx_advance(filp, arg);
+
+        case MOST_SYNC_RX_SET_POLICY:
+            return most_sync_do_rx_set_policy(filp, arg);
+
+        case MOST_SYNC_RX_GET_STATS:
+            return most_sync_do_rx_get_stats(filp, arg);
+
+        case MOST_SYNC_RX_SET_WATERMARK:
+            return most_sync_do_rx_set_watermark(filp, arg);
+
+        case MOST_SYNC_SETUP_RX_STRIPES:
+            return most_sync_do_setup_rx_stripes(filp, arg);
+
+        case MOST_SYNC_RX_GET_TIMESTAMP:
+            return most_sync_do_rx_get_timestamp(filp, arg);
+
+        case MOST_SYNC_TX_SET_POLICY:
+            return most_sync_do_tx_set_policy(filp, arg);
+
+        case MOST_SYNC_TX_GET_STATS:
+            return most_sync_do_tx_get_stats(filp, arg);
+
+        case MOST_SYNC_TX_MMAP_INFO:
+            return most_sync_do_tx_mmap_info(filp, arg);
+
+        case MOST_SYNC_TX_COMMIT:
+            return most_sync_do_tx_commit(filp, arg);
+
+        case MOST_SYNC_TX_SET_LATENCY:
+            return most_sync_do_tx_set_latency(filp, arg);
+
+        case MOST_SYNC_TX_GET_DELAY:
+            return most_sync_do_tx_get_delay(filp, arg);
+
+        case MOST_SYNC_SET_BUFFER_SIZES:
+            return most_sync_do_set_buffer_sizes(filp, arg);
+
+        case MOST_SYNC_GET_BUFFER_SIZES:
+            return most_sync_do_get_buffer_sizes(filp, arg);
+
         default:
             return -ENOTTY;
     }
@@ -693,31 +1472,56 @@ static int most_sync_do_ioctl(struct inode        *inode,
     return 0;
 }
 
-/*
- * see header
+/**
+ * Implementation of most_sync_setup_rx() and MOST_SYNC_SETUP_RX_STRIPES.
+ *
+ * @param filp the Linux struct file
+ * @param frame_part the frame part of the reader
+ * @param stripes the stripes of the reader (@p frame_part covers all of them)
+ *        or @c NULL to read @p frame_part
+ * @return 0 on success, a negative error code on failure
  */
-int most_sync_setup_rx(struct file              *filp, 
-                       struct frame_part        *frame_part)
+static int most_sync_setup_rx_stripes(struct file               *filp,
+                                      struct frame_part         *frame_part,
+                                      const struct rx_stripes   *stripes)
 {
     struct most_sync_file   *sync_file = (void *)filp->private_data;
     struct most_sync_dev    *sync_dev = sync_file->sync_dev;
     int                     err = 0;
+    int                     i;
 
     down_write(&sync_dev->config_lock_rx);
 
-    /* if it's running, stop it*/
-    if (sync_file->rx_running) {
-        most_sync_stop_rx(sync_file);
+    if (stripes) {
+        sync_file->stripes_rx = *stripes;
+    } else {
+        sync_file->stripes_rx.count = 0;
     }
 
-    most_sync_setup_rx_common(*frame_part, sync_file, sync_dev, hw_rx_buffer_size, 
-                              sw_rx_buffer_size, err, most_sync_file);
+    most_sync_setup_rx_common(*frame_part, sync_file, sync_dev,
+                              sync_dev->hw_rx_frames, sync_dev->sw_rx_frames,
+                              rx_demux, rx_dma_ring, err,
+                              most_sync_file);
+
+    /* the reader indices may have changed, let pollers wait on the new queue */
+    for (i = 0; i < MOST_SYNC_OPENS; i++) {
+        wake_up_interruptible(&sync_dev->rx_queue[i]);
+    }
 
     up_write(&sync_dev->config_lock_rx);
 
     return err;
 }
 
+/*
+ * see header
+ */
+int most_sync_setup_rx(struct file              *filp, 
+                       struct frame_part        *frame_part)
+{
+    return most_sync_setup_rx_stripes(filp, frame_part, NULL);
+}
+
 /**
  * See documentation of MOST_SYNC_SETUP_RX.
  *
@@ -740,6 +1544,31 @@ static int most_sync_do_setup_rx(struct file        *filp,
     return most_sync_setup_rx(filp, &param);
 }
 
+/**
+ * See documentation of MOST_SYNC_SETUP_RX_STRIPES.
+ *
+ * @param filp the Linux struct file
+ * @param ioctl_arg the already checked ioctl argument
+ */
+static int most_sync_do_setup_rx_stripes(struct file        *filp,
+                                         unsigned long      ioctl_arg)
+{
+    struct rx_stripes       stripes;
+    struct frame_part       bounds;
+    int                     err;
+
+    if (__copy_from_user(&stripes, (void __user *)ioctl_arg, sizeof(stripes))) {
+        return -EFAULT;
+    }
+
+    err = rxbuf_stripes_bounds(&stripes, &bounds);
+    if (unlikely(err != 0)) {
+        return err;
+    }
+
+    return most_sync_setup_rx_stripes(filp, &bounds, &stripes);
+}
+
 /*
  * see header
  */
@@ -752,17 +1581,14 @@ int most_sync_setup_tx(struct file          *filp,
 
     down_write(&sync_dev->config_lock_tx);
 
-    /* if it's running, stop it*/
-    if (sync_file->tx_running) {
-        most_sync_stop_tx(sync_file);
-    }
-
-    most_sync_setup_tx_common(*frame_part, sync_file, sync_dev, hw_tx_buffer_size, 
-                              sw_tx_buffer_size, err, most_sync_file);
+    most_sync_setup_tx_common(*frame_part, sync_file, sync_dev,
+                              sync_dev->hw_tx_frames, sync_dev->sw_tx_frames,
+                              tx_independent, err, 
+                              most_sync_file);
 
     up_write(&sync_dev->config_lock_tx);
 
-    return 0;
+    return err;
 }
 
 /**
@@ -797,6 +1623,9 @@ static int __init most_sync_init(void)
 
     rtnrt_info("Loading module %s, version %s\n", DRIVER_NAME, version);
     print_measuring_warning();
+    if (rx_dma_ring) {
+        rtnrt_warn(PR "rx_dma_ring is experimental, see the documentation\n");
+    }
 
     /* register driver */
     err = most_register_high_driver(&most_sync_high_driver);
@@ -823,6 +1652,10 @@ EXPORT_SYMBOL(hw_tx_buffer_size);
 EXPORT_SYMBOL(hw_rx_buffer_size);
 EXPORT_SYMBOL(sw_tx_buffer_size);
 EXPORT_SYMBOL(sw_rx_buffer_size);
+EXPORT_SYMBOL(rx_demux);
+EXPORT_SYMBOL(rx_dma_ring);
+EXPORT_SYMBOL(tx_independent);
+EXPORT_SYMBOL(adaptive_pages);
 
 EXPORT_SYMBOL(most_sync_read);
 EXPORT_SYMBOL(most_sync_write);
@@ -103,11 +103,31 @@ static ssize_t most_sync_rt_write  (struct rtdm_dev_context *, rtdm_user_info_t
  */
 long sw_rx_buffer_size = STD_MOST_FRAMES_PER_SEC; /* 1 s */
 
+/*
+ * see header
+ */
+int rx_demux = 0;
+
+/*
+ * see header
+ */
+int rx_dma_ring = 0;
+
 /*
  * see header
  */
 long sw_tx_buffer_size = STD_MOST_FRAMES_PER_SEC; /* 1 s */
 
+/*
+ * see header
+ */
+int tx_independent = 0;
+
+/*
+ * see header
+ */
+int adaptive_pages = 0;
+
 /*
  * see header
  */
@@ -131,11 +151,35 @@ MODULE_PARM_DESC(sw_rx_buffer_size,
         "Size of the software receive buffer in frame parts "
         "(default: " __MODULE_STRING(STD_MOST_FRAMES_PER_SEC) ")");
 
+module_param(rx_demux, bool, S_IRUGO);
+MODULE_PARM_DESC(rx_demux,
+        "Split the received frames into one ring per reader in the interrupt "
+        "service routine, mmap() is not available then (default: 0)");
+
+module_param(rx_dma_ring, bool, S_IRUGO);
+MODULE_PARM_DESC(rx_dma_ring,
+        "Let the card write directly into a DMA ring of sw_rx_buffer_size "
+        "frames instead of copying each page, takes precedence over rx_demux "
+        "(experimental, relies on the card taking a new SRXSA at each page "
+        "switch; default: 0)");
+
 module_param(sw_tx_buffer_size, long, S_IRUGO);
 MODULE_PARM_DESC(sw_tx_buffer_size, 
         "Size of the software transmit buffer in frame parts "
         "(default: " __MODULE_STRING(STD_MOST_FRAMES_PER_SEC) ")");
 
+module_param(tx_independent, bool, S_IRUGO);
+MODULE_PARM_DESC(tx_independent,
+        "Give each writer its own ring which is merged in the interrupt "
+        "service routine, so a writer without data doesn't hold back the "
+        "others (default: 0)");
+
+module_param(adaptive_pages, bool, S_IRUGO);
+MODULE_PARM_DESC(adaptive_pages,
+        "Choose the page size of the card from the tightest latency "
+        "requirement of the open files, with pages of up to 100 ms "
+        "(default: 0)");
+
 module_param(hw_rx_buffer_size, long, S_IRUGO);
 MODULE_PARM_DESC(hw_rx_buffer_size, 
         "Size of the hardware receive buffer in frame parts "
@@ -413,6 +457,13 @@ static int most_sync_nrt_close(struct rtdm_dev_context     *context,
                 most_sync_last_closed_rx(sync_dev, file, most_sync_nrt_stop_rx);
                 most_sync_nrt_reconfigure_end(&sync_dev->rx_sync);
             }
+        } else if (file->rx_running) {
+            /* the page size may grow without this reader */
+            err = most_sync_nrt_reconfigure_begin(&sync_dev->rx_sync);
+            if (err >= 0) {
+                most_sync_adapt_rx_pages(sync_dev, most_sync_rt_file);
+                most_sync_nrt_reconfigure_end(&sync_dev->rx_sync);
+            }
         }
 
         /* check if it's the last writer */
@@ -423,6 +474,14 @@ static int most_sync_nrt_close(struct rtdm_dev_context     *context,
                 most_sync_last_closed_tx(sync_dev, file, most_sync_nrt_stop_tx);
                 most_sync_nrt_reconfigure_end(&sync_dev->tx_sync);
             }
+        } else if (file->tx_running) {
+            /* the other writers must not wait for this one */
+            err = most_sync_nrt_reconfigure_begin(&sync_dev->tx_sync);
+            if (err >= 0) {
+                most_sync_closed_tx(sync_dev, file);
+                most_sync_adapt_tx_pages(sync_dev, most_sync_rt_file);
+                most_sync_nrt_reconfigure_end(&sync_dev->tx_sync);
+            }
         }
     } while (err != 0 && count++ < MAX_RETRIES);
 
@@ -468,13 +527,8 @@ static inline int most_sync_nrt_setup_rx(struct most_sync_rt_file *file,
         return err;
     }
 
-    /* if it's running, stop it*/
-    if (file->rx_running) {
-        most_sync_nrt_stop_rx(file);
-    }
-
-    most_sync_setup_rx_common(param, file, sync_dev, hw_rx_buffer_size,
-            sw_rx_buffer_size, err, most_sync_rt_file);
+    most_sync_setup_rx_common(param, file, sync_dev, sync_dev->hw_rx_frames,
+            sync_dev->sw_rx_frames, rx_demux, rx_dma_ring, err, most_sync_rt_file);
 
     most_sync_nrt_reconfigure_end(&sync_dev->rx_sync);
 
@@ -510,13 +564,8 @@ static inline int most_sync_nrt_setup_tx(struct most_sync_rt_file *file,
         return err;
     }
 
-    /* if it's running, stop it*/
-    if (file->tx_running) {
-        most_sync_nrt_stop_rx(file);
-    }
-
-    most_sync_setup_tx_common(param, file, sync_dev, hw_tx_buffer_size,
-            sw_tx_buffer_size, err, most_sync_rt_file);
+    most_sync_setup_tx_common(param, file, sync_dev, sync_dev->hw_tx_frames,
+            sync_dev->sw_tx_frames, tx_independent, err, most_sync_rt_file);
     most_sync_nrt_reconfigure_end(&sync_dev->tx_sync);
 
     return err;
@@ -752,6 +801,13 @@ static int most_sync_rt_probe(struct most_dev *most_dev)
     atomic_set(&sync_dev->receiver_count, 0);
     atomic_set(&sync_dev->transmitter_count, 0);
 
+    /* the module parameters are the defaults, there is no
+       RTDM ioctl to change them yet */
+    sync_dev->sw_rx_frames = sw_rx_buffer_size;
+    sync_dev->hw_rx_frames = hw_rx_buffer_size;
+    sync_dev->sw_tx_frames = sw_tx_buffer_size;
+    sync_dev->hw_tx_frames = hw_tx_buffer_size;
+
     /* create the new RTDM device */
     memcpy(&sync_dev->rtdm_dev, &device_templ, sizeof(struct rtdm_device));
     snprintf(sync_dev->rtdm_dev.device_name, RTDM_MAX_DEVNAME_LEN,
@@ -829,7 +885,7 @@ static void most_sync_rt_interrupt_handler(struct most_dev      *dev,
 
         val = most_readreg_rt(sync_dev->most_dev, MOST_PCI_SRXCTRL_REG);
         dma_start = sync_dev->hw_receive_buf.addr_virt;
-        siz = sync_dev->hw_receive_buf.size / 2;
+        siz = sync_dev->rx_quadlets * 4 * sync_dev->rx_dma_page_frames;
 
         /* 
          * current page == 0 
@@ -840,7 +896,12 @@ static void most_sync_rt_interrupt_handler(struct most_dev      *dev,
         }
 
         measuring_receive_isr_start(sync_dev->sw_receive_buf);
-        rxbuf_put(sync_dev->sw_receive_buf, dma_start, siz);
+        if (sync_dev->rx_dma_slots > 2) {
+            most_sync_rx_dma_ring_int(sync_dev, val, most_writereg_rt);
+        } else {
+            rxbuf_put(sync_dev->sw_receive_buf, dma_start, siz);
+        }
+        rxbuf_timestamp(sync_dev->sw_receive_buf, rtnrt_clock_read());
         measuring_receive_isr_wakeup();
         rtdm_event_pulse(&sync_dev->rx_wait);
 
@@ -850,6 +911,10 @@ static void most_sync_rt_interrupt_handler(struct most_dev      *dev,
             rtnrt_warn(PR "RT-RX: sync_dev->rx_current_page == current_page\n");
         }
         sync_dev->rx_current_page = current_page;
+
+        if (sync_dev->rx_dma_slots == 2) {
+            most_sync_rx_switch_int(sync_dev, val, most_writereg_rt);
+        }
     }
     
     if (intstatus & ISSTX) {
@@ -862,7 +927,7 @@ static void most_sync_rt_interrupt_handler(struct most_dev      *dev,
 
         val = most_readreg_rt(sync_dev->most_dev, MOST_PCI_STXCTRL_REG);
         dma_start = sync_dev->hw_transmit_buf.addr_virt;
-        siz = sync_dev->hw_transmit_buf.size / 2;
+        siz = sync_dev->tx_quadlets * 4 * sync_dev->tx_page_frames;
 
         /* 
          * current page == 0 
@@ -884,6 +949,8 @@ static void most_sync_rt_interrupt_handler(struct most_dev      *dev,
             rtnrt_warn(PR "RT-TX: sync_dev->tx_current_page == current_page\n");
         }
         sync_dev->tx_current_page = current_page;
+
+        most_sync_tx_switch_int(sync_dev, val, most_writereg_rt);
     }
 }
 
@@ -912,6 +979,9 @@ static int __init most_sync_rt_init(void)
 
     rtnrt_info("Loading module %s, version %s\n", DRIVER_NAME, version);
     print_measuring_warning();
+    if (rx_dma_ring) {
+        rtnrt_warn(PR "rx_dma_ring is experimental, see the documentation\n");
+    }
 
     serial_rt_debug_init();
 
@@ -940,6 +1010,8 @@ EXPORT_SYMBOL(hw_tx_buffer_size);
 EXPORT_SYMBOL(hw_rx_buffer_size);
 EXPORT_SYMBOL(sw_tx_buffer_size);
 EXPORT_SYMBOL(sw_rx_buffer_size);
+EXPORT_SYMBOL(rx_demux);
+EXPORT_SYMBOL(rx_dma_ring);
 
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("Bernhard Walle");
@@ -108,7 +108,52 @@ struct most_sync_rt_dev {
     struct dma_buffer       hw_receive_buf;      /**< the receive buffer */
     struct dma_buffer       hw_transmit_buf;     /**< the transmit buffer */
     struct rx_buffer        *sw_receive_buf;     /**< the receive ring buffer */
+    unsigned int            rx_dma_slots;        /**< pages of the DMA ring, 2 if
+                                                      not in the DMA ring mode */
+    unsigned int            rx_dma_slot;         /**< the DMA ring page at SRXSA */
+    bool                    rx_dma_armed;        /**< the page at @c rx_dma_slot
+                                                      has the canary, see
+                                                      most_sync_rx_dma_ring_int() */
+    bool                    rx_dma_failed;       /**< the card ignored SRXSA, no
+                                                      more frames are published */
+    unsigned int            rx_dma_page_frames;  /**< frames per DMA page */
+    unsigned int            rx_quadlets;         /**< quadlets per frame the card
+                                                      writes (SRXCA + 1) */
+    unsigned int            rx_switch_quadlets;  /**< quadlets the receive interrupt
+                                                      switches to, 0 if none, see
+                                                      most_sync_rx_switch_int() */
+    unsigned int            rx_switch_page_frames; /**< frames per page the receive
+                                                      interrupt switches to, 0 to
+                                                      keep the page size */
+    unsigned int            rx_max_page_frames;  /**< largest page the DMA buffer
+                                                      takes, see
+                                                      most_sync_adapt_rx_pages() */
     struct tx_buffer        *sw_transmit_buf;    /**< the transmit ring buffer */
+    unsigned int            tx_quadlets;         /**< quadlets per frame the card
+                                                      reads (STXCA + 1) */
+    unsigned int            tx_switch_quadlets;  /**< quadlets the transmit interrupt
+                                                      switches to, 0 if none, see
+                                                      most_sync_tx_switch_int() */
+    unsigned int            tx_page_frames;      /**< frames per transmit page */
+    unsigned int            tx_switch_page_frames; /**< frames per page the transmit
+                                                      interrupt switches to, 0 to
+                                                      keep the page size */
+    unsigned int            tx_max_page_frames;  /**< largest page the DMA buffer
+                                                      takes, see
+                                                      most_sync_adapt_tx_pages() */
+    unsigned int            sw_rx_frames;        /**< size of the software receive
+                                                      buffer */
+    unsigned int            hw_rx_frames;        /**< frames per receive page for
+                                                      the next setup */
+    unsigned int            sw_tx_frames;        /**< size of the software transmit
+                                                      buffer */
+    unsigned int            hw_tx_frames;        /**< frames per transmit page for
+                                                      the next setup */
+    bool                    rx_resize;           /**< the receive sizes have changed,
+                                                      the next setup reallocates */
+    bool                    tx_resize;           /**< the transmit sizes have
+                                                      changed, the next setup
+                                                      reallocates */
     struct list_head        file_list;           /**< list of all opened files in a device */
     atomic_t                open_count;          /**< open counter */
     atomic_t                receiver_count;      /**< count of running receivers */
@@ -152,6 +197,15 @@ struct most_sync_rt_file {
                                                       if rx_running is true */
     int                     writer_index;        /**< writer number for the tx buffer, only valid
                                                       if tx_running is true */
+    struct rx_policy        policy_rx;           /**< read policy, always the default
+                                                      policy (RX_OVERRUN_SKIP) */
+    unsigned int            watermark_rx;        /**< wakeup watermark in frames,
+                                                      always 0 (each frame) */
+    struct tx_policy        policy_tx;           /**< underrun policy, always the
+                                                      default policy
+                                                      (TX_UNDERRUN_SILENCE) */
+    unsigned int            latency_tx;          /**< latency cap in frames,
+                                                      always 0 (no cap) */
 };
 	
 #endif /* MOST_SYNC_RT_H */
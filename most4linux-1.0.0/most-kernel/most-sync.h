@@ -98,10 +98,306 @@
 #define MOST_SYNC_SETUP_TX \
     _IOW(MOST_SYNC_IOCTL_MAGIC, 1, struct frame_part)
 
+/**
+ * Information about the mapping of the receive ring, see 
+ * MOST_SYNC_RX_MMAP_INFO.
+ */
+struct most_sync_rx_mmap_info {
+    __u32    mmap_size;     /**< number of bytes that can be mapped, the
+                                 control page plus the ring */
+    __u32    ring_offset;   /**< offset of the ring in the mapping */
+    __u32    reader_index;  /**< index of this file in the
+                                 rx_mmap_ctrl.read_offset array */
+    __u32    reserved;      /**< reserved, always 0 */
+};
+
+/**
+ * Returns the information that is needed to map the receive ring with mmap()
+ * in a struct most_sync_rx_mmap_info. MOST_SYNC_SETUP_RX must have been called
+ * before.
+ *
+ * The ring can then be mapped read-only with mmap() at offset 0. The first
+ * page of the mapping is a struct rx_mmap_ctrl which contains the current write
+ * offset and the read offsets of all readers. The frames between the read offset
+ * of the reader and the write offset can be consumed in place, afterwards the
+ * read offset must be advanced with MOST_SYNC_RX_ADVANCE. To detect an
+ * overrun, the reader compares the sequence number of its next frame (see
+ * MOST_SYNC_RX_GET_STATS) with rx_mmap_ctrl.frames_written, read consistently
+ * with rx_mmap_ctrl.write_seq.
+ *
+ * Each setup ioctl() on the device (also from other files) replaces the ring.
+ * In that case, rx_mmap_ctrl.state changes to RX_MMAP_STALE and the ring must
+ * be unmapped and mapped again.
+ *
+ * Mapping is not available if the driver was loaded with the @c rx_demux
+ * parameter because there's no common ring then, and not with the
+ * @c rx_dma_ring parameter because the ring is DMA memory of the card.
+ *
+ * Returns 0 on success, a negative error value on failure (@c -ENODEV if
+ * the @c rx_demux or the @c rx_dma_ring parameter is set).
+ */
+#define MOST_SYNC_RX_MMAP_INFO \
+    _IOR(MOST_SYNC_IOCTL_MAGIC, 2, struct most_sync_rx_mmap_info)
+
+/**
+ * Advances the read offset of this file by the given number of frames
+ * (<tt>__u32</tt>) without copying the data. Used together with mmap().
+ *
+ * Returns the number of frames the read offset was advanced (which is less
+ * if not enough frames are available) or a negative error value on failure.
+ * Overruns are handled like in read(), see MOST_SYNC_RX_SET_POLICY.
+ */
+#define MOST_SYNC_RX_ADVANCE \
+    _IOW(MOST_SYNC_IOCTL_MAGIC, 3, __u32)
+
+/**
+ * Sets the read policy (struct rx_policy) of this file: what happens if the
+ * reader was overrun by the device, i.e. if it didn't read for longer than the
+ * size of the software receive buffer, and if old frames should be skipped to
+ * keep the latency low. The policy stays valid for further
+ * MOST_SYNC_SETUP_RX calls.
+ *
+ * With RX_OVERRUN_ERROR, read() fails once with @c -EOVERFLOW after an
+ * overrun, with RX_OVERRUN_SKIP (the default) it continues with the newest
+ * frames. In both cases, the read position jumps to the last received page
+ * (or as many frames as the watermark of the file, if that is more, but at
+ * most @c latest_frames) and the frames before are counted as lost, see
+ * MOST_SYNC_RX_GET_STATS.
+ *
+ * Returns 0 on success, a negative error value on failure.
+ */
+#define MOST_SYNC_RX_SET_POLICY \
+    _IOW(MOST_SYNC_IOCTL_MAGIC, 4, struct rx_policy)
+
+/**
+ * Returns the receive statistics (struct rx_stats) of this file, i.e. the 64
+ * bit sequence number of the next frame, the number of lost and skipped frames
+ * and the number of overruns. The counters start at 0 with each setup of the
+ * receive ring. MOST_SYNC_SETUP_RX must have been called before.
+ *
+ * Returns 0 on success, a negative error value on failure.
+ */
+#define MOST_SYNC_RX_GET_STATS \
+    _IOR(MOST_SYNC_IOCTL_MAGIC, 5, struct rx_stats)
+
+/**
+ * Wakeup watermark of a reader, see MOST_SYNC_RX_SET_WATERMARK.
+ */
+struct most_sync_rx_watermark {
+    __u32    frames;        /**< minimum number of frames */
+    __u32    usecs;         /**< minimum time in microseconds, converted to
+                                 frames with STD_MOST_FRAMES_PER_SEC */
+};
+
+/**
+ * Sets the wakeup watermark (struct most_sync_rx_watermark) of this file. A
+ * blocking read() and poll() only return once at least that many frames are
+ * available for this reader, so a reader that wants 100 ms of data isn't woken
+ * up on each page. If both values are set, the larger one counts, 0 means
+ * each frame (the default). The watermark is limited to the size of the
+ * software receive buffer and stays valid for further MOST_SYNC_SETUP_RX calls.
+ *
+ * A non-blocking read() still returns the frames that are available.
+ *
+ * Returns 0 on success, a negative error value on failure.
+ */
+#define MOST_SYNC_RX_SET_WATERMARK \
+    _IOW(MOST_SYNC_IOCTL_MAGIC, 6, struct most_sync_rx_watermark)
+
+/**
+ * Setup ioctl() call like MOST_SYNC_SETUP_RX, but with several frame parts
+ * (stripes, see struct rx_stripes) that are returned together by each read().
+ * This replaces one file per frame part, and the ring is traversed only once
+ * for all stripes.
+ *
+ * Each read() returns whole frames of all stripes, i.e. a multiple of the sum
+ * of the stripe sizes, in the layout given in rx_stripes.layout. With
+ * RX_LAYOUT_PLANAR, the planes are as large as the number of frames returned.
+ * A later MOST_SYNC_SETUP_RX on the same file returns to a single frame part.
+ *
+ * Returns 0 on success, a negative error value on failure (@c -EINVAL if the
+ * stripes are invalid).
+ */
+#define MOST_SYNC_SETUP_RX_STRIPES \
+    _IOW(MOST_SYNC_IOCTL_MAGIC, 7, struct rx_stripes)
+
+/**
+ * Returns the timing (struct rx_timestamps) of this file: the sequence number
+ * and the receive time of the first frame of the last read() and the age of
+ * the oldest frame that is available for reading. The interrupt service
+ * routine takes a timestamp of each page, the time of a single frame is
+ * derived from that. MOST_SYNC_SETUP_RX must have been called before.
+ *
+ * Returns 0 on success, a negative error value on failure.
+ */
+#define MOST_SYNC_RX_GET_TIMESTAMP \
+    _IOR(MOST_SYNC_IOCTL_MAGIC, 8, struct rx_timestamps)
+
+/**
+ * Sets the underrun policy (struct tx_policy) of this file, i.e. what is
+ * transmitted in its frame part while it has no data. Only used if the
+ * driver was loaded with the @c tx_independent parameter, otherwise all
+ * writers wait for the slowest one and silence is transmitted in the whole
+ * frame. The policy stays valid for further MOST_SYNC_SETUP_TX calls.
+ *
+ * Returns 0 on success, a negative error value on failure.
+ */
+#define MOST_SYNC_TX_SET_POLICY \
+    _IOW(MOST_SYNC_IOCTL_MAGIC, 9, struct tx_policy)
+
+/**
+ * Returns the transmit statistics (struct tx_stats) of this file. The
+ * underrun counters are only maintained with the @c tx_independent
+ * parameter. MOST_SYNC_SETUP_TX must have been called before.
+ *
+ * Returns 0 on success, a negative error value on failure.
+ */
+#define MOST_SYNC_TX_GET_STATS \
+    _IOR(MOST_SYNC_IOCTL_MAGIC, 10, struct tx_stats)
+
+/**
+ * Offset that selects the transmit area of the file in mmap(), see
+ * MOST_SYNC_TX_MMAP_INFO. Offset 0 maps the receive ring.
+ */
+#define MOST_SYNC_TX_MMAP_OFFSET            0x40000000
+
+/**
+ * Information about the mapping of the transmit area, see 
+ * MOST_SYNC_TX_MMAP_INFO.
+ */
+struct most_sync_tx_mmap_info {
+    __u32    mmap_size;     /**< number of bytes that can be mapped, the
+                                 control page plus the ring */
+    __u32    mmap_offset;   /**< offset to pass to mmap(), always
+                                 MOST_SYNC_TX_MMAP_OFFSET */
+    __u32    ring_offset;   /**< offset of the ring in the mapping */
+    __u32    reserved;      /**< reserved, always 0 */
+};
+
+/**
+ * Returns the information that is needed to map the transmit area of this
+ * file with mmap() in a struct most_sync_tx_mmap_info. MOST_SYNC_SETUP_TX must
+ * have been called before.
+ *
+ * The area is mapped read-write at offset MOST_SYNC_TX_MMAP_OFFSET. The first
+ * page is a struct tx_mmap_ctrl, followed by a ring which only contains the
+ * frame part of this file. The frame parts are stored at
+ * tx_mmap_ctrl.write_offset and then published with MOST_SYNC_TX_COMMIT, the
+ * interrupt service routine copies them directly into the pages of the card.
+ * At most <tt>frame_count - 1</tt> frame parts can be outstanding, the frame
+ * part before tx_mmap_ctrl.read_offset must not be overwritten.
+ *
+ * Each MOST_SYNC_SETUP_TX of this file replaces the area. In that case,
+ * tx_mmap_ctrl.state changes to TX_MMAP_STALE and the area must be mapped
+ * again.
+ *
+ * Only available if the driver was loaded with the @c tx_independent
+ * parameter because otherwise the frame parts of all writers are interleaved
+ * in one ring.
+ *
+ * Returns 0 on success, a negative error value on failure (@c -ENODEV if
+ * the @c tx_independent parameter is not set).
+ */
+#define MOST_SYNC_TX_MMAP_INFO \
+    _IOR(MOST_SYNC_IOCTL_MAGIC, 11, struct most_sync_tx_mmap_info)
+
+/**
+ * Publishes the given number of frame parts (<tt>__u32</tt>) which have been
+ * stored in the mapped transmit area, see MOST_SYNC_TX_MMAP_INFO. The write
+ * offset in the control page advances accordingly. Can be mixed with write().
+ *
+ * Returns the number of frame parts committed (which is less if the ring has
+ * not enough free space, use poll() to wait for it) or a negative error value
+ * on failure. If the file had an underrun, the frame parts it missed have been
+ * skipped and tx_mmap_ctrl.read_offset is ahead of the write offset. The call
+ * then fails with @c -EPIPE without committing anything, the write offset
+ * moves to the read offset and the frame parts must be stored there again.
+ */
+#define MOST_SYNC_TX_COMMIT \
+    _IOW(MOST_SYNC_IOCTL_MAGIC, 12, __u32)
+
+/**
+ * Latency cap of a writer, see MOST_SYNC_TX_SET_LATENCY.
+ */
+struct most_sync_tx_latency {
+    __u32    frames;        /**< maximum number of queued frames */
+    __u32    usecs;         /**< maximum queued time in microseconds,
+                                 converted to frames with
+                                 STD_MOST_FRAMES_PER_SEC */
+};
+
+/**
+ * Sets the latency cap (struct most_sync_tx_latency) of this file: write()
+ * and MOST_SYNC_TX_COMMIT accept at most that many frames ahead of the
+ * transmission, a blocking write() and poll() wait until the queue is below
+ * the cap. This keeps the output latency of interactive streams low while
+ * other writers of the same device still use the whole software transmit
+ * buffer. If both values are set, the smaller one counts, 0 means the size of
+ * the software transmit buffer (the default). The cap stays valid for further
+ * MOST_SYNC_SETUP_TX calls.
+ *
+ * Returns 0 on success, a negative error value on failure.
+ */
+#define MOST_SYNC_TX_SET_LATENCY \
+    _IOW(MOST_SYNC_IOCTL_MAGIC, 13, struct most_sync_tx_latency)
+
+/**
+ * Returns the current output delay of this file in microseconds
+ * (<tt>__u32</tt>): the frames that are queued in the software transmit buffer
+ * plus one page of the card, i.e. how long a frame written now takes until it
+ * is transmitted. MOST_SYNC_SETUP_TX must have been called before.
+ *
+ * Returns 0 on success, a negative error value on failure.
+ */
+#define MOST_SYNC_TX_GET_DELAY \
+    _IOR(MOST_SYNC_IOCTL_MAGIC, 14, __u32)
+
+/**
+ * Buffer sizes of a device in frames, see MOST_SYNC_SET_BUFFER_SIZES.
+ */
+struct most_sync_buffer_sizes {
+    __u32    sw_rx_frames;  /**< size of the software receive buffer */
+    __u32    hw_rx_frames;  /**< frames per page of the card when receiving */
+    __u32    sw_tx_frames;  /**< size of the software transmit buffer */
+    __u32    hw_tx_frames;  /**< frames per page of the card when
+                                 transmitting */
+};
+
+/**
+ * Changes the buffer sizes (struct most_sync_buffer_sizes) of the device
+ * without reloading the module. The module parameters @c sw_rx_buffer_size,
+ * @c hw_rx_buffer_size, @c sw_tx_buffer_size and @c hw_tx_buffer_size are
+ * only the defaults for each device. A value of 0 leaves the size unchanged.
+ * The hardware sizes must be between 1 and MOST_SYNC_MAX_PAGE_FRAMES, the
+ * software sizes at least twice the hardware sizes and at most
+ * MOST_SYNC_MAX_BUFFER_FRAMES. The caller needs @c CAP_SYS_ADMIN.
+ *
+ * The running rings are not touched, the next MOST_SYNC_SETUP_RX or
+ * MOST_SYNC_SETUP_TX stops the direction, reallocates the buffers with the new
+ * sizes and starts it again. All readers (or writers) of the device have to
+ * call the setup ioctl again then. Per-file limits within the shared buffers
+ * are MOST_SYNC_RX_SET_WATERMARK and MOST_SYNC_TX_SET_LATENCY.
+ *
+ * Returns 0 on success, a negative error value on failure (@c -EINVAL if the
+ * sizes are out of range, @c -EPERM without @c CAP_SYS_ADMIN).
+ */
+#define MOST_SYNC_SET_BUFFER_SIZES \
+    _IOW(MOST_SYNC_IOCTL_MAGIC, 15, struct most_sync_buffer_sizes)
+
+/**
+ * Returns the buffer sizes (struct most_sync_buffer_sizes) which are used for
+ * the next reallocation of the buffers of the device. The sizes of the running
+ * rings may differ after a MOST_SYNC_SET_BUFFER_SIZES.
+ *
+ * Returns 0 on success, a negative error value on failure.
+ */
+#define MOST_SYNC_GET_BUFFER_SIZES \
+    _IOR(MOST_SYNC_IOCTL_MAGIC, 16, struct most_sync_buffer_sizes)
+
 /**
  * The maximum ioctl number. This value may change in future.
  */
-#define MOST_SYNC_MAXIOCTL                  1
+#define MOST_SYNC_MAXIOCTL                  16
 
 
 #ifdef __KERNEL__
@@ -133,15 +429,62 @@ struct most_sync_dev {
     struct dma_buffer       hw_receive_buf;      /**< the receive buffer */
     struct dma_buffer       hw_transmit_buf;     /**< the transmit buffer */
     struct rx_buffer        *sw_receive_buf;     /**< the receive ring buffer */
+    unsigned int            rx_dma_slots;        /**< pages of the DMA ring, 2 if
+                                                      not in the DMA ring mode */
+    unsigned int            rx_dma_slot;         /**< the DMA ring page at SRXSA */
+    bool                    rx_dma_armed;        /**< the page at @c rx_dma_slot
+                                                      has the canary, see
+                                                      most_sync_rx_dma_ring_int() */
+    bool                    rx_dma_failed;       /**< the card ignored SRXSA, no
+                                                      more frames are published */
+    unsigned int            rx_dma_page_frames;  /**< frames per DMA page */
+    unsigned int            rx_quadlets;         /**< quadlets per frame the card
+                                                      writes (SRXCA + 1) */
+    unsigned int            rx_switch_quadlets;  /**< quadlets the receive interrupt
+                                                      switches to, 0 if none, see
+                                                      most_sync_rx_switch_int() */
+    unsigned int            rx_switch_page_frames; /**< frames per page the receive
+                                                      interrupt switches to, 0 to
+                                                      keep the page size */
+    unsigned int            rx_max_page_frames;  /**< largest page the DMA buffer
+                                                      takes, see
+                                                      most_sync_adapt_rx_pages() */
     struct tx_buffer        *sw_transmit_buf;    /**< the transmit ring buffer */
+    unsigned int            tx_quadlets;         /**< quadlets per frame the card
+                                                      reads (STXCA + 1) */
+    unsigned int            tx_switch_quadlets;  /**< quadlets the transmit interrupt
+                                                      switches to, 0 if none, see
+                                                      most_sync_tx_switch_int() */
+    unsigned int            tx_page_frames;      /**< frames per transmit page */
+    unsigned int            tx_switch_page_frames; /**< frames per page the transmit
+                                                      interrupt switches to, 0 to
+                                                      keep the page size */
+    unsigned int            tx_max_page_frames;  /**< largest page the DMA buffer
+                                                      takes, see
+                                                      most_sync_adapt_tx_pages() */
+    unsigned int            sw_rx_frames;        /**< size of the software receive
+                                                      buffer, see
+                                                      MOST_SYNC_SET_BUFFER_SIZES */
+    unsigned int            hw_rx_frames;        /**< frames per receive page for
+                                                      the next setup */
+    unsigned int            sw_tx_frames;        /**< size of the software transmit
+                                                      buffer */
+    unsigned int            hw_tx_frames;        /**< frames per transmit page for
+                                                      the next setup */
+    bool                    rx_resize;           /**< the receive sizes have changed,
+                                                      the next setup reallocates */
+    bool                    tx_resize;           /**< the transmit sizes have
+                                                      changed, the next setup
+                                                      reallocates */
     struct list_head        file_list;           /**< list of all opened files in a 
                                                       device */
     atomic_t                open_count;          /**< open counter */
     atomic_t                receiver_count;      /**< count of running receivers */
     atomic_t                transmitter_count;   /**< count of running transmittes */
-    wait_queue_head_t       rx_queue;            /**< wait queue for sleeping processes 
-                                                      that want to read data but cannot
-                                                      because there are no data to read */
+    wait_queue_head_t       rx_queue[MOST_SYNC_OPENS]; /**< wait queue of each reader
+                                                      for sleeping processes that want
+                                                      to read data but cannot because
+                                                      the watermark is not reached */
     wait_queue_head_t       tx_queue;            /**< wait queue for sleeping processes
                                                       that want to write data but cannot
                                                       write because the queue is full */
@@ -177,6 +520,18 @@ struct most_sync_file {
     int                    writer_index;        /**< writer number for the tx buffer,
                                                      only valid if @c tx_running is
                                                      @c true */
+    struct rx_policy       policy_rx;           /**< read policy, see
+                                                     MOST_SYNC_RX_SET_POLICY */
+    unsigned int           watermark_rx;        /**< wakeup watermark in frames, see
+                                                     MOST_SYNC_RX_SET_WATERMARK */
+    struct rx_stripes      stripes_rx;          /**< the stripes if set up with
+                                                     MOST_SYNC_SETUP_RX_STRIPES
+                                                     (@c part_rx covers all of them),
+                                                     count 0 otherwise */
+    struct tx_policy       policy_tx;           /**< underrun policy, see
+                                                     MOST_SYNC_TX_SET_POLICY */
+    unsigned int           latency_tx;          /**< latency cap in frames, see
+                                                     MOST_SYNC_TX_SET_LATENCY */
 };
 
 
@@ -189,6 +544,8 @@ struct most_sync_file {
  * @param buff the userspace buffer that contains the destination
  * @param count the number of bytes allocated for @p buff
  * @param copy how the memory must be copied
+ * @return the number of bytes read, @c -EAGAIN if the file was opened with
+ *         @c O_NONBLOCK and no frame is available
  */
 ssize_t most_sync_read(struct file                  *filp, 
                        void                         *buff,
@@ -204,6 +561,8 @@ ssize_t most_sync_read(struct file                  *filp,
  * @param buff the userspace buffer that contains the destination
  * @param count the number of bytes allocated for @p buff
  * @param copy how the memory must be copied
+ * @return the number of bytes written, less than @p count or @c -EAGAIN if
+ *         the file was opened with @c O_NONBLOCK and the ring is full
  */
 ssize_t most_sync_write(struct file                 *filp, 
                         void                        *buff,
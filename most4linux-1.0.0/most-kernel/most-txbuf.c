@@ -51,15 +51,22 @@
 /*
  * Documentation: see header
  */
-struct tx_buffer *txbuf_alloc(unsigned int writer_count, 
-                              unsigned int frame_count,
-                              unsigned int bytes_per_frame)
+struct tx_buffer *txbuf_alloc(unsigned int frame_count,
+                              unsigned int bytes_per_frame,
+                              bool         independent)
 {
-    int                 i;
     struct tx_buffer    *ret;
 
     /* one element more to detemerine emtpy and full rings */
     frame_count++;
+
+    /* the ring and the control page must fit in an unsigned int */
+    if (unlikely(frame_count < 2 || bytes_per_frame == 0 ||
+                bytes_per_frame > (UINT_MAX - 2 * PAGE_SIZE) / frame_count)) {
+        rtnrt_err(PR "Invalid ring size: %u frames with %u bytes\n",
+                frame_count, bytes_per_frame);
+        return NULL;
+    }
  
     /* allocate the structure */
     ret = ker_malloc(sizeof(struct tx_buffer));
@@ -70,50 +77,372 @@ struct tx_buffer *txbuf_alloc(unsigned int writer_count,
     memset(ret, 0, sizeof(struct tx_buffer));
 
     /* initialize all elements */
-    ret->writer_count    = writer_count;
+    ret->writer_count    = 0;
     ret->frame_count     = frame_count;
     ret->bytes_per_frame = bytes_per_frame;
-    ret->full_count      = 0;
-    rtnrt_lock_init(&ret->lock);
+    ret->hw_bytes_per_frame = bytes_per_frame;
+    ret->frames_read     = 0;
+    ret->independent     = independent;
 
-    /* allocate the ring */
-    ret->buffer = vmalloc(bytes_per_frame * frame_count);
-    pr_txbuf_debug(PR "Allocating %d bytes ringbuffer (0x%p)\n", 
-             bytes_per_frame * frame_count, ret->buffer);
-    if (unlikely(!ret->buffer)) {
-        pr_txbuf_debug(PR "Allocating ring buffer failed\n");
-        goto err_buf;
+    /* allocate the ring, the writers have their own in the independent mode */
+    if (!independent) {
+        ret->buffer = vmalloc(bytes_per_frame * frame_count);
+        pr_txbuf_debug(PR "Allocating %d bytes ringbuffer (0x%p)\n", 
+                 bytes_per_frame * frame_count, ret->buffer);
+        if (unlikely(!ret->buffer)) {
+            pr_txbuf_debug(PR "Allocating ring buffer failed\n");
+            goto err_buf;
+        }
+
+        /* the bytes which no writer transmits are silence */
+        memset(ret->buffer, 0, bytes_per_frame * frame_count);
     }
-#ifdef DEBUG
-    memset(ret->buffer, 0, bytes_per_frame * frame_count);
-#endif
 
-    /* set the pointers right */
-    for (i = 0; i < ret->writer_count; i++) {
-        ret->writeptr[i] = ret->buffer;
+    /* the writers are added later, see txbuf_add_writer() */
+    ret->writers = ker_malloc(MOST_SYNC_OPENS * sizeof(struct txbuf_writer *));
+    if (unlikely(!ret->writers)) {
+        rtnrt_err(PR "Allocating the writer table failed\n");
+        goto err_ring;
     }
+    memset(ret->writers, 0, MOST_SYNC_OPENS * sizeof(struct txbuf_writer *));
     ret->readptr = ret->buffer;
 
     return ret;
     
+err_ring:
+    if (ret->buffer) {
+        vfree(ret->buffer);
+    }
 err_buf:
     kfree(ret);
     return NULL;
 }
 
+/**
+ * Frees the ring of a writer in the independent mode. txbuf_get() must not
+ * use the writer any more, see txbuf_remove_writer() and txbuf_free().
+ *
+ * @param writer the writer
+ */
+static void txbuf_free_area(struct txbuf_writer *writer)
+{
+    /* 
+     * pages which are still mapped in userspace stay allocated until they are
+     * unmapped, so tell the user that the ring is gone
+     */
+    writer->ctrl->state = TX_MMAP_STALE;
+    vfree(writer->area);
+
+    writer->area   = NULL;
+    writer->ctrl   = NULL;
+    writer->buffer = NULL;
+}
+
 /*
  * Documentation: see header
  */
 void txbuf_free(struct tx_buffer *ring)
 {
+    int i;
+
     if (ring) {
         if (ring->buffer) {
             vfree(ring->buffer);
         }
+        for (i = 0; i < MOST_SYNC_OPENS; i++) {
+            if (ring->writers[i] && ring->writers[i]->area) {
+                txbuf_free_area(ring->writers[i]);
+            }
+            kfree(ring->writers[i]);
+        }
+        kfree(ring->writers);
         kfree(ring);
     }
 }
 
+/**
+ * Returns the difference of two sequence numbers of which one may be modified
+ * by the other side at the same time. The difference is always less than the
+ * size of the ring, so only the low 32 bits are used, which are read
+ * atomically also on 32 bit architectures.
+ *
+ * @param a the first sequence number
+ * @param b the second sequence number
+ * @return <tt>a - b</tt>
+ */
+static inline long txbuf_seq_diff(u64 a, u64 b)
+{
+    return (s32)((u32)a - (u32)b);
+}
+
+/**
+ * Advances a frame index of the ring by @p frames frames.
+ *
+ * @param ring the ring buffer
+ * @param index the frame index, less than @c frame_count
+ * @param frames the number of frames, at most @c frame_count
+ * @return the new index
+ */
+static inline unsigned int txbuf_index_add(struct tx_buffer    *ring,
+                                           unsigned int        index,
+                                           unsigned int        frames)
+{
+    index += frames;
+    if (index >= ring->frame_count) {
+        index -= ring->frame_count;
+    }
+    return index;
+}
+
+/**
+ * Reads @c frames_read and the frame index of @c readptr consistently. Used
+ * by the writers in the shared mode.
+ *
+ * @param ring the ring buffer
+ * @param read_index the index of the frame which is transmitted next is
+ *        stored there
+ * @return the sequence number of the frame which is transmitted next
+ */
+static inline u64 txbuf_shared_read_position(struct tx_buffer  *ring,
+                                             unsigned int      *read_index)
+{
+    unsigned int    seq;
+    unsigned char   *readptr;
+    u64             ret;
+
+    do {
+        seq = ring->read_seq;
+        smp_rmb();
+        ret = ring->frames_read;
+        readptr = ring->readptr;
+        smp_rmb();
+    } while (unlikely((seq & 1) || seq != ring->read_seq));
+
+    *read_index = (readptr - ring->buffer) / ring->bytes_per_frame;
+    return ret;
+}
+
+/**
+ * Reads @c consumed and @c read_index of a writer consistently. Used by the
+ * writers in the independent mode.
+ *
+ * @param writer the writer
+ * @param read_index the index of the frame which is transmitted next is
+ *        stored there
+ * @return the sequence number of the frame which is transmitted next
+ */
+static inline u64 txbuf_independent_read_position(struct txbuf_writer *writer,
+                                                  unsigned int *read_index)
+{
+    unsigned int    seq;
+    u64             ret;
+
+    do {
+        seq = writer->read_seq;
+        smp_rmb();
+        ret = writer->consumed;
+        *read_index = writer->read_index;
+        smp_rmb();
+    } while (unlikely((seq & 1) || seq != writer->read_seq));
+
+    return ret;
+}
+
+/**
+ * Returns the number of frames which all active writers have committed, i.e.
+ * which can be transmitted. A writer which is behind @c frames_read (only
+ * possible shortly after txbuf_add_writer()) doesn't hold back the others,
+ * it catches up in txbuf_put().
+ *
+ * @param ring the ring buffer
+ * @return the number of frames, 0 if there are no writers
+ */
+static unsigned int txbuf_frames_full(struct tx_buffer *ring)
+{
+    u64             read        = ring->frames_read;
+    unsigned int    min_val     = ring->frame_count;
+    bool            writers     = false;
+    int             count       = ring->writer_count;
+    int             i;
+
+    smp_rmb();
+    for (i = 0; i < count; i++) {
+        struct txbuf_writer *writer = ring->writers[i];
+        long                full;
+
+        /* removed writer */
+        if (!writer || !writer->active) {
+            continue;
+        }
+
+        full = txbuf_seq_diff(writer->committed, read);
+        if (full >= 0) {
+            min_val = min(min_val, (unsigned int)full);
+            writers = true;
+        }
+    }
+
+    /* the frames must be read after the commit positions */
+    smp_rmb();
+
+    return writers ? min_val : 0;
+}
+
+/**
+ * Returns the number of frames a writer has committed which have not been
+ * transmitted yet. A writer behind @c frames_read has no frames in the ring.
+ *
+ * @param ring the ring buffer
+ * @param writer the writer
+ * @param read the value of @c frames_read
+ * @return the number of frames
+ */
+static inline unsigned int txbuf_writer_full(struct tx_buffer      *ring,
+                                             struct txbuf_writer   *writer,
+                                             u64                   read)
+{
+    long full = txbuf_seq_diff(writer->committed, read);
+
+    return full > 0 ? full : 0;
+}
+
+/**
+ * Returns the number of frames a writer may have queued, i.e. the size of the
+ * ring minus the free frame, limited by the latency cap of the writer.
+ *
+ * @param ring the ring buffer
+ * @param writer the writer
+ * @return the number of frames
+ */
+static inline unsigned int txbuf_writer_capacity(struct tx_buffer      *ring,
+                                                 struct txbuf_writer   *writer)
+{
+    unsigned int capacity = ring->frame_count - 1;
+
+    if (writer->max_queued != 0) {
+        capacity = min(capacity, writer->max_queued);
+    }
+    return capacity;
+}
+
+/**
+ * Implementation of txbuf_get() in the independent mode. Each writer fills its
+ * frame part with the frames it has committed. If it has not enough frames,
+ * the rest of the page is filled according to its policy and the underrun is
+ * counted, but the other writers are not held back. The filled frames are
+ * skipped in the ring of the writer, so a late writer continues at the
+ * current frame instead of transmitting its data late from then on.
+ *
+ * @param ring the ring buffer
+ * @param buffer the buffer to copy
+ * @param frames the number of frames in @p buffer
+ * @return the number of bytes copied, always all frames
+ */
+static ssize_t txbuf_get_independent(struct tx_buffer   *ring,
+                                     unsigned char      *buffer,
+                                     unsigned int       frames)
+{
+    int             hw_bpf  = ring->hw_bytes_per_frame;
+    int             count   = ring->writer_count;
+    int             i;
+    unsigned int    j;
+
+    /* the bytes which no writer transmits are silence */
+    memset(buffer, 0, frames * hw_bpf);
+
+    smp_rmb();
+    for (i = 0; i < count; i++) {
+        struct txbuf_writer *writer = ring->writers[i];
+        u64                 consumed;
+        long                queued;
+        unsigned int        part_count, copy, advance;
+        unsigned char       *src, *dst, *end;
+
+        /* removed writer or the card doesn't transmit its part yet */
+        if (!writer || !writer->active ||
+                writer->part.offset + writer->part.count > hw_bpf) {
+            continue;
+        }
+
+        consumed   = writer->consumed;
+        part_count = writer->part.count;
+        queued     = txbuf_seq_diff(writer->committed, consumed);
+        copy       = queued > 0 ? min((unsigned int)queued, frames) : 0;
+        advance    = copy;
+
+        /* the frames must be read after the commit position */
+        smp_rmb();
+
+        src = writer->buffer + writer->read_index * part_count;
+        end = writer->buffer + ring->frame_count * part_count;
+        dst = buffer + writer->part.offset;
+
+        for (j = 0; j < copy; j++) {
+            memcpy(dst, src, part_count);
+            dst += hw_bpf;
+            src += part_count;
+            if (src >= end) {
+                src = writer->buffer;
+            }
+        }
+
+        if (copy > 0) {
+            writer->underrun = false;
+        }
+
+        /* fill the rest, the slot before src is never written by the writer */
+        if (copy < frames) {
+            unsigned char *last = (src == writer->buffer ? end : src) 
+                                  - part_count;
+
+            if (writer->policy.underrun == TX_UNDERRUN_REPEAT) {
+                for (j = copy; j < frames; j++) {
+                    memcpy(dst, last, part_count);
+                    dst += hw_bpf;
+                }
+            }
+
+            /* 
+             * a writer which has never written is not late, otherwise the
+             * slots of the filled frames have gone out and are skipped
+             */
+            if (consumed + copy != 0) {
+                if (!writer->underrun) {
+                    writer->underruns++;
+                    writer->underrun = true;
+                }
+                writer->underrun_frames += frames - copy;
+                advance = frames;
+            }
+
+            /* keep the last frame part in front of the new read position */
+            if (advance > copy && 
+                    writer->policy.underrun == TX_UNDERRUN_REPEAT) {
+                unsigned int prev = txbuf_index_add(ring, writer->read_index,
+                                                    advance - 1);
+
+                memcpy(writer->buffer + prev * part_count, last, part_count);
+            }
+        }
+
+        /* 
+         * the frames must be read before the writer may overwrite them, the
+         * writer reads consumed and read_index together, see
+         * txbuf_independent_read_position()
+         */
+        smp_mb();
+        writer->read_seq++;
+        smp_wmb();
+        writer->read_index = txbuf_index_add(ring, writer->read_index, advance);
+        writer->consumed = consumed + advance;
+        smp_wmb();
+        writer->read_seq++;
+        writer->ctrl->read_offset = writer->read_index * part_count;
+    }
+
+    return frames * hw_bpf;
+}
+
 /*
  * Documentation: see header
  */
@@ -122,38 +451,58 @@ ssize_t txbuf_get(struct tx_buffer     *ring,
                   size_t                bytes)
 {
     int           to_copy;
-    unsigned long flags;
     int           byte_count; 
+    int           frames, i;
+    int           hw_bpf      = ring->hw_bytes_per_frame;
     unsigned int  ring_size   = ring->frame_count * ring->bytes_per_frame;
+    unsigned char *readp      = ring->readptr;
 
-    if ((bytes % ring->bytes_per_frame != 0) || (bytes > ring_size)) {
+    if ((bytes % hw_bpf != 0) || (bytes / hw_bpf > ring->frame_count)) {
         rtnrt_err(PR "bytes (%d) must be dividable by %d\n",
-               (int)bytes, ring->bytes_per_frame);
+               (int)bytes, hw_bpf);
         return -EINVAL;
     }
 
-    /* only copy the number of ring elements */
-    byte_count = min((size_t)ring->full_count, bytes);
+    if (ring->independent) {
+        return txbuf_get_independent(ring, buffer, bytes / hw_bpf);
+    }
 
-    /* number of bytes to copy in the first step */
-    to_copy = min(byte_count,
-                 (int)(ring_size - (unsigned long)(ring->readptr - ring->buffer)));
+    /* only copy the frames which all writers have committed */
+    frames = min(txbuf_frames_full(ring), (unsigned int)(bytes / hw_bpf));
+    byte_count = frames * ring->bytes_per_frame;
 
     /* ring is empty */
-    if (to_copy == 0) {
+    if (frames == 0) {
         return 0;
     }
 
+    if (hw_bpf != ring->bytes_per_frame) {
+        /* the card reads narrower frames than the ring stores */
+        for (i = 0; i < frames; i++) {
+            memcpy(buffer + i * hw_bpf, readp, hw_bpf);
+
+            readp += ring->bytes_per_frame;
+            if (readp >= ring->buffer + ring_size) {
+                readp = ring->buffer;
+            }
+        }
+        goto out;
+    }
+
+    /* number of bytes to copy in the first step */
+    to_copy = min(byte_count,
+                 (int)(ring_size - (unsigned long)(readp - ring->buffer)));
+
     /* copy the data */
-    memcpy(buffer, ring->readptr, to_copy);
+    memcpy(buffer, readp, to_copy);
 
     /* no overflow? */
     if (to_copy == byte_count) {
         /* adjust the ring */
-        if ((ring->readptr + to_copy) >= (ring->buffer + ring_size)) {
-            ring->readptr = ring->buffer;
+        if ((readp + to_copy) >= (ring->buffer + ring_size)) {
+            readp = ring->buffer;
         } else {
-            ring->readptr += to_copy;
+            readp += to_copy;
         }
     } else {
         /* copy the rest */
@@ -163,51 +512,334 @@ ssize_t txbuf_get(struct tx_buffer     *ring,
         memcpy(buffer, ring->buffer, to_copy);
 
         /* adjust the ring */
-        ring->readptr = ring->buffer + to_copy;
+        readp = ring->buffer + to_copy;
     }
     
-    rtnrt_lock_get_irqsave(&ring->lock, flags);
-    ring->full_count -= byte_count;
-    rtnrt_lock_put_irqrestore(&ring->lock, flags);
+out:
+    /* 
+     * the frames must be read before the writers may overwrite them, the
+     * writers read frames_read and readptr together, see
+     * txbuf_shared_read_position()
+     */
+    smp_mb();
+    ring->read_seq++;
+    smp_wmb();
+    ring->readptr = readp;
+    ring->frames_read += frames;
+    smp_wmb();
+    ring->read_seq++;
     
-    return byte_count;
+    return frames * hw_bpf;
 }
 
 /**
- * Updates the full frame count
+ * Clears a frame part in all frames of the ring.
  *
  * @param ring the ring buffer
+ * @param frame_part the frame part
  */
-static void txbuf_update_full_frame_count(struct tx_buffer *ring)
+static void txbuf_clear_part(struct tx_buffer   *ring,
+                             struct frame_part  frame_part)
 {
-    unsigned int  ring_size   = ring->frame_count * ring->bytes_per_frame;
-    int           min_val     = ring_size;
-    int           i;
+    int i;
 
+    for (i = 0; i < ring->frame_count; i++) {
+        memset(ring->buffer + i * ring->bytes_per_frame + frame_part.offset,
+               0, frame_part.count);
+    }
+}
+
+/*
+ * Documentation: see header
+ */
+void txbuf_set_hw_width(struct tx_buffer *ring, unsigned int bytes)
+{
+    return_if_fails_dbg(bytes > 0 && bytes <= ring->bytes_per_frame);
+
+    ring->hw_bytes_per_frame = bytes;
+}
+
+/**
+ * Implementation of txbuf_add_writer() in the independent mode. The writer
+ * starts with an empty ring, its frame part is silence until it writes.
+ *
+ * @param ring the ring buffer
+ * @param writer the writer, not active
+ * @param writer_index the index of the writer
+ * @param frame_part the part of the frame the writer transmits
+ * @return 0 on success, @c -ENOMEM if the ring could not be allocated
+ */
+static int txbuf_add_independent(struct tx_buffer       *ring,
+                                 struct txbuf_writer    *writer,
+                                 unsigned int           writer_index,
+                                 struct frame_part      frame_part)
+{
+    void *area;
+
+    /* 
+     * always a new ring, so a mapping of the previous one can't write into
+     * it; the caller has waited for the interrupt handler after removing the
+     * writer, so txbuf_get() doesn't use the old ring any more
+     */
+    area = vmalloc_user(PAGE_SIZE + 
+            PAGE_ALIGN(ring->frame_count * frame_part.count));
+    if (unlikely(!area)) {
+        rtnrt_err(PR "Allocating the ring of writer %d failed\n", 
+                writer_index);
+        return -ENOMEM;
+    }
+    if (writer->area) {
+        txbuf_free_area(writer);
+    }
+
+    /* zeroed by vmalloc_user() */
+    writer->area   = area;
+    writer->ctrl   = area;
+    writer->buffer = (unsigned char *)area + PAGE_SIZE;
+    writer->ctrl->state           = TX_MMAP_VALID;
+    writer->ctrl->frame_count     = ring->frame_count;
+    writer->ctrl->bytes_per_frame = frame_part.count;
+
+    writer->part            = frame_part;
+    writer->committed       = 0;
+    writer->write_index     = 0;
+    writer->consumed        = 0;
+    writer->read_index      = 0;
+    writer->underrun        = false;
+    writer->underruns       = 0;
+    writer->underrun_frames = 0;
+    smp_wmb();
+    writer->active = true;
+    if (writer_index >= ring->writer_count) {
+        smp_wmb();
+        ring->writer_count = writer_index + 1;
+    }
+
+    return 0;
+}
+
+/*
+ * Documentation: see header
+ */
+int txbuf_add_writer(struct tx_buffer           *ring,
+                     unsigned int               writer_index,
+                     struct frame_part          frame_part)
+{
+    u64                 read;
+    unsigned int        read_index;
+    unsigned int        min_val   = ring->frame_count;
+    bool                others    = false;
+    struct txbuf_writer *writer;
+    int                 i;
+
+    return_value_if_fails_dbg(writer_index < MOST_SYNC_OPENS, -EINVAL);
+    return_value_if_fails_dbg(frame_part.offset + frame_part.count <= 
+                              ring->bytes_per_frame, -EINVAL);
+
+    writer = ring->writers[writer_index];
+    if (!writer) {
+        writer = ker_malloc(sizeof(struct txbuf_writer));
+        if (unlikely(!writer)) {
+            rtnrt_err(PR "Allocating writer %d failed\n", writer_index);
+            return -ENOMEM;
+        }
+        memset(writer, 0, sizeof(struct txbuf_writer));
+        smp_wmb();
+        ring->writers[writer_index] = writer;
+    }
+
+    if (ring->independent) {
+        return txbuf_add_independent(ring, writer, writer_index, frame_part);
+    }
+
+    txbuf_clear_part(ring, frame_part);
+
+    /* the frames the other writers have completed are not delayed */
+    read = txbuf_shared_read_position(ring, &read_index);
     for (i = 0; i < ring->writer_count; i++) {
-        int bytes_full = ring->writeptr[i] - ring->readptr;
-        if (bytes_full < 0) {
-            bytes_full = ring_size + bytes_full;
+        struct txbuf_writer *other = ring->writers[i];
+
+        if (i == writer_index || !other || !other->active) {
+            continue;
         }
-        min_val = min(min_val, bytes_full);
+        min_val = min(min_val, txbuf_writer_full(ring, other, read));
+        others = true;
+    }
+
+    if (!others) {
+        min_val = 0;
+    }
+    writer->committed = read + min_val;
+    writer->write_index = txbuf_index_add(ring, read_index, min_val);
+    smp_wmb();
+    writer->active = true;
+    if (writer_index >= ring->writer_count) {
+        smp_wmb();
+        ring->writer_count = writer_index + 1;
     }
-    ring->full_count = min_val;
+
+    return 0;
 }
 
 /*
  * Documentation: see header
  */
-bool txbuf_is_full(struct tx_buffer *ring, int writer_index)
+void txbuf_remove_writer(struct tx_buffer       *ring,
+                         unsigned int           writer_index,
+                         struct frame_part      frame_part)
+{
+    return_if_fails_dbg(writer_index < MOST_SYNC_OPENS);
+    return_if_fails_dbg(ring->writers[writer_index] != NULL);
+    return_if_fails_dbg(frame_part.offset + frame_part.count <= 
+                        ring->bytes_per_frame);
+
+    ring->writers[writer_index]->active = false;
+    smp_wmb();
+
+    if (!ring->independent) {
+        txbuf_clear_part(ring, frame_part);
+    }
+}
+
+/*
+ * Documentation: see header
+ */
+void txbuf_set_policy(struct tx_buffer          *ring,
+                      unsigned int              writer_index,
+                      const struct tx_policy    *policy)
+{
+    return_if_fails_dbg(writer_index < MOST_SYNC_OPENS);
+    return_if_fails_dbg(ring->writers[writer_index] != NULL);
+
+    ring->writers[writer_index]->policy = *policy;
+}
+
+/*
+ * Documentation: see header
+ */
+void txbuf_set_max_queued(struct tx_buffer      *ring,
+                          unsigned int          writer_index,
+                          unsigned int          frames)
+{
+    return_if_fails_dbg(writer_index < MOST_SYNC_OPENS);
+    return_if_fails_dbg(ring->writers[writer_index] != NULL);
+
+    ring->writers[writer_index]->max_queued = frames;
+}
+
+/**
+ * Returns the sequence number of the frame which is transmitted next for a
+ * writer.
+ *
+ * @param ring the ring buffer
+ * @param writer the writer
+ * @return the read position
+ */
+static inline u64 txbuf_read_position(struct tx_buffer      *ring,
+                                      struct txbuf_writer   *writer)
+{
+    return ring->independent ? writer->consumed : ring->frames_read;
+}
+
+/*
+ * Documentation: see header
+ */
+void txbuf_get_stats(struct tx_buffer   *ring,
+                     unsigned int       writer_index,
+                     struct tx_stats    *stats)
+{
+    struct txbuf_writer *writer;
+
+    return_if_fails_dbg(writer_index < MOST_SYNC_OPENS);
+    return_if_fails_dbg(ring->writers[writer_index] != NULL);
+
+    writer = ring->writers[writer_index];
+    stats->position        = writer->committed;
+    stats->queued_frames   = txbuf_writer_full(ring, writer, 
+                                txbuf_read_position(ring, writer));
+    stats->underruns       = writer->underruns;
+    stats->underrun_frames = writer->underrun_frames;
+}
+
+/*
+ * Documentation: see header
+ */
+int txbuf_commit(struct tx_buffer       *ring,
+                 unsigned int           writer_index,
+                 unsigned int           frames)
 {
-    unsigned int   ring_size    = ring->frame_count * ring->bytes_per_frame;
-    int            bytes_full;
+    struct txbuf_writer *writer;
+    u64                 read;
+    unsigned int        read_index, queued, capacity;
 
-    bytes_full = ring->writeptr[writer_index] - ring->readptr;
-    if (bytes_full < 0) {
-        bytes_full = ring_size + bytes_full;
+    return_value_if_fails_dbg(writer_index < MOST_SYNC_OPENS, -EINVAL);
+    return_value_if_fails_dbg(ring->writers[writer_index] != NULL, -EINVAL);
+
+    if (!ring->independent) {
+        return -ENODEV;
+    }
+    writer = ring->writers[writer_index];
+
+    read = txbuf_independent_read_position(writer, &read_index);
+    smp_mb();
+
+    /* 
+     * the slots of a writer behind the read position have gone out, its
+     * frame parts are dropped and it continues at the read position
+     */
+    if (txbuf_seq_diff(read, writer->committed) > 0) {
+        writer->write_index = read_index;
+        writer->committed = read;
+        writer->ctrl->write_offset = read_index * writer->part.count;
+        return -EPIPE;
     }
 
-    return bytes_full == (int)(ring_size - ring->bytes_per_frame);
+    /* one frame part stays free, see txbuf_get_independent() */
+    queued   = txbuf_seq_diff(writer->committed, read);
+    capacity = txbuf_writer_capacity(ring, writer);
+    frames   = min(frames, queued < capacity ? capacity - queued : 0);
+
+    /* the frames which userspace has stored must be visible before */
+    smp_wmb();
+    writer->write_index = txbuf_index_add(ring, writer->write_index, frames);
+    writer->committed += frames;
+    writer->ctrl->write_offset = writer->write_index * writer->part.count;
+
+    return frames;
+}
+
+#ifndef USP_TEST
+/*
+ * Documentation: see header
+ */
+int txbuf_mmap(struct tx_buffer         *ring,
+               unsigned int             writer_index,
+               struct vm_area_struct    *vma)
+{
+    unsigned long size = vma->vm_end - vma->vm_start;
+
+    /* the writers have no ring of their own */
+    if (!ring->independent) {
+        return -ENODEV;
+    }
+
+    if (size > txbuf_mmap_size(ring, writer_index)) {
+        return -EINVAL;
+    }
+
+    return remap_vmalloc_range(vma, ring->writers[writer_index]->area, 0);
+}
+#endif
+
+/*
+ * Documentation: see header
+ */
+bool txbuf_is_full(struct tx_buffer *ring, int writer_index)
+{
+    struct txbuf_writer *writer = ring->writers[writer_index];
+
+    return txbuf_writer_full(ring, writer, txbuf_read_position(ring, writer))
+        >= txbuf_writer_capacity(ring, writer);
 }
 
 /*
@@ -220,33 +852,58 @@ ssize_t txbuf_put(struct tx_buffer              *ring,
                   size_t                        bytes,
                   struct rtnrt_memcopy_desc     *copy)
 {
-    int            frames_to_copy, still_to_copy;
-    unsigned long  flags;
-    int            bytes_full;
-    unsigned int   elements_free;
-    int            err;
-    int            offset_bytes = frame_part.offset;
-    int            count_bytes  = frame_part.count;
-    unsigned int   ring_size    = ring->frame_count * ring->bytes_per_frame;
-    unsigned char  *writep      = ring->writeptr[writer_index];
-    unsigned char  *ring_end    = ring->buffer + ring_size;
+    int                 frames_to_copy, still_to_copy;
+    u64                 read, committed;
+    unsigned int        read_index, write_index;
+    unsigned int        elements_free, queued, capacity;
+    int                 err;
+    int                 offset_bytes = frame_part.offset;
+    int                 count_bytes  = frame_part.count;
+    struct txbuf_writer *writer      = ring->writers[writer_index];
+    unsigned char       *base        = ring->buffer;
+    unsigned int        stride       = ring->bytes_per_frame;
+    unsigned char       *writep;
+    unsigned char       *ring_end;
 
 #ifdef DEBUG
     /* check the bytes */
     if (bytes % count_bytes != 0) {
         rtnrt_err(PR "bytes (%d) must be dividable by %d\n", 
-                bytes, count_bytes);
+                (int)bytes, count_bytes);
         return -EINVAL;
     }
 #endif
 
-    /* don't overwrite something, get the number of elements to copy */
-    bytes_full = writep - ring->readptr;
-    if (bytes_full < 0) {
-        bytes_full = ring_size + bytes_full;
+    /* in the independent mode, the writer's ring contains only its part */
+    if (ring->independent) {
+        base = writer->buffer;
+        stride = count_bytes;
+        offset_bytes = 0;
+    }
+    ring_end = base + ring->frame_count * stride;
+
+    /* the frames must not be written before they have been transmitted */
+    if (ring->independent) {
+        read = txbuf_independent_read_position(writer, &read_index);
+    } else {
+        read = txbuf_shared_read_position(ring, &read_index);
     }
-    elements_free  = ring->frame_count - (bytes_full / (ring->bytes_per_frame));
-    frames_to_copy = min((size_t)elements_free - 1, bytes / count_bytes);
+    smp_mb();
+
+    /* a writer behind the read position continues there */
+    committed = writer->committed;
+    write_index = writer->write_index;
+    if (txbuf_seq_diff(read, committed) > 0) {
+        committed = read;
+        write_index = read_index;
+    }
+    writep = base + write_index * stride;
+
+    /* don't overwrite something and stay within the latency cap */
+    queued         = txbuf_seq_diff(committed, read);
+    capacity       = txbuf_writer_capacity(ring, writer);
+    elements_free  = queued < capacity ? capacity - queued : 0;
+    frames_to_copy = min((size_t)elements_free, bytes / count_bytes);
 
     pr_txbuf_debug(PR "elements free: %d, frames to copy: %d\n", 
                            elements_free, frames_to_copy);
@@ -264,24 +921,27 @@ ssize_t txbuf_put(struct tx_buffer              *ring,
         if (err != 0) {
             rtnrt_err(PR "Error %d in copy, copied %d frames\n", 
                    err, frames_to_copy - still_to_copy);
-            return (frames_to_copy - still_to_copy) * count_bytes;
+            frames_to_copy -= still_to_copy;
+            break;
         }
 
-        writep += ring->bytes_per_frame;
+        writep += stride;
 
         /* wrap at the end */
         if (writep >= ring_end) {
-            writep = ring->buffer;
+            writep = base;
         }
         buffer += count_bytes;
         still_to_copy--;
     }
 
-    /* adjust the ring */
-    rtnrt_lock_get_irqsave(&ring->lock, flags);
-    ring->writeptr[writer_index] = writep;
-    txbuf_update_full_frame_count(ring);
-    rtnrt_lock_put_irqrestore(&ring->lock, flags);
+    /* commit the frames, the data must be visible before */
+    smp_wmb();
+    writer->write_index = txbuf_index_add(ring, write_index, frames_to_copy);
+    writer->committed = committed + frames_to_copy;
+    if (ring->independent) {
+        writer->ctrl->write_offset = writer->write_index * count_bytes;
+    }
 
     return frames_to_copy * count_bytes;
 
@@ -300,40 +960,57 @@ void txbuf_print_debug(struct tx_buffer *ring)
 
     spin_lock(&print_lock);
     rtnrt_debug("Frames in ring       : %d\n", ring->frame_count);
-    rtnrt_debug("Full bytes           : %d\n", ring->full_count);
+    rtnrt_debug("Frames read          : %llu\n", 
+            (unsigned long long)ring->frames_read);
     rtnrt_debug("Bytes per frame      : %d\n", ring->bytes_per_frame);
-    rtnrt_debug("Read offset          : %d\n", ring->readptr - ring->buffer);
+    rtnrt_debug("Read offset          : %d\n", 
+            (int)(ring->readptr - ring->buffer));
 
     /* now print the information per writer */
     for (i = 0; i < ring->writer_count; i++) {
-        rtnrt_debug("Write offset   [%2d]  : %d\n", i, 
-                ring->writeptr[i] - ring->buffer);
+        if (ring->writers[i] && ring->writers[i]->active) {
+            rtnrt_debug("Committed      [%2d]  : %llu (read %llu)\n", i, 
+                    (unsigned long long)ring->writers[i]->committed, 
+                    (unsigned long long)txbuf_read_position(ring, 
+                        ring->writers[i]));
+        }
     }
 
-    for (i = 0; i < min(16, (int)ring_size); i++) {
+    for (i = 0; ring->buffer && i < min(16, (int)ring_size); i++) {
         rtnrt_printk("%-2.2X ", ring->buffer[i]);
     }
 
-    printk("\n");
+    rtnrt_printk("\n");
     spin_unlock(&print_lock);
 }
 #endif
 
 
 #ifdef USP_TEST
+/**
+ * Copy function of the test, see struct rtnrt_memcopy_desc.
+ */
+static unsigned long usp_copy(void *to, const void *from, size_t count,
+                              void *cookie)
+{
+    memcpy(to, from, count);
+    return 0;
+}
+
 /* gcc -g -DDEBUG -DUSP_TEST -o most-txbuf most-txbuf.c */
 int main(int argc, char *argv[])
 {
     struct frame_part frame_part;
-    unsigned char       user_data[] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 
+    char                user_data[] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 
                                        10, 11, 12, 13, 14, 15, 16 };
     unsigned char       data[1024];
     struct tx_buffer    *buffer;
+    struct rtnrt_memcopy_desc copy = { usp_copy, NULL };
     int                 err;
 
     pr_debugm("BEGIN\n");
 
-    buffer = txbuf_alloc(2, 5, 6);
+    buffer = txbuf_alloc(5, 6, false);
     if (!buffer) {
         pr_err("Error in tvbuf_alloc\n\n\n");
         return -1;
@@ -341,21 +1018,28 @@ int main(int argc, char *argv[])
 
     frame_part.offset = 0;
     frame_part.count  = 4;
-    err = txbuf_put(buffer, 0, frame_part, user_data, 4);
+    txbuf_add_writer(buffer, 0, frame_part);
+    frame_part.offset = 4;
+    frame_part.count  = 2;
+    txbuf_add_writer(buffer, 1, frame_part);
+
+    frame_part.offset = 0;
+    frame_part.count  = 4;
+    err = txbuf_put(buffer, 0, frame_part, user_data, 4, &copy);
     pr_debugm("Err=%d\n", err);
     printf("==Full=%d, %d\n", txbuf_is_full(buffer, 0), txbuf_is_full(buffer, 1));
 
-    err = txbuf_put(buffer, 0, frame_part, user_data + 4, 8);
+    err = txbuf_put(buffer, 0, frame_part, user_data + 4, 8, &copy);
     pr_debugm("Err=%d\n", err);
     printf("==Full=%d, %d\n", txbuf_is_full(buffer, 0), txbuf_is_full(buffer, 1));
 
-    err = txbuf_put(buffer, 0, frame_part, user_data, 12);
+    err = txbuf_put(buffer, 0, frame_part, user_data, 12, &copy);
     pr_debugm("Err=%d\n", err);
     printf("==Full=%d, %d\n", txbuf_is_full(buffer, 0), txbuf_is_full(buffer, 1));
 
     frame_part.offset = 4;
     frame_part.count = 2;
-    err = txbuf_put(buffer, 1, frame_part, user_data, 6);
+    err = txbuf_put(buffer, 1, frame_part, user_data, 6, &copy);
     pr_debugm("Err=%d\n", err);
 
     err = txbuf_get(buffer, data, 24);
@@ -365,7 +1049,7 @@ int main(int argc, char *argv[])
 
     frame_part.offset = 0;
     frame_part.count  = 4;
-    err = txbuf_put(buffer, 0, frame_part, user_data, 12);
+    err = txbuf_put(buffer, 0, frame_part, user_data, 12, &copy);
     pr_debugm("Err=%d\n", err);
     txbuf_print_debug(buffer);
 
@@ -35,13 +35,72 @@
 #  include <asm/uaccess.h>            /* copy_from_user() */
 #  include <linux/module.h>
 #  include <linux/wait.h>
+#  include <linux/mm.h>
+#  include "rt-nrt.h"
 #else
 #  include "usp-test.h"
 #endif
 
 #include "most-common.h"
 #include "most-constants.h"
-#include "rt-nrt.h"
+
+/**
+ * State of one writer of a struct tx_buffer. Each writer is allocated
+ * separately and on its own cache line, so writers on different CPUs don't
+ * share cache lines.
+ *
+ * Only the writer itself modifies @c committed and @c write_index, the
+ * interrupt service routine only reads @c committed. The frames are written
+ * before @c committed is advanced (smp_wmb()), so no lock is needed between
+ * them. As the 64 bit sequence numbers can't be read atomically on all
+ * architectures, the other side only uses their difference, see
+ * txbuf_seq_diff(). In the independent mode, only txbuf_get() modifies
+ * @c consumed and @c read_index, the writer reads them together under
+ * @c read_seq.
+ */
+struct txbuf_writer {
+    u64               committed;                  /**< sequence number of the
+                                                       frame which is written
+                                                       next, i.e. all frames
+                                                       before are complete */
+    unsigned int      write_index;                /**< number of the frame
+                                                       which is written next,
+                                                       belongs to
+                                                       @c committed */
+    bool              active;                     /**< @c false if the writer
+                                                       has been removed */
+    unsigned int      max_queued;                 /**< maximum number of frames
+                                                       the writer may be ahead
+                                                       of the transmission, 0
+                                                       for the whole ring */
+
+    /* only used in the independent mode */
+    void              *area;                      /**< the allocated memory:
+                                                       control page followed by
+                                                       @c buffer */
+    struct tx_mmap_ctrl *ctrl;                    /**< the control page (start
+                                                       of @c area) */
+    unsigned char     *buffer;                    /**< ring of frame parts of
+                                                       this writer */
+    struct frame_part part;                       /**< frame part of the
+                                                       writer */
+    u64               consumed;                   /**< sequence number of the
+                                                       frame which txbuf_get()
+                                                       transmits next */
+    unsigned int      read_index;                 /**< number of the frame
+                                                       which txbuf_get()
+                                                       transmits next, belongs
+                                                       to @c consumed */
+    unsigned int      read_seq;                   /**< sequence counter for
+                                                       @c consumed and
+                                                       @c read_index */
+    struct tx_policy  policy;                     /**< underrun policy */
+    bool              underrun;                   /**< the writer had no data
+                                                       in the last page */
+    unsigned int      underruns;                  /**< number of underruns */
+    u64               underrun_frames;            /**< number of filled
+                                                       frames */
+} ____cacheline_aligned_in_smp;
 
 /**
  * Transfer buffer for MOST, implemented as ringbuffer. The buffer is one large
@@ -50,68 +109,145 @@
  * them in the change buffer.
  *
  * The processes (write syscall) place their contents in this ring buffer. As
- * this happen asynchronously, there's a write pointer for each writer which
- * points to the frame which should be written next (to the beginning of the
- * frame).
+ * this happen asynchronously, each writer has its own commit position (a
+ * frame sequence number, see struct txbuf_writer). The interrupt service
+ * routine transmits the frames up to the minimum commit position of all
+ * writers and then advances @c frames_read. Both sides only read the
+ * position of the other side, so neither a lock nor disabling interrupts is
+ * needed in txbuf_put() and txbuf_get().
+ *
+ * In the independent mode (@c independent), each writer has its own ring of
+ * frame parts instead and txbuf_get() assembles the frames from them. A writer
+ * that has no data doesn't hold back the others, its frame part is filled
+ * according to its struct tx_policy and the underrun is counted. The frames
+ * of the page which it missed are skipped in its ring, so when it writes
+ * again, its data is transmitted from the next page on instead of being
+ * delayed by the underrun. The ring of a writer is allocated with
+ * vmalloc_user() behind a control page (struct tx_mmap_ctrl), so the writer
+ * can map it with txbuf_mmap() and publish the frames with txbuf_commit()
+ * instead of copying them with txbuf_put().
  *
- * To determine the number of full elements in the interrupt service fast,
- * there's a special variable. This is only a performance optimization.
+ * Up to MOST_SYNC_OPENS writers are allocated on demand, see struct
+ * txbuf_writer.
  */
 struct tx_buffer {
-    unsigned char     *buffer;                    /**< the ring buffer */
-    unsigned char     *writeptr[MOST_SYNC_OPENS]; /**< The write pointers. Points 
-                                                       to the first byte of the
-                                                       quadlet which should be
-                                                       written next. */
-    int               writer_count;               /**< number of writers */
+    unsigned char     *buffer;                    /**< the ring buffer, @c NULL
+                                                       in the independent
+                                                       mode */
+    bool              independent;                /**< each writer has its own
+                                                       ring */
+    struct txbuf_writer **writers;                /**< the writers, MOST_SYNC_OPENS
+                                                       entries, @c NULL if not
+                                                       allocated */
+    int               writer_count;               /**< number of writers, i.e. the
+                                                       highest writer index plus
+                                                       one */
     unsigned char     *readptr;                   /**< the read pointer */
-    unsigned int      full_count;                 /**< number of bytes which are filled
-                                                       and can be transferred */
-    rtnrt_lock_t      lock;                       /**< locking for the element count
-                                                       because it's motified by every
-                                                       reader, maybe concurrently */
+    u64               frames_read;                /**< sequence number of the frame
+                                                       which is transmitted next,
+                                                       only modified by
+                                                       txbuf_get() */
+    unsigned int      read_seq;                   /**< sequence counter for
+                                                       @c frames_read and
+                                                       @c readptr */
     int               frame_count;                /**< number of maximum frames in the
                                                        ring */
     int               bytes_per_frame;            /**< number of quadlets per frame */
+    int               hw_bytes_per_frame;         /**< number of bytes per frame in
+                                                       the pages of the card, at
+                                                       most @c bytes_per_frame,
+                                                       see txbuf_set_hw_width() */
 };
 
 
 /**
- * @param writer_count the number of writers
+ * Allocates a ring buffer without writers, they are added with
+ * txbuf_add_writer().
+ *
  * @param frame_count the number of frames that are in the ring buffer
  * @param bytes_per_frame the number of bytes needed per frame
+ * @param independent @c true if each writer should get its own ring, see
+ *        struct tx_buffer
  *  
  * @return the allocated ring buffer or NULL if the ring buffer could not be
  *         allocated (an error message will be printed)
  */
-struct tx_buffer *txbuf_alloc(unsigned int writer_count, 
-                              unsigned int frame_count,
-                              unsigned int bytes_per_frame);
+struct tx_buffer *txbuf_alloc(unsigned int frame_count,
+                              unsigned int bytes_per_frame,
+                              bool         independent);
 
 /**
  * Frees the ring buffer. Don't use @p ring after calling this function any
- * more.
+ * more. The transmit interrupt must have been disabled and waited for
+ * (most_intsync()) before, as txbuf_get() may still read the ring otherwise.
  *
  * @param ring the ring buffer
  */
 void txbuf_free(struct tx_buffer *ring);
 
 /**
- * Reads element_count frames from the ring buffer.
+ * Sets the number of bytes per frame which the card reads from its pages,
+ * i.e. the frame width used in txbuf_get(). If this is less than
+ * @c bytes_per_frame of the ring, only the beginning of each frame is
+ * transmitted. Must be called in the context of the interrupt handler or with
+ * the interrupt disabled.
+ *
+ * @param ring the ring buffer
+ * @param bytes the number of bytes, at most @c bytes_per_frame
+ */
+void txbuf_set_hw_width(struct tx_buffer *ring, unsigned int bytes);
+
+/**
+ * Adds a writer to a running ring buffer. The writer starts at the position
+ * of the writer which is most behind, so the frames which are already
+ * complete are transmitted without interruption. Its frame part is cleared
+ * in the whole ring. In the independent mode, the writer starts with an empty
+ * ring of its own instead. The state of the writer is allocated if the index
+ * has not been used before. Must not be called in interrupt context. The caller
+ * serializes txbuf_add_writer() and txbuf_remove_writer().
+ *
+ * @param ring the ring buffer
+ * @param writer_index the index of the new writer, less than MOST_SYNC_OPENS
+ * @param frame_part the part of the frame the writer transmits
+ * @return 0 on success, @c -ENOMEM if the writer could not be allocated
+ */
+int txbuf_add_writer(struct tx_buffer           *ring,
+                     unsigned int               writer_index,
+                     struct frame_part          frame_part);
+
+/**
+ * Removes a writer from a running ring buffer. The other writers are not
+ * waited for it any more and its frame part is cleared in the whole ring, so
+ * silence is transmitted there. txbuf_get() may still use the writer until it
+ * returns, so the caller waits for the interrupt handler (most_intsync())
+ * before the index is added again.
+ *
+ * @param ring the ring buffer
+ * @param writer_index the index of the writer
+ * @param frame_part the part of the frame the writer transmitted
+ */
+void txbuf_remove_writer(struct tx_buffer       *ring,
+                         unsigned int           writer_index,
+                         struct frame_part      frame_part);
+
+/**
+ * Reads element_count frames from the ring buffer. Only one context (the
+ * interrupt service routine) may call this function at a time.
  *
  * @param ring the ring buffer
  * @param buffer the buffer to copy (usually a DMA buffer)
- * @param bytes the number of bytes that should be copied. If there are
- *        less than bytes elements in the ring, only the number of elements in
- *        the ring are copied
- * @return the number of elements copied
+ * @param bytes the number of bytes that should be copied, in frames of
+ *        @c hw_bytes_per_frame bytes. If there are less frames in the ring,
+ *        only the frames in the ring are copied
+ * @return the number of bytes copied
  */
 ssize_t txbuf_get(struct tx_buffer      *ring, 
                   unsigned char         *buffer,
                   size_t                bytes);
 
 /**
- * Puts @p bytes bytes in the ring.
+ * Puts @p bytes bytes in the ring. Only one thread may put data for the same
+ * @p writer_index at a time.
  *
  * @param ring the ring buffer
  * @param writer_index the index of the writer that wants to put data in the
@@ -132,7 +268,97 @@ ssize_t txbuf_put(struct tx_buffer              *ring,
                   struct rtnrt_memcopy_desc     *copy);
 
 /**
- * Checks if the buffer is full for the specified writer.
+ * Sets the underrun policy of a writer, see MOST_SYNC_TX_SET_POLICY. Only
+ * used in the independent mode.
+ *
+ * @param ring the ring buffer
+ * @param writer_index the index of the writer
+ * @param policy the new policy
+ */
+void txbuf_set_policy(struct tx_buffer          *ring,
+                      unsigned int              writer_index,
+                      const struct tx_policy    *policy);
+
+/**
+ * Sets the maximum number of frames a writer may have queued, see
+ * MOST_SYNC_TX_SET_LATENCY. txbuf_put() and txbuf_commit() don't accept more
+ * and txbuf_is_full() reports the writer as full when it is reached.
+ *
+ * @param ring the ring buffer
+ * @param writer_index the index of the writer
+ * @param frames the number of frames, 0 for the size of the ring
+ */
+void txbuf_set_max_queued(struct tx_buffer      *ring,
+                          unsigned int          writer_index,
+                          unsigned int          frames);
+
+/**
+ * Gets the statistics of a writer, see MOST_SYNC_TX_GET_STATS.
+ *
+ * @param ring the ring buffer
+ * @param writer_index the index of the writer
+ * @param stats the statistics are stored there
+ */
+void txbuf_get_stats(struct tx_buffer   *ring,
+                     unsigned int       writer_index,
+                     struct tx_stats    *stats);
+
+/**
+ * Publishes @p frames frame parts which the writer has stored directly in its
+ * mapped ring (see txbuf_mmap()) at the write offset of its control page. Only
+ * available in the independent mode.
+ *
+ * @param ring the ring buffer
+ * @param writer_index the index of the writer
+ * @param frames the number of frame parts
+ * @return the number of frame parts committed, less than @p frames if the
+ *         ring has not enough free space, @c -EPIPE if the writer was behind
+ *         the transmission (the frame parts are dropped and the write offset
+ *         moves to the read offset), @c -ENODEV if the ring is not in the
+ *         independent mode
+ */
+int txbuf_commit(struct tx_buffer       *ring,
+                 unsigned int           writer_index,
+                 unsigned int           frames);
+
+/**
+ * Returns the number of bytes that can be mapped with txbuf_mmap() for a
+ * writer, i.e. the size of the control page plus the page-aligned size of its
+ * ring. 0 if the ring is not in the independent mode.
+ *
+ * @param ring the ring buffer
+ * @param writer_index the index of the writer
+ */
+static inline size_t txbuf_mmap_size(struct tx_buffer *ring,
+                                     unsigned int     writer_index)
+{
+    struct txbuf_writer *writer = ring->writers[writer_index];
+
+    if (!ring->independent) {
+        return 0;
+    }
+    return PAGE_SIZE + PAGE_ALIGN(ring->frame_count * writer->part.count);
+}
+
+#ifndef USP_TEST
+/**
+ * Maps the control page and the ring of a writer into the address space
+ * described by @p vma. Only available in the independent mode.
+ *
+ * @param ring the ring buffer
+ * @param writer_index the index of the writer
+ * @param vma the virtual memory area as passed to the mmap() file operation
+ * @return 0 on success, a negative error code on failure (@c -ENODEV if the
+ *         ring is not in the independent mode)
+ */
+int txbuf_mmap(struct tx_buffer         *ring,
+               unsigned int             writer_index,
+               struct vm_area_struct    *vma);
+#endif
+
+/**
+ * Checks if the buffer is full for the specified writer, i.e. if it has
+ * queued the maximum number of frames (see txbuf_set_max_queued()).
  *
  * @param ring the ring buffer
  * @param writer_index the index of the writer
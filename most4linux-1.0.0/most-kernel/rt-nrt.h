@@ -44,6 +44,7 @@
 #include <linux/spinlock.h>
 #include <linux/interrupt.h>
 #include <linux/delay.h>
+#include <linux/hrtimer.h>
 
 #ifdef RT_RTDM
 #   include <rtdm/rtdm_driver.h>
@@ -510,8 +511,8 @@ typedef uint64_t nanosecs_rel_t;
 #if defined(RT_RTDM) || defined(DOXYGEN)
 
 /**
- * Get a system timestamp in nanoseconds. Uses getnstimeofday() on Linux so
- * the precision is only microseconds.
+ * Get a system timestamp in nanoseconds. Uses ktime_get() on Linux, i.e. the
+ * monotonic clock which doesn't jump if the time of day is set.
  *
  * It's important that timers have been startet if using in real-time mode.
  * On RTAI, the timers must run in @e oneshot mode to give precise timing
@@ -534,10 +535,7 @@ static inline nanosecs_abs_t rtnrt_clock_read(void)
 
 static inline nanosecs_abs_t rtnrt_clock_read(void)
 {
-    struct timespec ts;
-
-    getnstimeofday(&ts);
-    return (nanosecs_abs_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+    return ktime_to_ns(ktime_get());
 }
 
 #endif
@@ -28,7 +28,15 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <errno.h>
+#include <limits.h>
+#include <sys/types.h>
+
+/* kernel types */
+typedef unsigned long long      u64;
+typedef unsigned int            u32;
+typedef int                     s32;
 
 /* no user memory */
 #define __user
@@ -47,6 +55,11 @@
 #define pr_emerg                printf
 #define pr_rxbuf_debug			printf
 #define pr_txbuf_debug			printf
+#define rtnrt_printk            printf
+#define rtnrt_debug             printf
+#define rtnrt_info              printf
+#define rtnrt_warn              printf
+#define rtnrt_err               printf
 
 /* suppress compiler warnings */
 #define do_nothing              do{} while (0);
@@ -56,6 +69,24 @@
 #define ker_malloc(m)           malloc(m)
 #define vmalloc(m)              malloc(m)
 #define vfree(m)                free(m)
+#define vmalloc_user(m)         calloc(1, m)
+
+/* pages */
+#define PAGE_SIZE               4096UL
+#define PAGE_ALIGN(addr)        (((addr) + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1))
+
+/* no cache line alignment */
+#define ____cacheline_aligned_in_smp
+
+/* no other processors */
+#define smp_wmb()               do_nothing
+#define smp_rmb()               do_nothing
+#define smp_mb()                do_nothing
+
+/* 64 bit division */
+#define NSEC_PER_SEC            1000000000L
+#define NSEC_PER_USEC           1000L
+#define do_div(n, base)         ((n) /= (base))
 
 /* memory copying */
 static inline int my_memcpy(void *dst, void *src, int size)
@@ -69,6 +100,20 @@ static inline int my_memcpy(void *dst, void *src, int size)
 #define copy_to_user(a, b, c)   \
     my_memcpy(a, b, c)
 
+/* same as in rt-nrt.h */
+typedef unsigned long (*rtnrt_memcopy_func)(void              *to, 
+                                            const void        *from, 
+                                            unsigned long     count,
+                                            void              *cookie);
+
+struct rtnrt_memcopy_desc {
+    rtnrt_memcopy_func  function;
+    void                *cookie;
+};
+
+#define rtnrt_copy(desc, to, from, count)   \
+    (desc)->function(to, from, count, (desc)->cookie)
+
 /* some algorithms */
 #define min(a,b)                (((a) < (b)) ? (a) : (b))
 #define max(a,b)                (((a) > (b)) ? (a) : (b))
@@ -79,6 +124,17 @@ static inline int my_memcpy(void *dst, void *src, int size)
 #define write_lock_irqsave(a,b)         do_nothing
 #define write_unlock_irqrestore(a,b)    do_nothing
 
+#define spinlock_t                      int
+#define RTNRT_LSPINLOCK_UNLOCKED(a)     0
+#define spin_lock(a)                    do { (void)(a); } while (0)
+#define spin_unlock(a)                  do { (void)(a); } while (0)
+
+#define rtnrt_lock_t                    int
+#define rtnrt_lockctx_t                 int
+#define rtnrt_lock_init(a)              do_nothing
+#define rtnrt_lock_get_irqsave(a,b)     do { (void)(b); } while (0)
+#define rtnrt_lock_put_irqrestore(a,b)  do_nothing
+
 /* no initialization for locking function */
 #define rwlock_init(a)                  do_nothing
 #define init_waitqueue_head(a)          do_nothing
@@ -88,5 +144,21 @@ static inline int my_memcpy(void *dst, void *src, int size)
 
 /* compile specific */
 #define unlikely(x)  __builtin_expect(!!(x), 0)
+#define likely(x)    __builtin_expect(!!(x), 1)
+
+/* assertions */
+#define return_value_if_fails_dbg(expression, value)            \
+    do {                                                        \
+        if (!(expression)) {                                    \
+            return value;                                       \
+        }                                                       \
+    } while (0)
+
+#define return_if_fails_dbg(expression)                         \
+    do {                                                        \
+        if (!(expression)) {                                    \
+            return;                                             \
+        }                                                       \
+    } while (0)
 
 #endif /* USP_TEST_H */